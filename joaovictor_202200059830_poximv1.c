@@ -1,6 +1,6 @@
 //
 // Poxim-V C simulator example
-// 
+//
 // (C) Copyright 2024 Bruno Otavio Piedade Prado
 //
 // This file is part of Poxim-V.
@@ -20,1071 +20,7996 @@
 //
 
 // How to build and run:
-// $ gcc -Wall -O3 nomesobrenome_123456789012_exemplo.c -o nomesobrenome_123456789012_exemplo.elf
+// $ gcc -Wall -O3 nomesobrenome_123456789012_exemplo.c -o nomesobrenome_123456789012_exemplo.elf -lpthread
 // $ ./nomesobrenome_123456789012_exemplo.elf input.hex output.out
+// The input may also be an RV32 ELF executable (detected by its header): PT_LOAD
+// segments are copied to their physical addresses, pc starts at the entry point
+// and function symbols label the text trace and the profile.
+// Machine mode: csrrw/csrrs/csrrc (and immediate forms) on mstatus, misa, mie, mtvec,
+// mscratch, mepc, mcause, mtval, mip, mcycle, minstret, the read-only counters and the
+// ID registers, ecall and mret; unknown instructions and illegal CSR accesses trap once
+// mtvec is set (halting otherwise), and CLINT timer and software interrupts are taken
+// after control flow (at block boundaries).
+// Compressed (RVC) instructions are expanded to their 32-bit equivalents once, when
+// decoded, and traced with a "c." prefix; the block and jit engines run them (and
+// instructions not aligned to 4 bytes) one by one.
+// Options (before input and output):
+//   --engine=interp|threaded|block|jit execution engine (default interp)
+//   --trace=on|off             trace output (default on)
+//   --trace-pc=FIRST:LAST      trace only pc in [FIRST, LAST] (hexadecimal)
+//   --trace-window=FIRST:COUNT trace only COUNT instructions from the FIRST-th
+//   --dump-mem=FILE            write final memory as a hexadecimal file
+//   --trace-format=text|binary trace lines or fixed-size binary records
+//   --render                   convert a binary trace (input) to text (output)
+//   --mem-size=SIZE            guest memory size, with optional K/M/G suffix (default 32K)
+//   --harts=N                  harts sharing the memory, one host thread each (default 1);
+//                              hart k > 0 traces to "output.hart<k>"
+//   --merge-trace              run harts round-robin, one instruction each, into a single
+//                              text trace with "[k] " line prefixes (deterministic)
+//   --batch=MANIFEST           simulate the "input output [dump]" lines of MANIFEST (no
+//                              input or output arguments) on a work-stealing thread pool;
+//                              the exit status is 1 when any image fails, faults or exits
+//                              nonzero
+//   --jobs=N                   batch host threads (default: online processors)
+//   --timing[=SETTINGS]        cycle-approximate timing model (in-order pipeline, I/D caches);
+//                              SETTINGS is key=value,... with fetch, decode, execute, div,
+//                              branch and miss in cycles, icache and dcache as SIZE:WAYS:LINE
+//                              (default fetch=1,decode=1,execute=1,div=34,branch=2,miss=20,
+//                              icache=16K:4:64,dcache=16K:4:64)
+//   --bpred=LIST               branch predictors simulated together, LIST is name[:bits],...
+//                              with static, bimodal (12), gshare (12) and tage (10), bits
+//                              being log2 entries per table (the first one drives the timing
+//                              model branch penalty)
+//   --profile[=N]              count executions per instruction and report the mnemonic
+//                              histogram, load/store widths and the N (default 16) hottest
+//                              instructions and basic blocks
+//   --snapshot=FILE            write registers, pc, CSRs, CLINT registers and touched memory
+//                              pages to FILE before the instruction selected by
+//                              --snapshot-at=N (after N instructions) or --snapshot-pc=ADDR
+//                              (first execution)
+//   --restore                  input is a snapshot instead of a hexadecimal file (mapped,
+//                              pages copied on first touch); instructions count from zero,
+//                              guest counters and mtime continue from the snapshot
+//   --sample=PERIOD:WINDOW[:WARMUP] sampled simulation: fast-forward without side channels,
+//                              then WARMUP instructions warming the timing model and
+//                              predictors up and a measured WINDOW (traced and profiled)
+//                              ending every PERIOD; reports extrapolated cycles and
+//                              mispredicts with 95% confidence intervals (enables --timing)
+//   --bbv=FILE[:INTERVAL]      write SimPoint basic block vectors every INTERVAL
+//                              instructions (default 10000000) to FILE
+//   --reverse[=CHECKPOINTS:INTERVAL] reverse execution: undo log of the registers and bytes
+//                              each instruction overwrites, with a ring of CHECKPOINTS
+//                              (default 64) checkpoints every INTERVAL (default 100000)
+//                              instructions bounding its memory
+//   --last-write=ADDR          after the run, go back to the last store writing ADDR
+//   --step-back=N              after the run, go back N instructions
+//   --goto=N                   after the run, go to the N-th instruction (back or forward);
+//                              summary and --dump-mem show the state reached (these three
+//                              enable --reverse)
+//   --gdb=PORT|PATH            wait for a GDB connection on 127.0.0.1:PORT or a Unix socket
+//                              and run under its control (registers, memory, breakpoints,
+//                              watchpoints, step and continue at full speed on the selected
+//                              engine; reverse step and continue with --reverse)
+//   --cosim                    lock-step co-simulation: runs --engine on a copy of the image
+//                              against the interpreter (traced as usual), comparing pc,
+//                              registers, CSRs and stored bytes at every control flow and
+//                              the memory at the end; stops at the first divergence with
+//                              its instructions and differences
+//   --generate=MIX[:LENGTH[:SEED]] write a random RV32IM program to output (no input) instead
+//                              of simulating: 64 loops of instructions drawn from MIX (alu,
+//                              mul, mem, branch or mixed) over a data window in the last
+//                              page of memory, running about LENGTH (default 1000000)
+//                              instructions, then the halt sequence (SEED default 1)
+//   --devices[=LIST]           memory-mapped devices outside RAM, LIST is name=ADDR,...
+//                              (hexadecimal) with uart (console on stdout: write THR at +0,
+//                              LSR at +5), clint (msip at +0, mtimecmp at +0x4000, mtime at
+//                              +0xbff8 counting retired instructions) and halt (a write
+//                              halts the hart with its exit code, the process exit status
+//                              of hart 0, capped at 255; a memory fault of any hart exits
+//                              with status 1); default uart=10000000,clint=2000000,
+//                              halt=100000
 
 // Standard integer library
 #include <stdint.h>
+#include <stddef.h>
 // Standard library
 #include <stdlib.h>
 // Standard I/O library
 #include <stdio.h>
 #include <string.h>
+// Command line options
+#include <getopt.h>
+// Wall clock (throughput measurement)
+#include <time.h>
+// File mapping (input loading)
+#include <sys/mman.h>
+#include <sys/stat.h>
+// Host processor count (batch workers)
+#include <unistd.h>
+// Host threads (one per hart)
+#include <pthread.h>
+// Debugger sockets (GDB stub)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+// ELF executables (types and constants)
+#include <elf.h>
+
+// Memory offset (first guest address)
+#define MEM_OFFSET 0x80000000
+// Default memory size for both data and instructions (32 KiB)
+#define MEM_SIZE_DEFAULT (32 * 1024)
+// Page size (4 KiB, allocated on first touch)
+#define PAGE_BITS 12
+#define PAGE_SIZE (1 << PAGE_BITS)
+#define PAGE_MASK (PAGE_SIZE - 1)
+// Decoded instruction slots per page (one per halfword, see code_slot)
+#define PAGE_SLOTS (PAGE_SIZE / 2)
+// Software TLB entries (direct-mapped, per CPU)
+#define TLB_SIZE 256
+// Longest translated block (guest instructions)
+#define BLOCK_MAX 64
+
+// Rarely taken paths kept out of the handlers
+#if defined(__GNUC__)
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+// Register labels (ABI names)
+static const char* const x_label[32] = { "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6" };
+
+typedef struct cpu cpu_t;
+typedef struct decoded decoded_t;
+typedef struct block block_t;
+typedef struct timing timing_t;
+typedef struct branch_unit branch_unit_t;
+typedef struct bbv bbv_t;
+typedef struct sample sample_t;
+typedef struct reverse reverse_t;
+
+// Instruction handler (executes and outputs a single decoded instruction)
+typedef void (*handler_t)(cpu_t* cpu, const decoded_t* d);
+
+// Decoded instruction (one entry per halfword, filled on first execution)
+struct decoded {
+	// Operation handler (NULL while the word is not decoded)
+	handler_t handler;
+	// Raw instruction word (16 bits for compressed instructions)
+	uint32_t instruction;
+	// Immediate, already sign-extended for the instruction format
+	int32_t imm;
+	// Register indexes
+	uint8_t rd;
+	uint8_t rs1;
+	uint8_t rs2;
+	// Operation index (see OP_LIST, compressed instructions use the one of
+	// their expansion)
+	uint8_t op;
+	// Instruction size in bytes (2 for compressed instructions)
+	uint8_t size;
+	// Threaded engine label index (op, or OP_COUNT for compressed instructions)
+	uint8_t dispatch;
+	// Executions (profiler, also counted through const pointers)
+	uint64_t count;
+};
+
+// Memory page
+typedef struct {
+	// Contents
+	uint8_t data[PAGE_SIZE];
+	// Decoded instructions, one per halfword (NULL until the page is fetched from)
+	decoded_t* code;
+	// Code version (incremented when a store overwrites a decoded instruction)
+	uint32_t version;
+} page_t;
+
+// Memory-mapped devices, outside RAM: loads and stores reach them from their
+// slow paths once the RAM lookup has failed, so RAM accesses never look them up
+enum {
+	DEVICE_UART,
+	DEVICE_CLINT,
+	DEVICE_HALT,
+	DEVICE_COUNT
+};
+
+// Device names, region sizes (16550 UART registers; CLINT msip at 0x0,
+// mtimecmp at 0x4000 and mtime at 0xbff8; halt register at 0x0) and default
+// regions (QEMU virt addresses)
+static const char* const device_name[DEVICE_COUNT] = { "uart", "clint", "halt" };
+static const uint32_t device_size[DEVICE_COUNT] = { 0x100, 0x10000, 0x1000 };
+static const uint32_t device_default[DEVICE_COUNT] = { 0x10000000, 0x02000000, 0x00100000 };
+
+// Console output buffer size
+#define CONSOLE_BUFFER_SIZE (64 * 1024)
+
+// Devices (shared by all harts)
+typedef struct {
+	// Region bases (TLB_INVALID when absent)
+	uint32_t base[DEVICE_COUNT];
+	// Console output, written to stdout when full, at the end and on newlines
+	// when stdout is a terminal
+	char* console;
+	uint32_t console_used;
+	uint8_t console_lines;
+	uint64_t console_bytes;
+	// mtime is the count of instructions retired by the reading hart plus this offset
+	uint64_t mtime_offset;
+	// Timer compare and software interrupt registers, per hart
+	uint64_t* mtimecmp;
+	uint32_t* msip;
+	uint32_t harts;
+	// Harts (CLINT writes reset their boundary)
+	cpu_t* const* cpus;
+	// Console and register lock
+	pthread_mutex_t lock;
+} devices_t;
+
+// Guest memory (pages over [base, base + size), allocated on first touch)
+typedef struct {
+	// First guest address
+	uint32_t base;
+	// Size in bytes
+	uint32_t size;
+	// Page table, indexed by (address - base) >> PAGE_BITS
+	page_t** pages;
+	// Allocated pages
+	uint32_t allocated;
+	// Page and decoded instruction creation lock (shared by all harts)
+	pthread_mutex_t lock;
+	// Restored snapshot, mapped (its pages are copied on first touch, NULL when none)
+	const uint8_t* image;
+	size_t image_size;
+	// Memory-mapped devices (NULL when disabled)
+	devices_t* devices;
+} memory_t;
+
+// Snapshot point (before the at-th instruction or the first one at pc)
+typedef struct {
+	// Snapshot file (NULL for none)
+	const char* file;
+	// Executed instructions (UINT64_MAX for none)
+	uint64_t at;
+	// Instruction address (TLB_INVALID for none)
+	uint32_t pc;
+} snapshot_point_t;
+
+// Debugger stop points (GDB stub): software breakpoints are armed as unknown
+// instructions in the decoded slots while the guest runs, and watched pages
+// stay out of the data TLB, so only their accesses take the slow paths
+#define DEBUG_POINTS_MAX 64
+
+// Stop point (GDB Z packet type: 0 software and 1 hardware breakpoints,
+// 2 write, 3 read and 4 access watchpoints)
+typedef struct {
+	uint32_t address;
+	uint32_t length;
+	uint8_t type;
+} debug_point_t;
+
+// Debugger state of a hart
+typedef struct {
+	debug_point_t points[DEBUG_POINTS_MAX];
+	uint32_t count;
+	// Stop reason (DEBUG_NONE, DEBUG_BREAKPOINT or DEBUG_WATCH), with the
+	// accessed watched address and the watchpoint type
+	uint8_t stop;
+	uint32_t watch_address;
+	uint8_t watch_type;
+} debug_t;
+
+// Stop reasons and accesses
+enum {
+	DEBUG_NONE,
+	DEBUG_BREAKPOINT,
+	DEBUG_WATCH
+};
+#define DEBUG_READ 1
+#define DEBUG_WRITE 2
+
+// Program symbol (ELF function, with its size when known)
+typedef struct {
+	uint32_t address;
+	uint32_t size;
+	// Name offset in the string table
+	uint32_t name;
+} symbol_t;
+
+// Program symbols, sorted by address (trace and profile labels)
+typedef struct {
+	symbol_t* entries;
+	uint32_t count;
+	// Names (copied from the ELF string table)
+	char* names;
+} symbols_t;
+
+// Software TLB entry (page number tag, TLB_INVALID when empty)
+typedef struct {
+	uint32_t tag;
+	page_t* page;
+} tlb_entry_t;
+
+#define TLB_INVALID 0xFFFFFFFF
+
+// Binary trace record (fixed size). Memory accesses are rs1 + imm, with the
+// stored value in rs2 and the loaded value in rd, as in the text trace.
+typedef struct {
+	// Instruction address
+	uint32_t pc;
+	// Raw instruction word
+	uint32_t instruction;
+	// Source values before execution
+	uint32_t rs1_value;
+	uint32_t rs2_value;
+	// Destination value after execution
+	uint32_t rd_value;
+} trace_record_t;
+
+// Binary trace header magic ("PXT1"), followed by the record size
+#define TRACE_MAGIC 0x31545850
+
+// Binary trace fault record instruction (illegal encoding), with the faulting
+// address in rs1_value
+#define TRACE_FAULT 0xFFFFFFFF
+
+// Binary trace trap record instruction (illegal encoding), with mcause in
+// rs1_value and the handler address in rs2_value
+#define TRACE_TRAP 0xFFFFFFFE
+
+// Trace buffer size (1 MiB, written with a single fwrite when nearly full)
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+// Trace buffer
+typedef struct {
+	// Buffered bytes
+	char* data;
+	// Used bytes
+	size_t used;
+	// Trace file
+	FILE* file;
+} trace_buffer_t;
+
+// Machine code buffer of a hart (mapped on first use, unmapped with the hart)
+typedef struct {
+	uint8_t* code;
+	size_t used;
+	uint8_t failed;
+} jit_buffer_t;
+
+// Machine-mode CSRs (mcycle and minstret are kept as offsets from the
+// instruction count, mip is read from the CLINT)
+typedef struct {
+	uint32_t mstatus;
+	uint32_t mtvec;
+	uint32_t mepc;
+	uint32_t mcause;
+	uint32_t mtval;
+	uint32_t mscratch;
+	uint32_t mie;
+	uint64_t mcycle_offset;
+	uint64_t minstret_offset;
+} csr_t;
+
+// Snapshot file header ("PXS2"), followed by the page table (one entry per
+// memory page: stored page number plus one, 0 when not stored) and the
+// stored pages, aligned to PAGE_SIZE so the file maps directly. Counter and
+// mtime offsets are rebased to an instruction count of zero, so restored
+// counters and timer continue where the snapshot was taken
+typedef struct {
+	uint32_t magic;
+	uint32_t base;
+	uint32_t size;
+	uint32_t pc;
+	uint32_t x[32];
+	uint32_t pages;
+	// CSRs and the hart CLINT registers
+	csr_t csr;
+	uint64_t mtimecmp;
+	uint64_t mtime_offset;
+	uint32_t msip;
+} snapshot_header_t;
+
+#define SNAPSHOT_MAGIC 0x32535850
 
 /**
- * Main function
- * @param argc	Number of command line arguments
- * @param argv	Command line arguments
- * @return		Returns the program execution status
+ * Computes the offset of the first stored page of a snapshot
+ * @param size	Memory size in bytes
+ * @return		Returns the offset
  */
-int main(int argc, char* argv[]) {
-	// Outputting separator
-	printf("--------------------------------------------------------------------------------\n");
-	// Iterating over arguments
-	for(uint32_t i = 0; i < argc; i++) {
-		// Outputting argument
-		printf("argv[%i] = %s\n", i, argv[i]);
-	}
-	// Opening input and output files using proper permissions
-	FILE* input = fopen(argv[1], "r");
-	FILE* output = fopen(argv[2], "w");
-	// Setting memory offset to 0x80000000
-	const uint32_t offset = 0x80000000;
-	// Creating 32 registers initialized with zero and labels
-	uint32_t x[32] = { 0 };
-	const char* x_label[32] = { "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6" };
-	// Creating pc register initialized with memory offset
-	uint32_t pc = offset;
-	// Creating 32 KiB memory for both data and instructions
-	uint8_t* mem = (uint8_t*)(malloc(32 * 1024));
-	// Reading memory contents from input hexadecimal file
-	
-	
-	// Processando o arquivo linha por linha
-	size_t num_bytes = 0;  // Contador de bytes carregados
-	char linha[256];       // Buffer para armazenar linhas do arquivo
-
-	while (fgets(linha, sizeof(linha), input)) {
-		// Ignorar linhas que começam com '@'
-		if (linha[0] == '@') {
-			continue;
-		}
+static inline size_t snapshot_data(uint32_t size) {
+	return (sizeof(snapshot_header_t) + 4 * (size_t)(size >> PAGE_BITS) + PAGE_MASK) & ~(size_t)(PAGE_MASK);
+}
 
-		// Processar cada par de caracteres como um byte hexadecimal
-		for (size_t i = 0; linha[i] != '\0'; i += 3) {  // Avança 3 posições (2 caracteres + espaço)
-			if (linha[i] == '\n' || linha[i] == '\r' || linha[i] == '\0') {
-				break;  // Ignorar quebras de linha ou fim da string
-			}
+// mstatus bits (MPP always reads machine mode), interrupt bits of mie and mip
+// and trap causes
+#define MSTATUS_MIE (1u << 3)
+#define MSTATUS_MPIE (1u << 7)
+#define MSTATUS_MPP (3u << 11)
+#define MIP_MSIP (1u << 3)
+#define MIP_MTIP (1u << 7)
+#define MIP_MEIP (1u << 11)
+#define CAUSE_ILLEGAL 2
+#define CAUSE_ECALL 11
+#define CAUSE_INTERRUPT 0x80000000u
+
+// Simulator state
+struct cpu {
+	// Registers
+	uint32_t x[32];
+	// Program counter
+	uint32_t pc;
+	// Memory for both data and instructions
+	memory_t* memory;
+	// Software TLBs for data accesses and instruction fetches
+	tlb_entry_t dtlb[TLB_SIZE];
+	tlb_entry_t itlb[TLB_SIZE];
+	// Base address and decoded instructions of the last fetched page
+	uint32_t fetch_tag;
+	decoded_t* fetch_code;
+	// Instruction crossing a page boundary (decoded again on every fetch)
+	decoded_t straddle;
+	// Translated blocks, per page and word (block engine)
+	block_t*** blocks;
+	// Block being executed (block engine) and its first pc while executed by
+	// micro-ops, which only count its instructions at its end (TLB_INVALID otherwise)
+	const block_t* block;
+	uint32_t block_pc;
+	// Compiled blocks (jit engine)
+	jit_buffer_t jit;
+	// Hart index (mhartid)
+	uint32_t hartid;
+	// Merged trace (lines prefixed by the hart index)
+	uint8_t trace_merged;
+	// Run condition
+	uint8_t run;
+	// Memory fault condition and faulting address
+	uint8_t fault;
+	uint32_t fault_address;
+	// Halted by the halt register, with the written exit code
+	uint8_t exited;
+	uint32_t exit_code;
+	// Console output and error messages dropped (reverse execution replaying
+	// logged instructions, engine hart of a co-simulation)
+	uint8_t muted;
+	// Machine-mode CSRs, trap taken by the last instruction (trace output) and
+	// instruction count from which an interrupt is taken (UINT64_MAX for none)
+	csr_t csr;
+	uint8_t trapped;
+	uint64_t interrupt_at;
+	// Load reservation (lr.w): address and loaded value, checked by sc.w
+	uint8_t reserved;
+	uint32_t reservation;
+	uint32_t reservation_value;
+	// Trace mode (TRACE_OFF, TRACE_ALL or TRACE_FILTER)
+	uint8_t trace_mode;
+	// Traced PC range (pc - trace_pc_first <= trace_pc_span, inclusive)
+	uint32_t trace_pc_first;
+	uint32_t trace_pc_span;
+	// Traced instruction window (instret - trace_first < trace_count)
+	uint64_t trace_first;
+	uint64_t trace_count;
+	// Binary trace records instead of text lines
+	uint8_t trace_binary;
+	// Trace buffer (shared by all harts in a merged trace)
+	trace_buffer_t* trace;
+	// Timing model (NULL when disabled)
+	timing_t* timing;
+	// Branch predictors (NULL when disabled)
+	branch_unit_t* branches;
+	// Profiler hottest entries listed (0 when disabled)
+	uint32_t profile;
+	// Pending snapshot (NULL when none or already written)
+	const snapshot_point_t* snapshot;
+	// Basic block vectors (NULL when disabled)
+	bbv_t* bbv;
+	// Sampled simulation (NULL when disabled)
+	sample_t* sample;
+	// Reverse execution (NULL when disabled)
+	reverse_t* reverse;
+	// Debugger stop points (NULL when no debugger is attached)
+	debug_t* debug;
+	// Program symbols (NULL for hexadecimal input or without symbols)
+	const symbols_t* symbols;
+	// Engines return at the first control flow from this instruction count
+	// (sampled simulation, UINT64_MAX otherwise)
+	uint64_t limit;
+	// Engines check for interrupts and the limit at the first control flow
+	// from this instruction count (the lowest of both, reset by CLINT writes)
+	uint64_t boundary;
+	// Instructions go through observe_step (trace, timing, branch predictors,
+	// profiler, a pending snapshot, basic block vectors or reverse execution)
+	uint8_t observed;
+	// Executed instructions
+	uint64_t instret;
+};
+
+// Trace modes
+enum {
+	// No trace lines (pure emulation)
+	TRACE_OFF,
+	// Every instruction
+	TRACE_ALL,
+	// Instructions inside the PC range and instruction window
+	TRACE_FILTER
+};
 
-			uint8_t valor;
-			if (sscanf(&linha[i], "%2hhX", &valor) == 1) {  // Lê 2 caracteres como um byte hexadecimal
-				mem[num_bytes++] = valor;
-				
+/**
+ * Creates the guest memory (pages are only allocated when touched)
+ * @param memory	Guest memory
+ * @param base		First guest address
+ * @param size		Size in bytes (multiple of PAGE_SIZE)
+ */
+static void mem_create(memory_t* memory, uint32_t base, uint32_t size) {
+	memory->base = base;
+	memory->size = size;
+	memory->pages = (page_t**)(calloc(size >> PAGE_BITS, sizeof(page_t*)));
+	memory->allocated = 0;
+	pthread_mutex_init(&memory->lock, NULL);
+	memory->image = NULL;
+	memory->image_size = 0;
+	memory->devices = NULL;
+}
 
-				// Verifica se ultrapassou o limite de memória
-				if (num_bytes >= 32 * 1024) {
-					fprintf(stderr, "Erro: Arquivo excede o limite de memória de 32 KiB\n");
-					fclose(input);
-					fclose(output);
-					return 1;
-				}
-			} else {
-				fprintf(stderr, "Erro ao converter os dados na posição %zu: %s\n", i, linha);
-			}
-		}
+/**
+ * Releases the guest memory pages and their decoded instructions
+ * @param memory	Guest memory
+ */
+static void mem_destroy(memory_t* memory) {
+	for(uint32_t index = 0; index < memory->size >> PAGE_BITS; index++) {
+		page_t* page = memory->pages[index];
+		if(page == NULL) continue;
+		free(page->code);
+		free(page);
 	}
+	free(memory->pages);
+	pthread_mutex_destroy(&memory->lock);
+	if(memory->image != NULL) munmap((void*)(memory->image), memory->image_size);
+}
 
+/**
+ * Retrieves the contents of a page in the restored snapshot
+ * @param memory	Guest memory
+ * @param index		Page index
+ * @return			Returns the stored page, or NULL when not stored
+ */
+static inline const uint8_t* mem_image(const memory_t* memory, uint32_t index) {
+	if(memory->image == NULL) return NULL;
+	const uint32_t* table = (const uint32_t*)(memory->image + sizeof(snapshot_header_t));
+	if(table[index] == 0) return NULL;
+	return memory->image + snapshot_data(memory->size) + (size_t)(table[index] - 1) * PAGE_SIZE;
+}
 
+/**
+ * Allocates a page on first touch (another hart may have just allocated it)
+ * @param memory	Guest memory
+ * @param slot		Page table slot
+ * @return			Returns the page
+ */
+static NOINLINE page_t* mem_allocate(memory_t* memory, page_t** slot) {
+	pthread_mutex_lock(&memory->lock);
+	page_t* page = *slot;
+	if(page == NULL) {
+		page = (page_t*)(calloc(1, sizeof(page_t)));
+		// Copying restored contents
+		const uint8_t* image = mem_image(memory, slot - memory->pages);
+		if(image != NULL) memcpy(page->data, image, PAGE_SIZE);
+		__atomic_store_n(slot, page, __ATOMIC_RELEASE);
+		memory->allocated++;
+	}
+	pthread_mutex_unlock(&memory->lock);
+	return page;
+}
 
+/**
+ * Retrieves the page holding an address, allocating it on first touch
+ * @param memory	Guest memory
+ * @param address	Guest address
+ * @return			Returns the page, or NULL outside memory
+ */
+static page_t* mem_page(memory_t* memory, uint32_t address) {
+	const uint32_t index = (address - memory->base) >> PAGE_BITS;
+	if(address - memory->base >= memory->size) return NULL;
+	page_t* page = __atomic_load_n(&memory->pages[index], __ATOMIC_ACQUIRE);
+	if(page == NULL) page = mem_allocate(memory, &memory->pages[index]);
+	return page;
+}
 
+/**
+ * Raises a memory fault, halting the simulation
+ * @param cpu		Simulator state
+ * @param address	Faulting address
+ */
+static void mem_fault(cpu_t* cpu, uint32_t address) {
+	cpu->fault = 1;
+	cpu->fault_address = address;
+	cpu->run = 0;
+	// Outputting error message to console (the trace line may be filtered out)
+	if(cpu->trace_mode != TRACE_ALL && !cpu->muted) fprintf(stderr, "error: memory fault at pc = 0x%08x, address = 0x%08x\n", cpu->pc, address);
+}
 
-	// Outputting separator
-	printf("--------------------------------------------------------------------------------\n");
-	// Setting run condition
-	uint8_t run = 1;
-	// Loop while condition is true
-	while(run) {
-		// Reading instruction from memory (4 byte alignment)
-		const uint32_t instruction = ((uint32_t*)(mem))[(pc - offset) >> 2];
-		// Retrieving instruction opcode (6:0)
-		const uint8_t opcode = instruction & 0b1111111;
-		// Retrieving instruction fields
-		const uint8_t funct7 = instruction >> 25;
-		const uint16_t imm = instruction >> 20;
-		const uint8_t uimm = (instruction & (0b11111 << 20)) >> 20;
-		const uint8_t rs1 = (instruction & (0b11111 << 15)) >> 15;
-		const uint8_t rs2 = (instruction >> 20) & 0b11111;
-		const uint8_t funct3 = (instruction & (0b111 << 12)) >> 12;
-		const uint8_t rd = (instruction & (0b11111 << 7)) >> 7;
-		const uint32_t imm20 = ((instruction >> 31) << 19) | (((instruction & (0b11111111 << 12)) >> 12) << 11) | (((instruction & (0b1 << 20)) >> 20) << 10) | ((instruction & (0b1111111111 << 21)) >> 21);
-		// Checking instruction opcode
-		//    fprintf(output,"rs2: 0x%08x\n",rs2);
-		//  fprintf(output,"rs1: 0x%08x\n",rs1);
-		switch(opcode) {
-			// I type (0010011)
-			case 0b0010011:
-				// slli (funct3 == 001 and funct7 == 0000000)
-				if(funct3 == 0b001 && funct7 == 0b0000000) {
-					// Calculating operation data
-					const uint32_t data = x[rs1] << uimm;
-					// Outputting instruction to console
-					fprintf(output,"0x%08x:slli   %s,%s,%u  %s=0x%08x<<%u=0x%08x\n", pc, x_label[rd], x_label[rs1], imm, x_label[rd], x[rs1], imm, data);
-					// Updating register if not x[0] (zero)
-					if(rd != 0) x[rd] = data;
-				}
-				// addi 
-				if (funct3 == 0b000) {
-					// Extensão de sinal do imediato de 12 bits
-					int32_t imm_sext = (int32_t)(imm << 20) >> 20;
-
-					// Calcula o resultado da soma
-					const uint32_t data = x[rs1] + imm_sext;
-
-					// Exibe a instrução no console com o imediato em hexadecimal (sinalizado)
-					fprintf(output,"0x%08x:addi   %s,%s,0x%03x   %s=0x%08x+0x%08x=0x%08x\n",
-						pc, x_label[rd], x_label[rs1], (uint32_t)imm_sext & 0xFFF,  // Imediato formatado
-						x_label[rd], x[rs1], imm_sext, data);
-
-					// Atualiza o registrador de destino, exceto x[0] (zero)
-					if (rd != 0) {
-						x[rd] = data;
-					}
-				}
-				//xori
-				if (funct3 == 0b100)
-				{
-					int32_t imm_xori = (int32_t)(imm << 20) >> 20;
+/**
+ * Checks whether an instruction address holds a debugger breakpoint
+ * @param debug		Debugger state
+ * @param pc		Instruction address
+ * @return			Returns 1 on a breakpoint
+ */
+static int debug_breakpoint(const debug_t* debug, uint32_t pc) {
+	for(uint32_t i = 0; i < debug->count; i++) {
+		if(debug->points[i].type <= 1 && debug->points[i].address == pc) return 1;
+	}
+	return 0;
+}
 
-					// Calcula o resultado da soma
-					const uint32_t data = x[rs1] ^ imm_xori;
+/**
+ * Checks whether a page holds bytes under a debugger watchpoint
+ * @param debug		Debugger state
+ * @param address	Guest address
+ * @return			Returns 1 when watched
+ */
+static int debug_watched(const debug_t* debug, uint32_t address) {
+	for(uint32_t i = 0; i < debug->count; i++) {
+		const debug_point_t* point = &debug->points[i];
+		if(point->type >= 2 && address >> PAGE_BITS >= point->address >> PAGE_BITS && address >> PAGE_BITS <= (point->address + point->length - 1) >> PAGE_BITS) return 1;
+	}
+	return 0;
+}
 
-					// Exibe a instrução no console com o imediato em hexadecimal (sinalizado)
-					fprintf(output,"0x%08x:xori   %s,%s,0x%03x   %s=0x%08x^0x%08x=0x%08x\n",
-						pc, x_label[rd], x_label[rs1], (uint32_t)imm_xori & 0xFFF,  // Imediato formatado
-						x_label[rd], x[rs1], imm_xori, data);
+/**
+ * Stops the hart after a data access overlapping a debugger watchpoint
+ * @param cpu		Simulator state
+ * @param address	Guest address
+ * @param size		Access size in bytes
+ * @param access	DEBUG_READ, DEBUG_WRITE or both (atomics)
+ */
+static NOINLINE void debug_access(cpu_t* cpu, uint32_t address, uint32_t size, uint8_t access) {
+	static const uint8_t watched[5] = { 0, 0, DEBUG_WRITE, DEBUG_READ, DEBUG_READ | DEBUG_WRITE };
+	debug_t* debug = cpu->debug;
+	for(uint32_t i = 0; i < debug->count; i++) {
+		const debug_point_t* point = &debug->points[i];
+		if(!(watched[point->type] & access) || (uint64_t)(address) + size <= point->address || (uint64_t)(point->address) + point->length <= address) continue;
+		debug->stop = DEBUG_WATCH;
+		debug->watch_address = (address > point->address) ? address : point->address;
+		debug->watch_type = point->type;
+		cpu->run = 0;
+		return;
+	}
+}
 
-					// Atualiza o registrador de destino, exceto x[0] (zero)
-					if (rd != 0) {
-						x[rd] = data;
-					}
-				}
-				//ori
-				if (funct3 == 0b110)
-				{
-					int32_t imm_ori = (int32_t)((imm << 20) >> 20);  // Extensão de sinal correta
+/**
+ * Creates the devices
+ * @param base		Region bases (TLB_INVALID when absent)
+ * @param harts		Number of harts
+ * @return			Returns the devices
+ */
+static devices_t* device_create(const uint32_t base[DEVICE_COUNT], uint32_t harts) {
+	devices_t* devices = (devices_t*)(calloc(1, sizeof(devices_t)));
+	memcpy(devices->base, base, sizeof(devices->base));
+	devices->console = (char*)(malloc(CONSOLE_BUFFER_SIZE));
+	devices->console_lines = isatty(fileno(stdout));
+	devices->mtimecmp = (uint64_t*)(malloc(harts * sizeof(uint64_t)));
+	for(uint32_t k = 0; k < harts; k++) devices->mtimecmp[k] = UINT64_MAX;
+	devices->msip = (uint32_t*)(calloc(harts, sizeof(uint32_t)));
+	devices->harts = harts;
+	pthread_mutex_init(&devices->lock, NULL);
+	return devices;
+}
 
-					// Se o registrador rs1 for zero, o resultado será apenas o imediato
-					uint32_t data = (rs1 == 0) ? imm_ori : x[rs1] | (uint32_t)imm_ori;  // OR com o imediato sinalizado ou com rs1
+/**
+ * Parses "name=ADDR,..." device regions (hexadecimal bases), only the
+ * listed devices being mapped
+ * @param base	Region bases (filled, TLB_INVALID when absent)
+ * @param text	Regions text
+ * @return		Returns 0 on success
+ */
+static int device_parse(uint32_t base[DEVICE_COUNT], const char* text) {
+	for(uint32_t type = 0; type < DEVICE_COUNT; type++) base[type] = TLB_INVALID;
+	char copy[256];
+	snprintf(copy, sizeof(copy), "%s", text);
+	char* save;
+	for(char* item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+		char key[16];
+		char value[64];
+		if(sscanf(item, "%15[^=]=%63s", key, value) != 2) return 1;
+		uint32_t type = 0;
+		while(type < DEVICE_COUNT && strcmp(key, device_name[type]) != 0) type++;
+		char* end;
+		const unsigned long address = strtoul(value, &end, 16);
+		// Aligned regions inside the address space
+		if(type == DEVICE_COUNT || *end != '\0' || address > 0xFFFFFFFF || address % device_size[type] != 0) return 1;
+		base[type] = (uint32_t)(address);
+	}
+	return 0;
+}
 
-					// Exibe a instrução corretamente no console
-					fprintf(output, "0x%08x:ori   %s,%s,0x%03x   %s=0x%08x|0x%08x=0x%08x\n",
-							pc, x_label[rd], x_label[rs1], imm & 0xFFF,  // Mostrar imediato corretamente
-							x_label[rd], x[rs1], imm_ori, data);
+/**
+ * Writes the buffered console output to stdout
+ * @param devices	Devices
+ */
+static void device_flush(devices_t* devices) {
+	fwrite(devices->console, 1, devices->console_used, stdout);
+	fflush(stdout);
+	devices->console_used = 0;
+}
 
-					// Atualiza o registrador de destino, exceto x0
-					if (rd != 0) {
-						x[rd] = data;
-					}
-				}
-				//andi
-				if (funct3 == 0b111)
-				{
-					int32_t imm_andi = (int32_t)(imm << 20) >> 20;
+/**
+ * Releases the devices (the console must be flushed first)
+ * @param devices	Devices
+ */
+static void device_destroy(devices_t* devices) {
+	pthread_mutex_destroy(&devices->lock);
+	free(devices->console);
+	free(devices->mtimecmp);
+	free(devices->msip);
+	free(devices);
+}
 
-					// Calcula o resultado da soma
-					const uint32_t data = x[rs1] & imm_andi;
+/**
+ * Counts the instructions retired before the executing one, inside blocks
+ * too (micro-ops only count them at the block end), so every engine reads
+ * the same time and counters
+ * @param cpu	Simulator state
+ * @return		Returns the exact instruction count
+ */
+static inline uint64_t cpu_instret(const cpu_t* cpu) {
+	return cpu->instret + ((cpu->block_pc != TLB_INVALID) ? (cpu->pc - cpu->block_pc) >> 2 : 0);
+}
 
-					// Exibe a instrução no console com o imediato em hexadecimal (sinalizado)
-					fprintf(output,"0x%08x:andi   %s,%s,0x%03x   %s=0x%08x&0x%08x=0x%08x\n",
-						pc, x_label[rd], x_label[rs1], (uint32_t)imm_andi & 0xFFF,  // Imediato formatado
-						x_label[rd], x[rs1], imm_andi, data);
+/**
+ * Reads mtime for a hart (its exact count of retired instructions)
+ * @param cpu	Simulator state
+ * @return		Returns mtime
+ */
+static inline uint64_t device_mtime(const cpu_t* cpu) {
+	return cpu_instret(cpu) + cpu->memory->devices->mtime_offset;
+}
 
-					// Atualiza o registrador de destino, exceto x[0] (zero)
-					if (rd != 0) {
-						x[rd] = data;
-					}
-				}
-				//srli
-				if (funct3 == 0b101 && funct7 == 0b00000000)
-				{
-					uint32_t shamt = (instruction >> 20) & 0x1F;
-					uint32_t valor_original = (uint32_t)x[rs1]; // Garante unsigned
-					uint32_t resultado = valor_original >> shamt;  // Deslocamento lógico
+/**
+ * Makes a hart check for interrupts at its next control flow (after a CLINT
+ * write changed its pending ones, with the register lock held)
+ * @param devices	Devices
+ * @param hart		Hart index
+ */
+static inline void device_wake(devices_t* devices, uint32_t hart) {
+	if(devices->cpus != NULL) __atomic_store_n(&devices->cpus[hart]->boundary, 0, __ATOMIC_RELAXED);
+}
 
-					x[rd] = (int32_t)resultado;  // Armazena corretamente em x[rd]
+/**
+ * Finds the device region holding a whole access
+ * @param devices	Devices
+ * @param address	Guest address
+ * @param size		Access size in bytes
+ * @param offset	Offset inside the region (filled)
+ * @return			Returns the device, or DEVICE_COUNT for none
+ */
+static uint32_t device_find(const devices_t* devices, uint32_t address, uint32_t size, uint32_t* offset) {
+	for(uint32_t type = 0; type < DEVICE_COUNT; type++) {
+		*offset = address - devices->base[type];
+		if(devices->base[type] != TLB_INVALID && *offset < device_size[type] && size <= device_size[type] - *offset) return type;
+	}
+	return DEVICE_COUNT;
+}
 
-					fprintf(output, "0x%08x:srli   %s,%s,%d          %s=0x%08x>>%d=0x%08x\n",
-						pc, x_label[rd], x_label[rs1], shamt, x_label[rd], valor_original, shamt, resultado);
+/**
+ * Finds the 64-bit CLINT register of an aligned access (msip registers, word
+ * accessed, are handled by the callers)
+ * @param cpu		Simulator state
+ * @param offset	Offset inside the CLINT region
+ * @param size		Access size in bytes
+ * @param mtime		Set for mtime (computed from the instruction count)
+ * @return			Returns the register, or NULL for unmapped and misaligned offsets
+ */
+static uint64_t* device_clint(cpu_t* cpu, uint32_t offset, uint32_t size, int* mtime) {
+	devices_t* devices = cpu->memory->devices;
+	*mtime = 0;
+	if(offset & (size - 1)) return NULL;
+	if(offset < 4 * devices->harts) return NULL;
+	if(offset - 0x4000 < 8 * devices->harts) return &devices->mtimecmp[(offset - 0x4000) >> 3];
+	*mtime = (offset >= 0xBFF8);
+	return NULL;
+}
 
-				}
-				//srai
-				if (funct3 == 0b101 && funct7 == 0b0100000)
-				{
-					uint32_t shamt = (instruction >> 20) & 0x1F;
-					int32_t valor_original = (int32_t)x[rs1];  // Converte explicitamente para signed
-					int32_t resultado = valor_original >> shamt;  // Deslocamento aritmético
+/**
+ * Loads a value from a device (only called after the RAM lookup failed)
+ * @param cpu		Simulator state
+ * @param address	Guest address
+ * @param size		Access size in bytes (1, 2 or 4)
+ * @param value		Loaded value (zero-extended)
+ * @return			Returns 1 on success, 0 outside device regions
+ */
+static NOINLINE int device_load(cpu_t* cpu, uint32_t address, uint32_t size, uint32_t* value) {
+	devices_t* devices = cpu->memory->devices;
+	uint32_t offset;
+	const uint32_t type = device_find(devices, address, size, &offset);
+	const uint32_t mask = (size == 4) ? 0xFFFFFFFF : (1u << (8 * size)) - 1;
+	*value = 0;
+	if(type == DEVICE_UART) {
+		// Line status: transmitter empty, no received data
+		if(offset == 5) *value = 0x60;
+	} else if(type == DEVICE_CLINT) {
+		int mtime;
+		const uint64_t* reg = device_clint(cpu, offset, size, &mtime);
+		pthread_mutex_lock(&devices->lock);
+		if(offset < 4 * devices->harts && size == 4) *value = devices->msip[offset >> 2];
+		else if(reg != NULL) *value = (uint32_t)(*reg >> (8 * (offset & 7))) & mask;
+		else if(mtime) *value = (uint32_t)(device_mtime(cpu) >> (8 * (offset & 7))) & mask;
+		pthread_mutex_unlock(&devices->lock);
+	}
+	return type != DEVICE_COUNT;
+}
 
-					x[rd] = resultado;  // Armazena corretamente o valor deslocado
+/**
+ * Stores a value into a device (only called after the RAM lookup failed):
+ * console bytes, timer registers or the exit code halting the hart
+ * @param cpu		Simulator state
+ * @param address	Guest address
+ * @param size		Access size in bytes (1, 2 or 4)
+ * @param value		Stored value
+ * @return			Returns 1 on success, 0 outside device regions
+ */
+static NOINLINE int device_store(cpu_t* cpu, uint32_t address, uint32_t size, uint32_t value) {
+	devices_t* devices = cpu->memory->devices;
+	uint32_t offset;
+	const uint32_t type = device_find(devices, address, size, &offset);
+	const uint32_t mask = (size == 4) ? 0xFFFFFFFF : (1u << (8 * size)) - 1;
+	if(type == DEVICE_UART && offset == 0 && !cpu->muted) {
+		// Transmitting a byte (buffered)
+		pthread_mutex_lock(&devices->lock);
+		if(devices->console_used == CONSOLE_BUFFER_SIZE) device_flush(devices);
+		devices->console[devices->console_used++] = (char)(value);
+		devices->console_bytes++;
+		if(devices->console_lines && (char)(value) == '\n') device_flush(devices);
+		pthread_mutex_unlock(&devices->lock);
+	} else if(type == DEVICE_CLINT) {
+		int mtime;
+		uint64_t* reg = device_clint(cpu, offset, size, &mtime);
+		const uint32_t shift = 8 * (offset & 7);
+		pthread_mutex_lock(&devices->lock);
+		if(offset < 4 * devices->harts && size == 4) {
+			devices->msip[offset >> 2] = value & 1;
+			device_wake(devices, offset >> 2);
+		} else if(reg != NULL) {
+			*reg = (*reg & ~((uint64_t)(mask) << shift)) | ((uint64_t)(value & mask) << shift);
+			device_wake(devices, (offset - 0x4000) >> 3);
+		} else if(mtime) {
+			// Moving the time base so mtime reads the written value
+			const uint64_t time = device_mtime(cpu);
+			devices->mtime_offset += ((time & ~((uint64_t)(mask) << shift)) | ((uint64_t)(value & mask) << shift)) - time;
+			for(uint32_t k = 0; k < devices->harts; k++) device_wake(devices, k);
+		}
+		pthread_mutex_unlock(&devices->lock);
+	} else if(type == DEVICE_HALT && offset == 0) {
+		// Halting the hart with the exit code
+		cpu->exited = 1;
+		cpu->exit_code = value;
+		cpu->run = 0;
+	}
+	return type != DEVICE_COUNT;
+}
 
-					fprintf(output, "0x%08x:srai   %s,%s,%d          %s=0x%08x>>>%d=0x%08x\n",
-						pc, x_label[rd], x_label[rs1], shamt, x_label[rd], (uint32_t)valor_original, shamt, (uint32_t)resultado);
-				}
+/**
+ * Computes the instruction count from which the hart takes an interrupt
+ * (enabled and pending software interrupt, or the timer reaching mtimecmp)
+ * and the boundary the engines check it at
+ * @param cpu	Simulator state
+ * @return		Returns the interrupt cause (0 when none can be taken)
+ */
+static uint32_t trap_update(cpu_t* cpu) {
+	devices_t* devices = cpu->memory->devices;
+	const csr_t* csr = &cpu->csr;
+	uint64_t at = UINT64_MAX;
+	uint32_t cause = 0;
+	if(devices != NULL) pthread_mutex_lock(&devices->lock);
+	if(devices != NULL && (csr->mstatus & MSTATUS_MIE)) {
+		const uint64_t compare = devices->mtimecmp[cpu->hartid];
+		if((csr->mie & MIP_MSIP) && devices->msip[cpu->hartid]) {
+			at = 0;
+			cause = 3;
+		} else if((csr->mie & MIP_MTIP) && compare != UINT64_MAX) {
+			// mtime counts instructions from its offset
+			at = (compare > devices->mtime_offset) ? compare - devices->mtime_offset : 0;
+			cause = 7;
+		}
+	}
+	cpu->interrupt_at = at;
+	__atomic_store_n(&cpu->boundary, (at < cpu->limit) ? at : cpu->limit, __ATOMIC_RELAXED);
+	if(devices != NULL) pthread_mutex_unlock(&devices->lock);
+	return cause;
+}
 
-				
-				//sltiu
-				if (funct3 == 0b011) {	
-					// Extração correta do imediato de 12 bits
-					int32_t imm = (int32_t)(instruction >> 20);  // Captura os 12 bits superiores
-					// Correção: Sign-extend (extensão de sinal para 32 bits)
-					if (imm & 0x800) {  // Se o bit 11 estiver definido (sinal negativo)
-						imm |= 0xFFFFF000;  // Preenche os bits superiores com 1s
-					}
+/**
+ * Sets the instruction count the engines return at (after control flow)
+ * @param cpu	Simulator state
+ * @param limit	Instruction count (UINT64_MAX for none)
+ */
+static void trap_limit(cpu_t* cpu, uint64_t limit) {
+	cpu->limit = limit;
+	trap_update(cpu);
+}
 
-					// Comparação sem sinal (unsigned)
-					if ((uint32_t)x[rs1] < (uint32_t)imm) {
-						x[rd] = 1;
-					} else {
-						x[rd] = 0;
-					}
+/**
+ * Checks whether the hart reached its boundary (read atomically, as CLINT
+ * writes of other harts reset it)
+ * @param cpu	Simulator state
+ * @return		Returns 1 when interrupts and the limit must be checked
+ */
+static inline int trap_due(const cpu_t* cpu) {
+	return cpu->instret >= __atomic_load_n(&cpu->boundary, __ATOMIC_RELAXED);
+}
 
-					// Impressão corrigida
-					fprintf(output, "0x%08x:sltiu   %s,%s,0x%03x       %s=(0x%08x<0x%08x)=%d\n", 
-						pc, x_label[rd], x_label[rs1], (imm & 0xFFF), x_label[rd], x[rs1], imm, x[rd]);
-				}
-				//slti
-				if (funct3 == 0b010)
-				{
-					int32_t imm = (int32_t)(instruction >> 20);  // Captura os 12 bits superiores
-					// Correção: Sign-extend (extensão de sinal para 32 bits)
-					if (imm & 0x800) {  // Se o bit 11 estiver definido (sinal negativo)
-						imm |= 0xFFFFF000;  // Preenche os bits superiores com 1s
-					}
+/**
+ * Resolves a data access through the TLB, refilling it on a miss
+ * @param cpu		Simulator state
+ * @param address	Guest address
+ * @return			Returns the page, or NULL outside memory
+ */
+static page_t* mem_translate(cpu_t* cpu, uint32_t address) {
+	tlb_entry_t* entry = &cpu->dtlb[(address >> PAGE_BITS) & (TLB_SIZE - 1)];
+	if(entry->tag != address >> PAGE_BITS) {
+		page_t* page = mem_page(cpu->memory, address);
+		if(page == NULL) return NULL;
+		// Keeping watched pages out of the TLB
+		if(cpu->debug != NULL && debug_watched(cpu->debug, address)) return page;
+		entry->tag = address >> PAGE_BITS;
+		entry->page = page;
+	}
+	return entry->page;
+}
 
+/**
+ * Loads bytes one by one (TLB misses, page crossings and faults)
+ * @param cpu		Simulator state
+ * @param address	Guest address
+ * @param size		Access size in bytes
+ * @param value		Loaded value (little endian)
+ * @return			Returns 1 on success, 0 on fault
+ */
+static NOINLINE int mem_load_slow(cpu_t* cpu, uint32_t address, uint32_t size, uint32_t* value) {
+	uint32_t data = 0;
+	for(uint32_t i = 0; i < size; i++) {
+		page_t* page = mem_translate(cpu, address + i);
+		if(page == NULL) {
+			// Accesses outside RAM may reach a device
+			if(i == 0 && cpu->memory->devices != NULL && device_load(cpu, address, size, value)) return 1;
+			mem_fault(cpu, address + i);
+			return 0;
+		}
+		data |= (uint32_t)page->data[(address + i) & PAGE_MASK] << (8 * i);
+	}
+	*value = data;
+	if(cpu->debug != NULL) debug_access(cpu, address, size, DEBUG_READ);
+	return 1;
+}
 
-					// Comparação sem sinal (unsigned)
-					if ((int32_t)x[rs1] < (int32_t)imm) {
-						x[rd] = 1;
-					} else {
-						x[rd] = 0;
-					}
+/**
+ * Loads a value from guest memory
+ * @param cpu		Simulator state
+ * @param address	Guest address
+ * @param size		Access size in bytes (1, 2 or 4)
+ * @param value		Loaded value (little endian, zero-extended)
+ * @return			Returns 1 on success, 0 on fault
+ */
+static inline int mem_load(cpu_t* cpu, uint32_t address, uint32_t size, uint32_t* value) {
+	const tlb_entry_t* entry = &cpu->dtlb[(address >> PAGE_BITS) & (TLB_SIZE - 1)];
+	const uint32_t offset = address & PAGE_MASK;
+	// Fast path (TLB hit inside a single page)
+	if(entry->tag == address >> PAGE_BITS && offset + size <= PAGE_SIZE) {
+		uint32_t data = 0;
+		memcpy(&data, &entry->page->data[offset], size);
+		*value = data;
+		return 1;
+	}
+	return mem_load_slow(cpu, address, size, value);
+}
 
-					// Impressão corrigida
-					fprintf(output, "0x%08x:slti   %s,%s,0x%03x       %s=(0x%08x<0x%08x)=%d\n", 
-						pc, x_label[rd], x_label[rs1], (imm & 0xFFF), x_label[rd], x[rs1], imm, x[rd]);
-				
-				}
-				
-				
-				
-				
-				
+/**
+ * Maps an instruction offset inside a page to its decoded slot: words first,
+ * then the halfwords between them, so code without compressed instructions
+ * keeps its slots as dense as with one slot per word
+ * @param offset	Offset inside the page (2 byte aligned)
+ * @return			Returns the slot index
+ */
+static inline uint32_t code_slot(uint32_t offset) {
+	return (offset >> 2) | ((offset & 2) << (PAGE_BITS - 3));
+}
 
-				// Breaking case
-				break;
-			// U Type (0010111)
-			case 0b0010111:
-				{
-					// Calcula o imediato deslocado (imm << 12)
-					const uint32_t imm_auipc = ((instruction >> 12) & 0xFFFFF) << 12;
-					// Exibe a instrução no console
-					fprintf(output,"0x%08x:auipc  %s,0x%05x    %s=0x%08x+0x%08x=0x%08x\n",pc, x_label[rd], (imm_auipc >> 12), x_label[rd], pc, imm_auipc, pc + imm_auipc);
+/**
+ * Drops the decoded instructions overlapped by a store into a page (and the
+ * blocks translated from the page, in every hart)
+ * @param page		Page
+ * @param offset	Store offset inside the page
+ * @param size		Store size in bytes
+ */
+static inline void mem_invalidate(page_t* page, uint32_t offset, uint32_t size) {
+	// Instructions starting from the halfword before the store (32-bit ones
+	// overlap it) up to its last byte
+	int dropped = 0;
+	for(uint32_t start = (offset >= 2) ? (offset - 2) & ~1u : 0; start < offset + size; start += 2) {
+		decoded_t* d = &page->code[code_slot(start)];
+		if(d->handler != NULL) {
+			__atomic_store_n(&d->handler, NULL, __ATOMIC_RELAXED);
+			dropped = 1;
+		}
+	}
+	if(dropped) __atomic_fetch_add(&page->version, 1, __ATOMIC_RELAXED);
+}
 
+/**
+ * Reads the code version of a page (stores from any hart change it)
+ * @param page	Page
+ * @return		Returns the version
+ */
+static inline uint32_t code_version(const page_t* page) {
+	return __atomic_load_n(&page->version, __ATOMIC_RELAXED);
+}
 
-					// Atualiza o registrador de destino, exceto x[0] (zero)
-					if (rd != 0) {
-						x[rd] = pc+imm_auipc;
-					}
-				}
-				break;			
+/**
+ * Stores bytes one by one (TLB misses, page crossings and faults)
+ * @param cpu		Simulator state
+ * @param address	Guest address
+ * @param size		Access size in bytes
+ * @param value		Stored value (little endian)
+ * @return			Returns 1 on success, 0 on fault
+ */
+static NOINLINE int mem_store_slow(cpu_t* cpu, uint32_t address, uint32_t size, uint32_t value) {
+	// Checking every byte before writing any of them
+	for(uint32_t i = 0; i < size; i++) {
+		if(mem_translate(cpu, address + i) == NULL) {
+			// Accesses outside RAM may reach a device
+			if(i == 0 && cpu->memory->devices != NULL && device_store(cpu, address, size, value)) return 1;
+			mem_fault(cpu, address + i);
+			return 0;
+		}
+	}
+	for(uint32_t i = 0; i < size; i++) {
+		page_t* page = mem_translate(cpu, address + i);
+		const uint32_t offset = (address + i) & PAGE_MASK;
+		page->data[offset] = (uint8_t)(value >> (8 * i));
+		if(page->code != NULL) mem_invalidate(page, offset, 1);
+	}
+	if(cpu->debug != NULL) debug_access(cpu, address, size, DEBUG_WRITE);
+	return 1;
+}
 
-			// U type (0110111) 
-			case 0b0110111:
-				uint32_t imm_lui = instruction & 0xFFFFF000;
+/**
+ * Stores a value into guest memory, dropping decoded instructions it overwrites
+ * @param cpu		Simulator state
+ * @param address	Guest address
+ * @param size		Access size in bytes (1, 2 or 4)
+ * @param value		Stored value (little endian)
+ * @return			Returns 1 on success, 0 on fault
+ */
+static inline int mem_store(cpu_t* cpu, uint32_t address, uint32_t size, uint32_t value) {
+	const tlb_entry_t* entry = &cpu->dtlb[(address >> PAGE_BITS) & (TLB_SIZE - 1)];
+	const uint32_t offset = address & PAGE_MASK;
+	// Fast path (TLB hit inside a single page)
+	if(entry->tag == address >> PAGE_BITS && offset + size <= PAGE_SIZE) {
+		page_t* page = entry->page;
+		memcpy(&page->data[offset], &value, size);
+		if(page->code != NULL) mem_invalidate(page, offset, size);
+		return 1;
+	}
+	return mem_store_slow(cpu, address, size, value);
+}
 
-				x[rd] = imm_lui;
+/**
+ * Resolves the word of an atomic access (aligned, so it never crosses a page)
+ * @param cpu		Simulator state
+ * @param address	Guest address
+ * @param page		Page holding the word (for decoded instruction invalidation)
+ * @return			Returns the host word, or NULL after a fault (misaligned or outside memory)
+ */
+static inline uint32_t* mem_atomic(cpu_t* cpu, uint32_t address, page_t** page) {
+	*page = (address & 3) ? NULL : mem_translate(cpu, address);
+	if(*page == NULL) {
+		mem_fault(cpu, address);
+		return NULL;
+	}
+	if(cpu->debug != NULL) debug_access(cpu, address, 4, DEBUG_READ | DEBUG_WRITE);
+	return (uint32_t*)(&(*page)->data[address & PAGE_MASK]);
+}
 
-				fprintf(output,"0x%08x:lui    %s,0x%05x     %s=0x%08x\n", 
-					pc, x_label[rd], imm_lui >> 12, x_label[rd], x[rd]);
-			
-			break;
+/**
+ * Retrieves the contents of a page without allocating it (touched page or
+ * restored snapshot)
+ * @param memory	Guest memory
+ * @param index		Page index
+ * @return			Returns the contents, or NULL when never written
+ */
+static const uint8_t* mem_contents(const memory_t* memory, uint32_t index) {
+	const page_t* page = __atomic_load_n(&memory->pages[index], __ATOMIC_ACQUIRE);
+	return (page != NULL) ? page->data : mem_image(memory, index);
+}
 
-			// R type (0110011)
-			case 0b0110011:
-			{
-				uint8_t funct3 = (instruction >> 12) & 0x7;
-        		uint8_t funct7 = (instruction >> 25) & 0x7F;
+/**
+ * Reads a word without faulting or allocating (0 outside touched pages)
+ * @param cpu		Simulator state
+ * @param address	Guest address
+ * @return			Returns the word
+ */
+static uint32_t mem_peek(cpu_t* cpu, uint32_t address) {
+	uint32_t value = 0;
+	for(uint32_t i = 0; i < 4; i++) {
+		const uint32_t offset = address + i - cpu->memory->base;
+		const uint8_t* data = (offset < cpu->memory->size) ? mem_contents(cpu->memory, offset >> PAGE_BITS) : NULL;
+		if(data != NULL) value |= (uint32_t)data[(address + i) & PAGE_MASK] << (8 * i);
+	}
+	return value;
+}
 
-				// Verifica se a instrução é ADD
-				if (funct3 == 0b000 && funct7 == 0b0000000) {
-					uint32_t data;
+/**
+ * Writes bytes without faulting (bytes outside memory are skipped), dropping
+ * decoded instructions they overwrite
+ * @param cpu		Simulator state
+ * @param address	Guest address
+ * @param size		Size in bytes
+ * @param value		Bytes (little endian)
+ */
+static void mem_poke(cpu_t* cpu, uint32_t address, uint32_t size, uint32_t value) {
+	for(uint32_t i = 0; i < size; i++) {
+		page_t* page = mem_page(cpu->memory, address + i);
+		if(page == NULL) continue;
+		const uint32_t offset = (address + i) & PAGE_MASK;
+		page->data[offset] = (uint8_t)(value >> (8 * i));
+		if(page->code != NULL) mem_invalidate(page, offset, 1);
+	}
+}
 
-					// Se rs1 for zero, o resultado será apenas o valor de rs2
-					if (rs1 == 0) {
-						data = x[rs2];  // Não soma nada, apenas copia rs2
-					}
-					if (rs2 == 0)
-					{
-						data = x[rs1];
-					}
-					
-					 else {
-						data = x[rs1] + x[rs2];  // Caso contrário, realiza a soma normal
-					}
+/**
+ * Writes registers, pc, CSRs, the hart CLINT registers and the touched memory
+ * pages (all-zero pages are skipped) to a snapshot file
+ * @param cpu	Simulator state (single hart)
+ * @param name	Snapshot file
+ * @return		Returns 0 on success
+ */
+static int snapshot_write(const cpu_t* cpu, const char* name) {
+	const memory_t* memory = cpu->memory;
+	static const uint8_t zero[PAGE_SIZE];
+	// Numbering stored pages
+	const uint32_t count = memory->size >> PAGE_BITS;
+	uint32_t* table = (uint32_t*)(calloc(count, sizeof(uint32_t)));
+	snapshot_header_t header = { .magic = SNAPSHOT_MAGIC, .base = memory->base, .size = memory->size, .pc = cpu->pc };
+	memcpy(header.x, cpu->x, sizeof(header.x));
+	// Rebasing counters and mtime to the restored instruction count (zero)
+	const uint64_t instret = cpu_instret(cpu);
+	header.csr = cpu->csr;
+	header.csr.mcycle_offset += instret;
+	header.csr.minstret_offset += instret;
+	header.mtimecmp = UINT64_MAX;
+	header.mtime_offset = instret;
+	if(memory->devices != NULL) {
+		header.mtimecmp = memory->devices->mtimecmp[cpu->hartid];
+		header.mtime_offset += memory->devices->mtime_offset;
+		header.msip = memory->devices->msip[cpu->hartid];
+	}
+	for(uint32_t index = 0; index < count; index++) {
+		const uint8_t* data = mem_contents(memory, index);
+		if(data != NULL && memcmp(data, zero, PAGE_SIZE) != 0) table[index] = ++header.pages;
+	}
+	// Writing header, page table (padded) and pages
+	FILE* file = fopen(name, "wb");
+	int status = (file == NULL);
+	if(file != NULL) {
+		const size_t padding = snapshot_data(memory->size) - sizeof(header) - count * sizeof(uint32_t);
+		status |= fwrite(&header, sizeof(header), 1, file) != 1;
+		status |= fwrite(table, sizeof(uint32_t), count, file) != count;
+		status |= fwrite(zero, 1, padding, file) != padding;
+		for(uint32_t index = 0; index < count && status == 0; index++) {
+			if(table[index] != 0) status |= fwrite(mem_contents(memory, index), PAGE_SIZE, 1, file) != 1;
+		}
+		status |= fclose(file) != 0;
+	}
+	if(status != 0) fprintf(stderr, "Erro: nao foi possivel escrever o snapshot %s\n", name);
+	free(table);
+	return status;
+}
 
-					// Exibe a instrução corretamente no console
-					fprintf(output, "0x%08x:add    %s,%s,%s       %s=0x%08x+0x%08x=0x%08x\n",
-							pc, x_label[rd], x_label[rs1], x_label[rs2],
-							x_label[rd], x[rs1], x[rs2], data);
+/**
+ * Restores a snapshot (registers, pc, CSRs, CLINT registers and memory) by
+ * mapping its file, the pages being copied into memory on first touch
+ * @param memory	Guest memory (same base and size as the snapshot)
+ * @param cpu		Simulator state (single hart)
+ * @param input		Snapshot file
+ * @return			Returns 0 on success
+ */
+static int snapshot_load(memory_t* memory, cpu_t* cpu, FILE* input) {
+	struct stat info;
+	if(fstat(fileno(input), &info) != 0 || (size_t)(info.st_size) < sizeof(snapshot_header_t)) {
+		fprintf(stderr, "Erro: snapshot invalido\n");
+		return 1;
+	}
+	const size_t size = info.st_size;
+	const uint8_t* data = (const uint8_t*)(mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(input), 0));
+	if(data == MAP_FAILED) {
+		fprintf(stderr, "Erro: nao foi possivel mapear o snapshot\n");
+		return 1;
+	}
+	// Checking header, page table and file size
+	snapshot_header_t header;
+	memcpy(&header, data, sizeof(header));
+	int status = header.magic != SNAPSHOT_MAGIC || size < snapshot_data(header.size) + (size_t)(header.pages) * PAGE_SIZE;
+	if(status == 0 && (header.base != memory->base || header.size != memory->size)) {
+		fprintf(stderr, "Erro: snapshot de memoria de %u KiB em 0x%08x (use --mem-size)\n", header.size / 1024, header.base);
+		munmap((void*)(data), size);
+		return 1;
+	}
+	const uint32_t* table = (const uint32_t*)(data + sizeof(header));
+	for(uint32_t index = 0; index < memory->size >> PAGE_BITS && status == 0; index++) status = table[index] > header.pages;
+	if(status != 0) {
+		fprintf(stderr, "Erro: snapshot invalido\n");
+		munmap((void*)(data), size);
+		return 1;
+	}
+	// Restoring state (pages on first touch)
+	memory->image = data;
+	memory->image_size = size;
+	cpu->pc = header.pc;
+	memcpy(cpu->x, header.x, sizeof(cpu->x));
+	cpu->csr = header.csr;
+	if(memory->devices != NULL) {
+		memory->devices->mtimecmp[cpu->hartid] = header.mtimecmp;
+		memory->devices->mtime_offset = header.mtime_offset;
+		memory->devices->msip[cpu->hartid] = header.msip;
+	}
+	trap_update(cpu);
+	return 0;
+}
 
-					// Atualiza o registrador de destino, exceto x0
-					if (rd != 0) {
-						x[rd] = data;
-					}
-				}
-				
-					//mul
-				if (funct3 == 0b000 && funct7 == 0b0000001 ) { 
-					// Realiza a multiplicação
-					int32_t rs1_print = x[rs1];
-					int32_t result = (int32_t)x[rs1] * (int32_t)x[rs2];
-
-					// Armazena o resultado em rd
-					x[rd] = result;
-
-					// Imprime a instrução e o resultado
-					fprintf(output,"0x%08x:mul    %s,%s,%s         %s=0x%08x*0x%08x=0x%08x\n", 
-						pc, x_label[rd], x_label[rs1], x_label[rs2], x_label[rd], rs1_print, x[rs2], result);
-				}
-					//mulh
-				if (funct3 == 0b001 && funct7 == 0b0000001 ) {  
-					// Realiza a multiplicação de 64 bits e pega a parte alta
-					int64_t result = (int64_t)((int32_t)x[rs1]) * (int64_t)((int32_t)x[rs2]);
+// Instruction handlers
+// Each handler only executes its instruction (the trace line is written by
+// trace_text). Control flow handlers leave pc at the target minus 4, as the
+// engines always increment pc by 4 afterwards. Handlers writing rd without
+// checking for x[0] reproduce the reference simulator behavior.
 
-					// Armazena a parte alta do resultado em rd (32 bits mais significativos)
-					x[rd] = (uint32_t)(result >> 32);
+// slli
+static void exec_slli(cpu_t* cpu, const decoded_t* d) {
+	if(d->rd != 0) cpu->x[d->rd] = cpu->x[d->rs1] << d->imm;
+}
 
-					// Imprime a instrução e o resultado
-					fprintf(output,"0x%08x:mulh   %s,%s,%s         %s=0x%08x*0x%08x=0x%08x\n", 
-						pc, x_label[rd], x_label[rs1], x_label[rs2], x_label[rd], x[rs1], x[rs2], x[rd]);
-				}
-					//mulhsu
-				 if (funct3 == 0b010 && funct7 == 0b0000001) {
-						// Realiza a multiplicação de um número assinado (rs1) com um número não assinado (rs2)
-						int32_t signed_rs1 = (int32_t)x[rs1];   // rs1 é tratado como assinado
-						uint32_t unsigned_rs2 = (uint32_t)x[rs2];  // rs2 é tratado como não assinado
+// addi
+static void exec_addi(cpu_t* cpu, const decoded_t* d) {
+	if(d->rd != 0) cpu->x[d->rd] = cpu->x[d->rs1] + d->imm;
+}
 
-						// Realiza a multiplicação de 64 bits
-						int64_t result = (int64_t)signed_rs1 * (int64_t)unsigned_rs2;
+// xori
+static void exec_xori(cpu_t* cpu, const decoded_t* d) {
+	if(d->rd != 0) cpu->x[d->rd] = cpu->x[d->rs1] ^ d->imm;
+}
 
-						// Armazena a parte alta (high) do resultado no registrador rd
-						x[rd] = (uint32_t)(result >> 32);  // Pegando os 32 bits mais significativos
+// ori (rs1 == zero yields only the immediate)
+static void exec_ori(cpu_t* cpu, const decoded_t* d) {
+	if(d->rd != 0) cpu->x[d->rd] = (d->rs1 == 0) ? (uint32_t)d->imm : cpu->x[d->rs1] | (uint32_t)d->imm;
+}
 
-						// Imprime a instrução e o resultado
-						fprintf(output,"0x%08x:mulhsu %s,%s,%s         %s=0x%08x*0x%08x=0x%08x\n", 
-							pc, x_label[rd], x_label[rs1], x_label[rs2], x_label[rd], signed_rs1, unsigned_rs2, x[rd]);
-					}
-					// mulhu
-				if (funct3 == 0b011 && funct7 == 0b0000001) {
-						// Realiza a multiplicação de dois números não assinados (rs1 * rs2)
-						uint32_t unsigned_rs1 = (uint32_t)x[rs1];   // rs1 é tratado como não assinado
-						uint32_t unsigned_rs2 = (uint32_t)x[rs2];   // rs2 é tratado como não assinado
+// andi
+static void exec_andi(cpu_t* cpu, const decoded_t* d) {
+	if(d->rd != 0) cpu->x[d->rd] = cpu->x[d->rs1] & d->imm;
+}
 
-						// Realiza a multiplicação de 64 bits
-						uint64_t result = (uint64_t)unsigned_rs1 * (uint64_t)unsigned_rs2;
+// srli
+static void exec_srli(cpu_t* cpu, const decoded_t* d) {
+	cpu->x[d->rd] = cpu->x[d->rs1] >> d->imm;
+}
 
-						// Armazena a parte alta (high) do resultado no registrador rd
-						x[rd] = (uint32_t)(result >> 32);  // Pegando os 32 bits mais significativos
+// srai
+static void exec_srai(cpu_t* cpu, const decoded_t* d) {
+	cpu->x[d->rd] = (int32_t)cpu->x[d->rs1] >> d->imm;
+}
 
-						// Imprime a instrução e o resultado
-						fprintf(output,"0x%08x:mulhu  %s,%s,%s         %s=0x%08x*0x%08x=0x%08x\n", 
-							pc, x_label[rd], x_label[rs1], x_label[rs2], x_label[rd], unsigned_rs1, unsigned_rs2, x[rd]);
-					}
-					//div
-				if( funct3 == 0b100 && funct7 == 0b0000001){
-					int32_t dividend = (int32_t)x[rs1];  
-		            int32_t divisor = (int32_t)x[rs2];   
-        		    int32_t result;
-
-					if (divisor == 0) {
-						// Quando o divisor for zero, o resultado é 0xffffffff
-						result = 0xffffffff;
-						fprintf(output,"0x%08x:div    %s,%s,%s         %s=0x%08x/0x%08x=0x%08x\n", 
-							pc,x_label[rd], x_label[rs1], x_label[rs2], x_label[rd], dividend, divisor, result);
-						
-						break;
-						
-					}
+// sltiu
+static void exec_sltiu(cpu_t* cpu, const decoded_t* d) {
+	cpu->x[d->rd] = (cpu->x[d->rs1] < (uint32_t)d->imm) ? 1 : 0;
+}
 
-					result = dividend / divisor;
+// slti
+static void exec_slti(cpu_t* cpu, const decoded_t* d) {
+	cpu->x[d->rd] = ((int32_t)cpu->x[d->rs1] < d->imm) ? 1 : 0;
+}
 
-					x[rd] = result;
+// auipc
+static void exec_auipc(cpu_t* cpu, const decoded_t* d) {
+	if(d->rd != 0) cpu->x[d->rd] = cpu->pc + d->imm;
+}
 
-					fprintf(output,"0x%08x:div    %s,%s,%s         %s=0x%08x/0x%08x=0x%08x\n", 
-                   		pc, x_label[rd], x_label[rs1], x_label[rs2], x_label[rd], dividend, divisor, result);
+// lui
+static void exec_lui(cpu_t* cpu, const decoded_t* d) {
+	cpu->x[d->rd] = d->imm;
+}
 
-				}
-					//divu
-				if(funct3 == 0b101 && funct7 == 0b0000001){
-					uint32_t dividend = (int32_t)x[rs1];  
-		            uint32_t divisor = (int32_t)x[rs2];   
-        		    uint32_t result;
-
-					if (divisor == 0) {
-						// Quando o divisor for zero, o resultado é 0xffffffff
-						result = 0xffffffff;
-						fprintf(output,"0x%08x:divu    %s,%s,%s         %s=0x%08x/0x%08x=0x%08x\n", 
-							pc,x_label[rd], x_label[rs1], x_label[rs2], x_label[rd], dividend, divisor, result);
-						
-						break;
-					}
+// add (rs2 == zero yields only rs1)
+static void exec_add(cpu_t* cpu, const decoded_t* d) {
+	uint32_t* const x = cpu->x;
+	if(d->rd != 0) x[d->rd] = (d->rs2 == 0) ? x[d->rs1] : x[d->rs1] + x[d->rs2];
+}
 
-					result = dividend / divisor;
+// mul
+static void exec_mul(cpu_t* cpu, const decoded_t* d) {
+	cpu->x[d->rd] = (int32_t)cpu->x[d->rs1] * (int32_t)cpu->x[d->rs2];
+}
 
-					x[rd] = result;
+// mulh
+static void exec_mulh(cpu_t* cpu, const decoded_t* d) {
+	const int64_t result = (int64_t)((int32_t)cpu->x[d->rs1]) * (int64_t)((int32_t)cpu->x[d->rs2]);
+	cpu->x[d->rd] = (uint32_t)(result >> 32);
+}
 
-					fprintf(output,"0x%08x:divu    %s,%s,%s         %s=0x%08x/0x%08x=0x%08x\n", 
-                   		pc, x_label[rd], x_label[rs1], x_label[rs2], x_label[rd], dividend, divisor, result);
+// mulhsu
+static void exec_mulhsu(cpu_t* cpu, const decoded_t* d) {
+	const int64_t result = (int64_t)((int32_t)cpu->x[d->rs1]) * (int64_t)cpu->x[d->rs2];
+	cpu->x[d->rd] = (uint32_t)(result >> 32);
+}
 
-				}
-				//rem 
-				if (funct3 == 0b110 && funct7 == 0b0000001)
-				{
-					int32_t dividend = x[rs1];  
-		            int32_t divisor = x[rs2];   
-        		    int32_t result;
+// mulhu
+static void exec_mulhu(cpu_t* cpu, const decoded_t* d) {
+	const uint64_t result = (uint64_t)cpu->x[d->rs1] * (uint64_t)cpu->x[d->rs2];
+	cpu->x[d->rd] = (uint32_t)(result >> 32);
+}
 
+// div (division by zero leaves rd unchanged, overflow yields the dividend)
+static void exec_div(cpu_t* cpu, const decoded_t* d) {
+	const int32_t divisor = cpu->x[d->rs2];
+	if(divisor == -1) cpu->x[d->rd] = 0u - cpu->x[d->rs1];
+	else if(divisor != 0) cpu->x[d->rd] = (int32_t)cpu->x[d->rs1] / divisor;
+}
 
-					if(divisor == 0){
-						result = dividend;
-					}
-					else{
-						result = dividend % divisor;
-					}
+// divu (division by zero leaves rd unchanged)
+static void exec_divu(cpu_t* cpu, const decoded_t* d) {
+	const uint32_t divisor = cpu->x[d->rs2];
+	if(divisor != 0) cpu->x[d->rd] = cpu->x[d->rs1] / divisor;
+}
 
-					x[rd] = result;
+// rem (overflow yields 0)
+static void exec_rem(cpu_t* cpu, const decoded_t* d) {
+	const int32_t dividend = cpu->x[d->rs1];
+	const int32_t divisor = cpu->x[d->rs2];
+	cpu->x[d->rd] = (divisor == 0) ? dividend : (divisor == -1) ? 0 : dividend % divisor;
+}
 
-					fprintf(output,"0x%08x:rem    %s,%s,%s         %s=0x%08x%%0x%08x=0x%08x\n",
-           					pc, x_label[rd], x_label[rs1], x_label[rs2], x_label[rd], dividend, divisor, result);
-				}
-				//remu 
-				if (funct3 == 0b111 && funct7 == 0b0000001)
-				{
-					uint32_t dividend = x[rs1];  
-		            uint32_t divisor = x[rs2];   
-        		    uint32_t result;
+// remu
+static void exec_remu(cpu_t* cpu, const decoded_t* d) {
+	const uint32_t dividend = cpu->x[d->rs1];
+	const uint32_t divisor = cpu->x[d->rs2];
+	cpu->x[d->rd] = (divisor == 0) ? dividend : dividend % divisor;
+}
 
+// sub (rs2 == zero yields only rs1)
+static void exec_sub(cpu_t* cpu, const decoded_t* d) {
+	uint32_t* const x = cpu->x;
+	if(d->rd != 0) x[d->rd] = (d->rs2 == 0) ? x[d->rs1] : x[d->rs1] - x[d->rs2];
+}
 
-					if(divisor == 0){
-						result = dividend;
-					}
-					else{
-						result = dividend % divisor;
-					}
+// xor (rs2 == zero yields only rs1)
+static void exec_xor(cpu_t* cpu, const decoded_t* d) {
+	uint32_t* const x = cpu->x;
+	if(d->rd != 0) x[d->rd] = (d->rs2 == 0) ? x[d->rs1] : x[d->rs1] ^ x[d->rs2];
+}
 
-					x[rd] = result;
+// or (a zero operand yields only the other register)
+static void exec_or(cpu_t* cpu, const decoded_t* d) {
+	uint32_t* const x = cpu->x;
+	if(d->rd != 0) x[d->rd] = (d->rs2 == 0) ? x[d->rs1] : (d->rs1 == 0) ? x[d->rs2] : x[d->rs1] | x[d->rs2];
+}
 
-					fprintf(output,"0x%08x:remu    %s,%s,%s         %s=0x%08x%%0x%08x=0x%08x\n",
-           					pc, x_label[rd], x_label[rs1], x_label[rs2], x_label[rd], dividend, divisor, result);
-				}
-				//sub
-				if (funct3 == 0b000 && funct7 == 0b0100000)
-				{
-					uint32_t data;
+// and (a zero operand yields zero)
+static void exec_and(cpu_t* cpu, const decoded_t* d) {
+	uint32_t* const x = cpu->x;
+	if(d->rd != 0) x[d->rd] = (d->rs1 == 0 || d->rs2 == 0) ? 0 : x[d->rs1] & x[d->rs2];
+}
 
-					// Se rs1 for zero, o resultado será apenas o valor de rs2
-					if (rs1 == 0) {
-						data = x[rs2];  // Não soma nada, apenas copia rs2
-					}
-					if (rs2 == 0)
-					{
-						data = x[rs1];
-					}
-					
-					 else {
-						data = x[rs1] - x[rs2];  // Caso contrário, realiza a soma normal
-					}
+// sll
+static void exec_sll(cpu_t* cpu, const decoded_t* d) {
+	cpu->x[d->rd] = cpu->x[d->rs1] << (cpu->x[d->rs2] & 0x1F);
+}
 
-					// Exibe a instrução corretamente no console
-					fprintf(output, "0x%08x:sub    %s,%s,%s       %s=0x%08x-0x%08x=0x%08x\n",
-							pc, x_label[rd], x_label[rs1], x_label[rs2], x_label[rd], x[rs1], x[rs2], data);
+// srl
+static void exec_srl(cpu_t* cpu, const decoded_t* d) {
+	cpu->x[d->rd] = cpu->x[d->rs1] >> (cpu->x[d->rs2] & 0x1F);
+}
+
+// sra
+static void exec_sra(cpu_t* cpu, const decoded_t* d) {
+	cpu->x[d->rd] = (int32_t)cpu->x[d->rs1] >> (cpu->x[d->rs2] & 0x1F);
+}
+
+// slt (rs1 == zero compares against 0)
+static void exec_slt(cpu_t* cpu, const decoded_t* d) {
+	const int32_t rs1_value = (d->rs1 == 0) ? 0 : (int32_t)cpu->x[d->rs1];
+	if(d->rd != 0) cpu->x[d->rd] = (rs1_value < (int32_t)cpu->x[d->rs2]) ? 1 : 0;
+}
+
+// sltu (rs1 == zero compares against 0)
+static void exec_sltu(cpu_t* cpu, const decoded_t* d) {
+	const uint32_t rs1_value = (d->rs1 == 0) ? 0 : cpu->x[d->rs1];
+	if(d->rd != 0) cpu->x[d->rd] = (rs1_value < cpu->x[d->rs2]) ? 1 : 0;
+}
+
+// sw
+static void exec_sw(cpu_t* cpu, const decoded_t* d) {
+	mem_store(cpu, cpu->x[d->rs1] + d->imm, 4, cpu->x[d->rs2]);
+}
+
+// sb
+static void exec_sb(cpu_t* cpu, const decoded_t* d) {
+	mem_store(cpu, cpu->x[d->rs1] + d->imm, 1, cpu->x[d->rs2]);
+}
+
+// sh
+static void exec_sh(cpu_t* cpu, const decoded_t* d) {
+	mem_store(cpu, cpu->x[d->rs1] + d->imm, 2, cpu->x[d->rs2]);
+}
+
+// Atomics (RV32A): word accesses at x[rs1] on host atomics, so harts running
+// in parallel synchronize through them. Misaligned addresses fault.
+
+// lr.w (reserves the address and the loaded value)
+static void exec_lr(cpu_t* cpu, const decoded_t* d) {
+	page_t* page;
+	const uint32_t address = cpu->x[d->rs1];
+	const uint32_t* word = mem_atomic(cpu, address, &page);
+	if(word == NULL) return;
+	const uint32_t value = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+	cpu->reserved = 1;
+	cpu->reservation = address;
+	cpu->reservation_value = value;
+	if(d->rd != 0) cpu->x[d->rd] = value;
+}
+
+// sc.w (succeeds, writing 0 to rd, when the reserved word still holds the
+// loaded value; the reservation is always released)
+static void exec_sc(cpu_t* cpu, const decoded_t* d) {
+	page_t* page;
+	const uint32_t address = cpu->x[d->rs1];
+	uint32_t* word = mem_atomic(cpu, address, &page);
+	if(word == NULL) return;
+	uint32_t expected = cpu->reservation_value;
+	const int success = cpu->reserved && cpu->reservation == address &&
+		__atomic_compare_exchange_n(word, &expected, cpu->x[d->rs2], 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	cpu->reserved = 0;
+	if(success && page->code != NULL) mem_invalidate(page, address & PAGE_MASK, 4);
+	if(d->rd != 0) cpu->x[d->rd] = !success;
+}
+
+// amoswap.w, amoadd.w, amoxor.w, amoand.w, amoor.w (rd receives the old value)
+#define AMO_FETCH_LIST(X) \
+	X(amoswap, __atomic_exchange_n) X(amoadd, __atomic_fetch_add) X(amoxor, __atomic_fetch_xor) \
+	X(amoand, __atomic_fetch_and) X(amoor, __atomic_fetch_or)
+#define X(name, fetch) \
+	static void exec_##name(cpu_t* cpu, const decoded_t* d) { \
+		page_t* page; \
+		const uint32_t address = cpu->x[d->rs1]; \
+		uint32_t* word = mem_atomic(cpu, address, &page); \
+		if(word == NULL) return; \
+		const uint32_t old = fetch(word, cpu->x[d->rs2], __ATOMIC_SEQ_CST); \
+		if(page->code != NULL) mem_invalidate(page, address & PAGE_MASK, 4); \
+		if(d->rd != 0) cpu->x[d->rd] = old; \
+	}
+AMO_FETCH_LIST(X)
+#undef X
+
+// amomin.w, amomax.w, amominu.w, amomaxu.w (compare and swap loop)
+#define AMO_COMPARE_LIST(X) \
+	X(amomin, int32_t, <) X(amomax, int32_t, >) X(amominu, uint32_t, <) X(amomaxu, uint32_t, >)
+#define X(name, type, compare) \
+	static void exec_##name(cpu_t* cpu, const decoded_t* d) { \
+		page_t* page; \
+		const uint32_t address = cpu->x[d->rs1]; \
+		uint32_t* word = mem_atomic(cpu, address, &page); \
+		if(word == NULL) return; \
+		const uint32_t value = cpu->x[d->rs2]; \
+		uint32_t old = __atomic_load_n(word, __ATOMIC_SEQ_CST), result; \
+		do { \
+			result = ((type)value compare (type)old) ? value : old; \
+		} while(!__atomic_compare_exchange_n(word, &old, result, 1, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)); \
+		if(page->code != NULL) mem_invalidate(page, address & PAGE_MASK, 4); \
+		if(d->rd != 0) cpu->x[d->rd] = old; \
+	}
+AMO_COMPARE_LIST(X)
+#undef X
+
+// ebreak
+static void exec_ebreak(cpu_t* cpu, const decoded_t* d) {
+	const uint32_t pc = cpu->pc;
+	// Retrieving previous and next instructions
+	const uint32_t previous = mem_peek(cpu, pc - 4);
+	const uint32_t next = mem_peek(cpu, pc + d->size);
+	// Halting condition
+	if(previous == 0x01f01013 && next == 0x40705013) cpu->run = 0;
+}
+
+// blt
+static void exec_blt(cpu_t* cpu, const decoded_t* d) {
+	if((int32_t)cpu->x[d->rs1] < (int32_t)cpu->x[d->rs2]) cpu->pc += d->imm - d->size;
+}
+
+// bne
+static void exec_bne(cpu_t* cpu, const decoded_t* d) {
+	if(cpu->x[d->rs1] != cpu->x[d->rs2]) cpu->pc += d->imm - d->size;
+}
+
+// beq
+static void exec_beq(cpu_t* cpu, const decoded_t* d) {
+	if(cpu->x[d->rs1] == cpu->x[d->rs2]) cpu->pc += d->imm - d->size;
+}
+
+// bge
+static void exec_bge(cpu_t* cpu, const decoded_t* d) {
+	if((int32_t)cpu->x[d->rs1] >= (int32_t)cpu->x[d->rs2]) cpu->pc += d->imm - d->size;
+}
+
+// bltu
+static void exec_bltu(cpu_t* cpu, const decoded_t* d) {
+	if(cpu->x[d->rs1] < cpu->x[d->rs2]) cpu->pc += d->imm - d->size;
+}
+
+// bgeu
+static void exec_bgeu(cpu_t* cpu, const decoded_t* d) {
+	if(cpu->x[d->rs1] >= cpu->x[d->rs2]) cpu->pc += d->imm - d->size;
+}
+
+// Branch with reserved funct3 (pc is kept, so the instruction repeats)
+static void exec_branch_reserved(cpu_t* cpu, const decoded_t* d) {
+	cpu->pc -= d->size;
+}
+
+// jalr
+static void exec_jalr(cpu_t* cpu, const decoded_t* d) {
+	// Calculating target address before updating rd
+	const uint32_t target_address = (cpu->x[d->rs1] + d->imm) & ~1;
+	if(d->rd != 0) cpu->x[d->rd] = cpu->pc + d->size;
+	cpu->pc = target_address - d->size;
+}
+
+// Loads (faulting addresses leave rd unchanged)
+
+// lw
+static void exec_lw(cpu_t* cpu, const decoded_t* d) {
+	uint32_t value;
+	if(mem_load(cpu, cpu->x[d->rs1] + d->imm, 4, &value)) cpu->x[d->rd] = value;
+}
+
+// lb
+static void exec_lb(cpu_t* cpu, const decoded_t* d) {
+	uint32_t value;
+	if(mem_load(cpu, cpu->x[d->rs1] + d->imm, 1, &value)) cpu->x[d->rd] = (int32_t)(int8_t)value;
+}
+
+// lh (reference simulator keeps only the low byte, zero-extended)
+static void exec_lh(cpu_t* cpu, const decoded_t* d) {
+	uint32_t value;
+	if(mem_load(cpu, cpu->x[d->rs1] + d->imm, 2, &value)) cpu->x[d->rd] = (uint8_t)value;
+}
+
+// lbu
+static void exec_lbu(cpu_t* cpu, const decoded_t* d) {
+	uint32_t value;
+	if(mem_load(cpu, cpu->x[d->rs1] + d->imm, 1, &value)) cpu->x[d->rd] = value;
+}
+
+// lhu
+static void exec_lhu(cpu_t* cpu, const decoded_t* d) {
+	uint32_t value;
+	if(mem_load(cpu, cpu->x[d->rs1] + d->imm, 2, &value)) cpu->x[d->rd] = value;
+}
+
+// jal
+static void exec_jal(cpu_t* cpu, const decoded_t* d) {
+	if(d->rd != 0) cpu->x[d->rd] = cpu->pc + d->size;
+	// Setting next pc minus the instruction size
+	cpu->pc += d->imm - d->size;
+}
+
+// No operation (reserved encodings of known opcodes)
+static void exec_nop(cpu_t* cpu, const decoded_t* d) {
+}
+
+/**
+ * Enters the machine-mode trap handler from the instruction at pc (mepc),
+ * leaving pc at the handler address minus the instruction size like
+ * instruction handlers do (vectored mtvec sends interrupts to base + 4 * cause)
+ * @param cpu	Simulator state
+ * @param cause	mcause
+ * @param tval	mtval
+ * @param size	Trapping instruction size (0 between instructions)
+ */
+static void trap_enter(cpu_t* cpu, uint32_t cause, uint32_t tval, uint32_t size) {
+	csr_t* csr = &cpu->csr;
+	csr->mepc = cpu->pc;
+	csr->mcause = cause;
+	csr->mtval = tval;
+	csr->mstatus = (csr->mstatus & ~(MSTATUS_MIE | MSTATUS_MPIE)) | ((csr->mstatus & MSTATUS_MIE) ? MSTATUS_MPIE : 0);
+	const uint32_t base = csr->mtvec & ~3u;
+	cpu->pc = ((cause & CAUSE_INTERRUPT) && (csr->mtvec & 1) ? base + 4 * (cause & ~CAUSE_INTERRUPT) : base) - size;
+	cpu->trapped = 1;
+	trap_update(cpu);
+}
+
+// Unknown
+static void exec_unknown(cpu_t* cpu, const decoded_t* d) {
+	// Stopping before a debugger breakpoint (armed as an unknown instruction):
+	// pc is kept and the instruction is not counted
+	if(cpu->debug != NULL && debug_breakpoint(cpu->debug, cpu->pc)) {
+		cpu->debug->stop = DEBUG_BREAKPOINT;
+		cpu->run = 0;
+		cpu->pc -= d->size;
+		cpu->instret--;
+		return;
+	}
+	// Raising an illegal instruction exception once a trap handler is installed
+	if(cpu->csr.mtvec != 0) {
+		trap_enter(cpu, CAUSE_ILLEGAL, d->instruction, d->size);
+		return;
+	}
+	// Outputting error message to console (the trace line may be filtered out)
+	if(cpu->trace_mode != TRACE_ALL && !cpu->muted) fprintf(stderr,"error: unknown instruction opcode at pc = 0x%08x\n", cpu->pc);
+	// Halting simulation
+	cpu->run = 0;
+}
+
+// Hart index read (csrrs rd, mhartid, zero)
+static void exec_mhartid(cpu_t* cpu, const decoded_t* d) {
+	if(d->rd != 0) cpu->x[d->rd] = cpu->hartid;
+}
+
+/**
+ * Reads mip: software interrupt and timer (mtime reached mtimecmp) pending bits
+ * @param cpu	Simulator state
+ * @return		Returns mip
+ */
+static uint32_t csr_mip(const cpu_t* cpu) {
+	devices_t* devices = cpu->memory->devices;
+	if(devices == NULL) return 0;
+	pthread_mutex_lock(&devices->lock);
+	const uint32_t mip = (devices->msip[cpu->hartid] ? MIP_MSIP : 0) | ((device_mtime(cpu) >= devices->mtimecmp[cpu->hartid]) ? MIP_MTIP : 0);
+	pthread_mutex_unlock(&devices->lock);
+	return mip;
+}
+
+/**
+ * Reads a CSR (counters run one cycle per instruction, time is mtime, or the
+ * instruction count without devices)
+ * @param cpu		Simulator state
+ * @param number	CSR number
+ * @param value		Read value
+ * @return			Returns 1 on success, 0 for unimplemented CSRs
+ */
+static int csr_read(const cpu_t* cpu, uint32_t number, uint32_t* value) {
+	const csr_t* csr = &cpu->csr;
+	const uint64_t instret = cpu_instret(cpu);
+	switch(number) {
+		case 0x300: *value = csr->mstatus | MSTATUS_MPP; break;
+		// misa: RV32IMAC
+		case 0x301: *value = 0x40001105; break;
+		case 0x304: *value = csr->mie; break;
+		case 0x305: *value = csr->mtvec; break;
+		case 0x340: *value = csr->mscratch; break;
+		case 0x341: *value = csr->mepc; break;
+		case 0x342: *value = csr->mcause; break;
+		case 0x343: *value = csr->mtval; break;
+		case 0x344: *value = csr_mip(cpu); break;
+		// mcycle, minstret, cycle, time, instret and their high halves
+		case 0xB00: case 0xC00: *value = (uint32_t)(instret + csr->mcycle_offset); break;
+		case 0xB80: case 0xC80: *value = (uint32_t)((instret + csr->mcycle_offset) >> 32); break;
+		case 0xB02: case 0xC02: *value = (uint32_t)(instret + csr->minstret_offset); break;
+		case 0xB82: case 0xC82: *value = (uint32_t)((instret + csr->minstret_offset) >> 32); break;
+		case 0xC01: *value = (uint32_t)((cpu->memory->devices != NULL) ? device_mtime(cpu) : instret); break;
+		case 0xC81: *value = (uint32_t)(((cpu->memory->devices != NULL) ? device_mtime(cpu) : instret) >> 32); break;
+		// mvendorid, marchid, mimpid and mhartid
+		case 0xF11: case 0xF12: case 0xF13: *value = 0; break;
+		case 0xF14: *value = cpu->hartid; break;
+		default: return 0;
+	}
+	return 1;
+}
+
+/**
+ * Writes a CSR (implemented and writable, WARL fields masked), updating the
+ * interrupt boundary
+ * @param cpu		Simulator state
+ * @param number	CSR number
+ * @param value		Written value
+ */
+static void csr_write(cpu_t* cpu, uint32_t number, uint32_t value) {
+	csr_t* csr = &cpu->csr;
+	const uint64_t instret = cpu_instret(cpu);
+	const uint64_t mcycle = instret + csr->mcycle_offset, minstret = instret + csr->minstret_offset;
+	switch(number) {
+		case 0x300: csr->mstatus = value & (MSTATUS_MIE | MSTATUS_MPIE); break;
+		case 0x304: csr->mie = value & (MIP_MSIP | MIP_MTIP | MIP_MEIP); break;
+		// Direct and vectored modes
+		case 0x305: csr->mtvec = value & ~2u; break;
+		case 0x340: csr->mscratch = value; break;
+		case 0x341: csr->mepc = value & ~1u; break;
+		case 0x342: csr->mcause = value; break;
+		case 0x343: csr->mtval = value; break;
+		// Counters move their offsets so they read the written half
+		case 0xB00: csr->mcycle_offset = ((mcycle & ~(uint64_t)(0xFFFFFFFF)) | value) - instret; break;
+		case 0xB80: csr->mcycle_offset = (((uint64_t)(value) << 32) | (uint32_t)(mcycle)) - instret; break;
+		case 0xB02: csr->minstret_offset = ((minstret & ~(uint64_t)(0xFFFFFFFF)) | value) - instret; break;
+		case 0xB82: csr->minstret_offset = (((uint64_t)(value) << 32) | (uint32_t)(minstret)) - instret; break;
+		// misa and mip ignore writes
+		default: break;
+	}
+	trap_update(cpu);
+}
+
+// csrrw, csrrs, csrrc and their immediate forms (csrrs and csrrc with a zero
+// source only read; unimplemented CSRs and writes to read-only ones are illegal)
+static void exec_csr(cpu_t* cpu, const decoded_t* d) {
+	// funct3: immediate form (bit 2), then 01 swap, 10 set and 11 clear
+	const uint8_t funct3 = (d->instruction >> 12) & 0b111;
+	const uint32_t number = d->imm & 0xFFF;
+	const uint32_t source = (funct3 & 0b100) ? d->rs1 : cpu->x[d->rs1];
+	const int write = (funct3 & 0b11) == 0b01 || d->rs1 != 0;
+	uint32_t value;
+	if(!csr_read(cpu, number, &value) || (write && (number >> 10) == 0b11)) {
+		exec_unknown(cpu, d);
+		return;
+	}
+	if(write) csr_write(cpu, number, ((funct3 & 0b11) == 0b01) ? source : ((funct3 & 0b11) == 0b10) ? value | source : value & ~source);
+	if(d->rd != 0) cpu->x[d->rd] = value;
+}
+
+// ecall (environment call from machine mode)
+static void exec_ecall(cpu_t* cpu, const decoded_t* d) {
+	trap_enter(cpu, CAUSE_ECALL, 0, d->size);
+}
+
+// mret (returning to mepc with the interrupt enable restored)
+static void exec_mret(cpu_t* cpu, const decoded_t* d) {
+	csr_t* csr = &cpu->csr;
+	csr->mstatus = (csr->mstatus & ~MSTATUS_MIE) | ((csr->mstatus & MSTATUS_MPIE) ? MSTATUS_MIE : 0) | MSTATUS_MPIE;
+	cpu->pc = csr->mepc - d->size;
+	trap_update(cpu);
+}
+
+// Fetch outside memory
+static void exec_fetch_fault(cpu_t* cpu, const decoded_t* d) {
+	mem_fault(cpu, cpu->pc);
+}
+
+// Operations (name, handler), in dispatch table order
+#define OP_LIST(X) \
+	X(SLLI, exec_slli) X(ADDI, exec_addi) X(XORI, exec_xori) X(ORI, exec_ori) \
+	X(ANDI, exec_andi) X(SRLI, exec_srli) X(SRAI, exec_srai) X(SLTIU, exec_sltiu) \
+	X(SLTI, exec_slti) X(AUIPC, exec_auipc) X(LUI, exec_lui) X(ADD, exec_add) \
+	X(MUL, exec_mul) X(MULH, exec_mulh) X(MULHSU, exec_mulhsu) X(MULHU, exec_mulhu) \
+	X(DIV, exec_div) X(DIVU, exec_divu) X(REM, exec_rem) X(REMU, exec_remu) \
+	X(SUB, exec_sub) X(XOR, exec_xor) X(OR, exec_or) X(AND, exec_and) \
+	X(SLL, exec_sll) X(SRL, exec_srl) X(SRA, exec_sra) X(SLT, exec_slt) \
+	X(SLTU, exec_sltu) X(SW, exec_sw) X(SB, exec_sb) X(SH, exec_sh) \
+	X(SC, exec_sc) X(AMOSWAP, exec_amoswap) X(AMOADD, exec_amoadd) X(AMOXOR, exec_amoxor) \
+	X(AMOAND, exec_amoand) X(AMOOR, exec_amoor) X(AMOMIN, exec_amomin) X(AMOMAX, exec_amomax) \
+	X(AMOMINU, exec_amominu) X(AMOMAXU, exec_amomaxu) \
+	X(BLT, exec_blt) X(BNE, exec_bne) X(BEQ, exec_beq) X(BGE, exec_bge) \
+	X(BLTU, exec_bltu) X(BGEU, exec_bgeu) X(BRANCH_RESERVED, exec_branch_reserved) X(JALR, exec_jalr) \
+	X(JAL, exec_jal) X(CSRRW, exec_csr) X(CSRRS, exec_csr) X(CSRRC, exec_csr) \
+	X(CSRRWI, exec_csr) X(CSRRSI, exec_csr) X(CSRRCI, exec_csr) X(ECALL, exec_ecall) \
+	X(MRET, exec_mret) X(UNKNOWN, exec_unknown) X(LW, exec_lw) X(LB, exec_lb) \
+	X(LH, exec_lh) X(LBU, exec_lbu) X(LHU, exec_lhu) X(LR, exec_lr) \
+	X(NOP, exec_nop) X(EBREAK, exec_ebreak) X(MHARTID, exec_mhartid) X(FETCH_FAULT, exec_fetch_fault)
+
+// Operation indexes
+enum {
+#define X(name, handler) OP_##name,
+	OP_LIST(X)
+#undef X
+	OP_COUNT
+};
+
+// Control flow operations (blocks end after them), including the system ones
+// that may trap or change the pending interrupts (a single range)
+#define OP_CONTROL(op) ((op) >= OP_BLT && (op) <= OP_UNKNOWN)
+
+// Handler table, indexed by operation
+static const handler_t op_handler[OP_COUNT] = {
+#define X(name, handler) handler,
+	OP_LIST(X)
+#undef X
+};
+
+// Handlers of compressed instructions: the expanded handler leaves pc at the
+// next instruction minus 2 (its size), moved to minus 4 like the other ones,
+// so engines always increment pc by 4
+#define X(name, handler) \
+	static void exec_compressed_##name(cpu_t* cpu, const decoded_t* d) { \
+		handler(cpu, d); \
+		cpu->pc -= 2; \
+	}
+OP_LIST(X)
+#undef X
+
+// Compressed handler table, indexed by operation
+static const handler_t op_compressed[OP_COUNT] = {
+#define X(name, handler) exec_compressed_##name,
+	OP_LIST(X)
+#undef X
+};
+
+// Expansion of illegal and unsupported compressed encodings (unknown opcode)
+#define COMPRESSED_ILLEGAL 0xFFFFFFFF
+
+/**
+ * Expands a compressed (RVC) instruction into its 32-bit equivalent
+ * @param c		Compressed instruction (low 16 bits)
+ * @return		Returns the 32-bit instruction, or COMPRESSED_ILLEGAL for
+ *				illegal, reserved and floating point encodings
+ */
+static uint32_t compressed_expand(uint32_t c) {
+	// 32-bit formats (immediates already in place, sign-extended)
+#define I(imm, rs1, funct3, rd, opcode) ((((uint32_t)(imm) & 0xFFF) << 20) | ((rs1) << 15) | ((funct3) << 12) | ((rd) << 7) | (opcode))
+#define S(imm, rs2, rs1) (((((uint32_t)(imm) >> 5) & 0x7F) << 25) | ((rs2) << 20) | ((rs1) << 15) | (0b010 << 12) | (((imm) & 0x1F) << 7) | 0b0100011)
+#define R(funct7, rs2, rs1, funct3, rd) (((funct7) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((funct3) << 12) | ((rd) << 7) | 0b0110011)
+#define B(imm, rs1, funct3) (((((uint32_t)(imm) >> 12) & 1) << 31) | ((((imm) >> 5) & 0x3F) << 25) | ((rs1) << 15) | ((funct3) << 12) | ((((imm) >> 1) & 0xF) << 8) | ((((imm) >> 11) & 1) << 7) | 0b1100011)
+#define J(imm, rd) (((((uint32_t)(imm) >> 20) & 1) << 31) | ((((imm) >> 1) & 0x3FF) << 21) | ((((imm) >> 11) & 1) << 20) | ((((imm) >> 12) & 0xFF) << 12) | ((rd) << 7) | 0b1101111)
+	// Full registers (11:7 and 6:2) and x8 to x15 ones (9:7 and 4:2)
+	const uint32_t rd = (c >> 7) & 0b11111, rs2 = (c >> 2) & 0b11111;
+	const uint32_t rd_c = 8 + ((c >> 7) & 0b111), rs2_c = 8 + ((c >> 2) & 0b111);
+	// 6-bit immediate (12 and 6:2), sign-extended
+	const int32_t imm6 = ((c & (1 << 12)) ? -32 : 0) | ((c >> 2) & 0b11111);
+	// Word offsets of lw/sw (12:10, 6 and 5) and of lwsp (12, 6:4 and 3:2) and swsp (12:9 and 8:7)
+	const uint32_t offset = (((c >> 10) & 0b111) << 3) | (((c >> 6) & 1) << 2) | (((c >> 5) & 1) << 6);
+	const uint32_t offset_lwsp = (((c >> 12) & 1) << 5) | (((c >> 4) & 0b111) << 2) | (((c >> 2) & 0b11) << 6);
+	const uint32_t offset_swsp = (((c >> 9) & 0b1111) << 2) | (((c >> 7) & 0b11) << 6);
+	// Jump offset (12, 11, 10:9, 8, 7, 6, 5:3 and 2) and branch offset (12, 11:10, 6:5, 4:3 and 2)
+	const int32_t jump = ((c & (1 << 12)) ? -2048 : 0) | (((c >> 11) & 1) << 4) | (((c >> 9) & 0b11) << 8) | (((c >> 8) & 1) << 10) |
+		(((c >> 7) & 1) << 6) | (((c >> 6) & 1) << 7) | (((c >> 3) & 0b111) << 1) | (((c >> 2) & 1) << 5);
+	const int32_t branch = ((c & (1 << 12)) ? -256 : 0) | (((c >> 10) & 0b11) << 3) | (((c >> 5) & 0b11) << 6) | (((c >> 3) & 0b11) << 1) | (((c >> 2) & 1) << 5);
+	uint32_t expanded = COMPRESSED_ILLEGAL;
+	// Selecting by quadrant (1:0) and funct3 (15:13)
+	switch(((c & 0b11) << 3) | ((c >> 13) & 0b111)) {
+		// c.addi4spn (zero immediate is illegal)
+		case 0b00000:
+			{
+				const uint32_t imm = (((c >> 7) & 0b1111) << 6) | (((c >> 11) & 0b11) << 4) | (((c >> 5) & 1) << 3) | (((c >> 6) & 1) << 2);
+				if(imm != 0) expanded = I(imm, 2, 0b000, rs2_c, 0b0010011);
+			}
+			break;
+		// c.lw and c.sw
+		case 0b00010: expanded = I(offset, rd_c, 0b010, rs2_c, 0b0000011); break;
+		case 0b00110: expanded = S(offset, rs2_c, rd_c); break;
+		// c.addi (c.nop), c.jal, c.li
+		case 0b01000: expanded = I(imm6, rd, 0b000, rd, 0b0010011); break;
+		case 0b01001: expanded = J(jump, 1); break;
+		case 0b01010: expanded = I(imm6, 0, 0b000, rd, 0b0010011); break;
+		// c.addi16sp (rd = sp) and c.lui (zero immediates are reserved)
+		case 0b01011:
+			if(rd == 2) {
+				const int32_t imm = ((c & (1 << 12)) ? -512 : 0) | (((c >> 6) & 1) << 4) | (((c >> 5) & 1) << 6) | (((c >> 3) & 0b11) << 7) | (((c >> 2) & 1) << 5);
+				if(imm != 0) expanded = I(imm, 2, 0b000, 2, 0b0010011);
+			} else if(imm6 != 0) {
+				expanded = (((uint32_t)(imm6) << 12) & 0xFFFFF000) | (rd << 7) | 0b0110111;
+			}
+			break;
+		// c.srli, c.srai, c.andi, c.sub, c.xor, c.or and c.and (shift amounts
+		// above 31 and the RV64 forms are reserved)
+		case 0b01100:
+			switch((c >> 10) & 0b11) {
+				case 0b00: if(!(c & (1 << 12))) expanded = I(rs2, rd_c, 0b101, rd_c, 0b0010011); break;
+				case 0b01: if(!(c & (1 << 12))) expanded = I(0x400 | rs2, rd_c, 0b101, rd_c, 0b0010011); break;
+				case 0b10: expanded = I(imm6, rd_c, 0b111, rd_c, 0b0010011); break;
+				case 0b11:
+					if(!(c & (1 << 12))) {
+						static const uint8_t funct3[4] = { 0b000, 0b100, 0b110, 0b111 };
+						const uint32_t funct2 = (c >> 5) & 0b11;
+						expanded = R((funct2 == 0) ? 0b0100000 : 0, rs2_c, rd_c, funct3[funct2], rd_c);
+					}
+					break;
+			}
+			break;
+		// c.j, c.beqz and c.bnez
+		case 0b01101: expanded = J(jump, 0); break;
+		case 0b01110: expanded = B(branch, rd_c, 0b000); break;
+		case 0b01111: expanded = B(branch, rd_c, 0b001); break;
+		// c.slli (shift amounts above 31 are reserved)
+		case 0b10000: if(!(c & (1 << 12))) expanded = I(rs2, rd, 0b001, rd, 0b0010011); break;
+		// c.lwsp (rd = zero is reserved) and c.swsp
+		case 0b10010: if(rd != 0) expanded = I(offset_lwsp, 2, 0b010, rd, 0b0000011); break;
+		case 0b10110: expanded = S(offset_swsp, rs2, 2); break;
+		// c.jr, c.mv, c.ebreak, c.jalr and c.add
+		case 0b10100:
+			if(!(c & (1 << 12))) {
+				if(rs2 != 0) expanded = R(0, rs2, 0, 0b000, rd);
+				else if(rd != 0) expanded = I(0, rd, 0b000, 0, 0b1100111);
+			} else {
+				if(rs2 != 0) expanded = R(0, rs2, rd, 0b000, rd);
+				else if(rd != 0) expanded = I(0, rd, 0b000, 1, 0b1100111);
+				else expanded = 0x00100073;
+			}
+			break;
+	}
+#undef I
+#undef S
+#undef R
+#undef B
+#undef J
+	return expanded;
+}
+
+/**
+ * Decodes an instruction into its handler, register indexes and immediate
+ * (compressed instructions decode as their expansion)
+ * @param d				Decoded instruction to be filled
+ * @param instruction	Raw instruction word (only the low 16 bits are used
+ *						for compressed instructions)
+ */
+static void decode(decoded_t* d, uint32_t instruction) {
+	if((instruction & 0b11) != 0b11) {
+		decode(d, compressed_expand(instruction & 0xFFFF));
+		d->instruction = instruction & 0xFFFF;
+		d->size = 2;
+		d->dispatch = OP_COUNT;
+		d->handler = op_compressed[d->op];
+		return;
+	}
+	d->size = 4;
+	// Retrieving instruction opcode (6:0)
+	const uint8_t opcode = instruction & 0b1111111;
+	// Retrieving instruction fields
+	const uint8_t funct7 = instruction >> 25;
+	const uint16_t imm = instruction >> 20;
+	const uint8_t funct3 = (instruction & (0b111 << 12)) >> 12;
+	// Storing register indexes and raw instruction
+	d->instruction = instruction;
+	d->rd = (instruction & (0b11111 << 7)) >> 7;
+	d->rs1 = (instruction & (0b11111 << 15)) >> 15;
+	d->rs2 = (instruction >> 20) & 0b11111;
+	// I type immediate (sign-extended 12 bits)
+	d->imm = (int32_t)(instruction) >> 20;
+	// Selecting handler (reserved encodings of known opcodes do nothing)
+	d->op = OP_NOP;
+	switch(opcode) {
+		// I type (0010011)
+		case 0b0010011:
+			if(funct3 == 0b001 && funct7 == 0b0000000) d->op = OP_SLLI;
+			if(funct3 == 0b000) d->op = OP_ADDI;
+			if(funct3 == 0b100) d->op = OP_XORI;
+			if(funct3 == 0b110) d->op = OP_ORI;
+			if(funct3 == 0b111) d->op = OP_ANDI;
+			if(funct3 == 0b101 && funct7 == 0b0000000) d->op = OP_SRLI;
+			if(funct3 == 0b101 && funct7 == 0b0100000) d->op = OP_SRAI;
+			if(funct3 == 0b011) d->op = OP_SLTIU;
+			if(funct3 == 0b010) d->op = OP_SLTI;
+			// Shift amount (24:20)
+			if(funct3 == 0b001 || funct3 == 0b101) d->imm = imm & 0b11111;
+			break;
+		// U type (0010111 and 0110111)
+		case 0b0010111:
+			d->op = OP_AUIPC;
+			d->imm = instruction & 0xFFFFF000;
+			break;
+		case 0b0110111:
+			d->op = OP_LUI;
+			d->imm = instruction & 0xFFFFF000;
+			break;
+		// R type (0110011)
+		case 0b0110011:
+			if(funct7 == 0b0000000) {
+				if(funct3 == 0b000) d->op = OP_ADD;
+				if(funct3 == 0b001) d->op = OP_SLL;
+				if(funct3 == 0b010) d->op = OP_SLT;
+				if(funct3 == 0b011) d->op = OP_SLTU;
+				if(funct3 == 0b100) d->op = OP_XOR;
+				if(funct3 == 0b101) d->op = OP_SRL;
+				if(funct3 == 0b110) d->op = OP_OR;
+				if(funct3 == 0b111) d->op = OP_AND;
+			}
+			if(funct7 == 0b0000001) {
+				if(funct3 == 0b000) d->op = OP_MUL;
+				if(funct3 == 0b001) d->op = OP_MULH;
+				if(funct3 == 0b010) d->op = OP_MULHSU;
+				if(funct3 == 0b011) d->op = OP_MULHU;
+				if(funct3 == 0b100) d->op = OP_DIV;
+				if(funct3 == 0b101) d->op = OP_DIVU;
+				if(funct3 == 0b110) d->op = OP_REM;
+				if(funct3 == 0b111) d->op = OP_REMU;
+			}
+			if(funct7 == 0b0100000) {
+				if(funct3 == 0b000) d->op = OP_SUB;
+				if(funct3 == 0b101) d->op = OP_SRA;
+			}
+			break;
+		// S type (0100011)
+		case 0b0100011:
+			if(funct3 == 0b010) d->op = OP_SW;
+			if(funct3 == 0b000) d->op = OP_SB;
+			if(funct3 == 0b001) d->op = OP_SH;
+			// S type immediate (sign-extended 12 bits)
+			d->imm = ((int32_t)((((instruction >> 25) << 5) | ((instruction >> 7) & 0x1F)) << 20)) >> 20;
+			break;
+		// Atomics (0101111, word size only)
+		case 0b0101111:
+			d->op = OP_UNKNOWN;
+			d->imm = 0;
+			if(funct3 == 0b010) {
+				const uint8_t funct5 = instruction >> 27;
+				if(funct5 == 0b00010 && d->rs2 == 0) d->op = OP_LR;
+				if(funct5 == 0b00011) d->op = OP_SC;
+				if(funct5 == 0b00001) d->op = OP_AMOSWAP;
+				if(funct5 == 0b00000) d->op = OP_AMOADD;
+				if(funct5 == 0b00100) d->op = OP_AMOXOR;
+				if(funct5 == 0b01100) d->op = OP_AMOAND;
+				if(funct5 == 0b01000) d->op = OP_AMOOR;
+				if(funct5 == 0b10000) d->op = OP_AMOMIN;
+				if(funct5 == 0b10100) d->op = OP_AMOMAX;
+				if(funct5 == 0b11000) d->op = OP_AMOMINU;
+				if(funct5 == 0b11100) d->op = OP_AMOMAXU;
+			}
+			break;
+		// I type (1110011)
+		case 0b1110011:
+			// ebreak (funct3 == 000 and imm == 1), ecall and mret
+			if(funct3 == 0b000 && imm == 1) d->op = OP_EBREAK;
+			if(instruction == 0x00000073) d->op = OP_ECALL;
+			if(instruction == 0x30200073) d->op = OP_MRET;
+			// CSR instructions (funct3 != 000, 100), the CSR number in imm
+			if(funct3 == 0b001) d->op = OP_CSRRW;
+			if(funct3 == 0b010) d->op = OP_CSRRS;
+			if(funct3 == 0b011) d->op = OP_CSRRC;
+			if(funct3 == 0b101) d->op = OP_CSRRWI;
+			if(funct3 == 0b110) d->op = OP_CSRRSI;
+			if(funct3 == 0b111) d->op = OP_CSRRCI;
+			if(funct3 != 0b000) d->imm = imm;
+			// csrrs rd, mhartid, zero (kept apart for its trace line)
+			if(funct3 == 0b010 && imm == 0xF14 && d->rs1 == 0) d->op = OP_MHARTID;
+			break;
+		// B type (1100011)
+		case 0b1100011:
+			d->op = OP_BRANCH_RESERVED;
+			if(funct3 == 0b100) d->op = OP_BLT;
+			if(funct3 == 0b001) d->op = OP_BNE;
+			if(funct3 == 0b000) d->op = OP_BEQ;
+			if(funct3 == 0b101) d->op = OP_BGE;
+			if(funct3 == 0b110) d->op = OP_BLTU;
+			if(funct3 == 0b111) d->op = OP_BGEU;
+			// B type immediate (sign-extended 13 bits)
+			{
+				int32_t imm_b = 0;
+				imm_b |= ((instruction >> 31) & 0x1) << 12;  // Bit 12 (sinal)
+				imm_b |= ((instruction >> 7) & 0x1) << 11;   // Bit 11
+				imm_b |= ((instruction >> 25) & 0x3F) << 5;  // Bits 10-5
+				imm_b |= ((instruction >> 8) & 0xF) << 1;    // Bits 4-1
+				d->imm = (imm_b << 19) >> 19;
+			}
+			break;
+		// JALR (1100111)
+		case 0b1100111:
+			d->op = OP_JALR;
+			break;
+		// I type (0000011)
+		case 0b0000011:
+			if(funct3 == 0b010) d->op = OP_LW;
+			if(funct3 == 0b000) d->op = OP_LB;
+			if(funct3 == 0b001) d->op = OP_LH;
+			if(funct3 == 0b100) d->op = OP_LBU;
+			if(funct3 == 0b101) d->op = OP_LHU;
+			break;
+		// Jal type (1101111)
+		case 0b1101111:
+			d->op = OP_JAL;
+			{
+				const uint32_t imm20 = ((instruction >> 31) << 19) | (((instruction & (0b11111111 << 12)) >> 12) << 11) | (((instruction & (0b1 << 20)) >> 20) << 10) | ((instruction & (0b1111111111 << 21)) >> 21);
+				// Extensão de sinal auxiliar
+				uint32_t simm_aux = ((imm20 >> 20)) ? (0xFFF00000) : (imm20);
+				simm_aux |= (simm_aux & 0x800) ? 0xFFFFF000 : 0x00000000;
+				d->imm = simm_aux << 1;
+			}
+			break;
+		// Unknown
+		default:
+			d->op = OP_UNKNOWN;
+	}
+	// Binding handler
+	d->dispatch = d->op;
+	d->handler = op_handler[d->op];
+}
+
+/**
+ * Writes the buffered trace bytes to the trace file
+ * @param buffer	Trace buffer
+ */
+static void trace_flush(trace_buffer_t* buffer) {
+	fwrite(buffer->data, 1, buffer->used, buffer->file);
+	buffer->used = 0;
+}
+
+/**
+ * Appends a binary record of an executed instruction to the trace buffer
+ * @param buffer	Trace buffer
+ * @param pc			Instruction address
+ * @param instruction	Raw instruction word (TRACE_FAULT for faults)
+ * @param v1			rs1 value before execution
+ * @param v2			rs2 value before execution
+ * @param vd			rd value after execution
+ */
+static inline void trace_record(trace_buffer_t* buffer, uint32_t pc, uint32_t instruction, uint32_t v1, uint32_t v2, uint32_t vd) {
+	if(buffer->used + sizeof(trace_record_t) > TRACE_BUFFER_SIZE) trace_flush(buffer);
+	const trace_record_t record = { pc, instruction, v1, v2, vd };
+	memcpy(buffer->data + buffer->used, &record, sizeof(record));
+	buffer->used += sizeof(record);
+}
+
+// Hexadecimal digit pairs for every byte value ("00" to "ff")
+static const char hex_pair[513] =
+	"000102030405060708090a0b0c0d0e0f"
+	"101112131415161718191a1b1c1d1e1f"
+	"202122232425262728292a2b2c2d2e2f"
+	"303132333435363738393a3b3c3d3e3f"
+	"404142434445464748494a4b4c4d4e4f"
+	"505152535455565758595a5b5c5d5e5f"
+	"606162636465666768696a6b6c6d6e6f"
+	"707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f"
+	"909192939495969798999a9b9c9d9e9f"
+	"a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+	"b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+	"c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+	"d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+	"e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+	"f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+// Text fragment, padded so it can always be copied as 16 bytes
+typedef struct {
+	// Characters
+	char s[15];
+	// Length
+	uint8_t n;
+} fragment_t;
+
+#define FRAGMENT(s) { s, sizeof(s) - 1 }
+
+// Register labels as text fragments
+static const fragment_t x_fragment[32] = {
+	FRAGMENT("zero"), FRAGMENT("ra"), FRAGMENT("sp"), FRAGMENT("gp"), FRAGMENT("tp"), FRAGMENT("t0"), FRAGMENT("t1"), FRAGMENT("t2"),
+	FRAGMENT("s0"), FRAGMENT("s1"), FRAGMENT("a0"), FRAGMENT("a1"), FRAGMENT("a2"), FRAGMENT("a3"), FRAGMENT("a4"), FRAGMENT("a5"),
+	FRAGMENT("a6"), FRAGMENT("a7"), FRAGMENT("s2"), FRAGMENT("s3"), FRAGMENT("s4"), FRAGMENT("s5"), FRAGMENT("s6"), FRAGMENT("s7"),
+	FRAGMENT("s8"), FRAGMENT("s9"), FRAGMENT("s10"), FRAGMENT("s11"), FRAGMENT("t3"), FRAGMENT("t4"), FRAGMENT("t5"), FRAGMENT("t6")
+};
+
+// Trace text of each operation: padded mnemonic, operator and the gap before
+// the result (column spacing kept exactly as in the reference simulator)
+typedef struct {
+	fragment_t mnemonic;
+	fragment_t operator;
+	fragment_t gap;
+} op_text_t;
+
+static const op_text_t op_text[OP_COUNT] = {
+	[OP_SLLI] = { FRAGMENT("slli   "), FRAGMENT("<<"), FRAGMENT("  ") },
+	[OP_ADDI] = { FRAGMENT("addi   "), FRAGMENT("+"), FRAGMENT("   ") },
+	[OP_XORI] = { FRAGMENT("xori   "), FRAGMENT("^"), FRAGMENT("   ") },
+	[OP_ORI] = { FRAGMENT("ori   "), FRAGMENT("|"), FRAGMENT("   ") },
+	[OP_ANDI] = { FRAGMENT("andi   "), FRAGMENT("&"), FRAGMENT("   ") },
+	[OP_SRLI] = { FRAGMENT("srli   "), FRAGMENT(">>"), FRAGMENT("          ") },
+	[OP_SRAI] = { FRAGMENT("srai   "), FRAGMENT(">>>"), FRAGMENT("          ") },
+	[OP_SLTIU] = { FRAGMENT("sltiu   "), FRAGMENT("<"), FRAGMENT("       ") },
+	[OP_SLTI] = { FRAGMENT("slti   "), FRAGMENT("<"), FRAGMENT("       ") },
+	[OP_AUIPC] = { FRAGMENT("auipc  "), FRAGMENT("+"), FRAGMENT("    ") },
+	[OP_LUI] = { FRAGMENT("lui    "), FRAGMENT(""), FRAGMENT("     ") },
+	[OP_ADD] = { FRAGMENT("add    "), FRAGMENT("+"), FRAGMENT("       ") },
+	[OP_MUL] = { FRAGMENT("mul    "), FRAGMENT("*"), FRAGMENT("         ") },
+	[OP_MULH] = { FRAGMENT("mulh   "), FRAGMENT("*"), FRAGMENT("         ") },
+	[OP_MULHSU] = { FRAGMENT("mulhsu "), FRAGMENT("*"), FRAGMENT("         ") },
+	[OP_MULHU] = { FRAGMENT("mulhu  "), FRAGMENT("*"), FRAGMENT("         ") },
+	[OP_DIV] = { FRAGMENT("div    "), FRAGMENT("/"), FRAGMENT("         ") },
+	[OP_DIVU] = { FRAGMENT("divu    "), FRAGMENT("/"), FRAGMENT("         ") },
+	[OP_REM] = { FRAGMENT("rem    "), FRAGMENT("%"), FRAGMENT("         ") },
+	[OP_REMU] = { FRAGMENT("remu    "), FRAGMENT("%"), FRAGMENT("         ") },
+	[OP_SUB] = { FRAGMENT("sub    "), FRAGMENT("-"), FRAGMENT("       ") },
+	[OP_XOR] = { FRAGMENT("xor    "), FRAGMENT("^"), FRAGMENT("       ") },
+	[OP_OR] = { FRAGMENT("or    "), FRAGMENT("|"), FRAGMENT("       ") },
+	[OP_AND] = { FRAGMENT("and    "), FRAGMENT("&"), FRAGMENT("       ") },
+	[OP_SLL] = { FRAGMENT("sll    "), FRAGMENT("<<"), FRAGMENT("       ") },
+	[OP_SRL] = { FRAGMENT("srl    "), FRAGMENT(">>"), FRAGMENT("       ") },
+	[OP_SRA] = { FRAGMENT("sra    "), FRAGMENT(">>>"), FRAGMENT("       ") },
+	[OP_SLT] = { FRAGMENT("slt     "), FRAGMENT("<"), FRAGMENT("         ") },
+	[OP_SLTU] = { FRAGMENT("sltu     "), FRAGMENT("<"), FRAGMENT("         ") },
+	[OP_SW] = { FRAGMENT("sw     "), FRAGMENT(""), FRAGMENT("    ") },
+	[OP_SB] = { FRAGMENT("sb    "), FRAGMENT(""), FRAGMENT("    ") },
+	[OP_SH] = { FRAGMENT("sw     "), FRAGMENT(""), FRAGMENT("    ") },
+	[OP_BLT] = { FRAGMENT("blt    "), FRAGMENT("<"), FRAGMENT("   ") },
+	[OP_BNE] = { FRAGMENT("bne    "), FRAGMENT("!="), FRAGMENT("   ") },
+	[OP_BEQ] = { FRAGMENT("beq    "), FRAGMENT("=="), FRAGMENT("   ") },
+	[OP_BGE] = { FRAGMENT("bge    "), FRAGMENT(">="), FRAGMENT("   ") },
+	[OP_BLTU] = { FRAGMENT("bltu    "), FRAGMENT("<"), FRAGMENT("   ") },
+	[OP_BGEU] = { FRAGMENT("bgeu    "), FRAGMENT(">="), FRAGMENT("   ") },
+	[OP_JALR] = { FRAGMENT("jalr   "), FRAGMENT("+"), FRAGMENT("   ") },
+	[OP_LW] = { FRAGMENT("lw     "), FRAGMENT(""), FRAGMENT("       ") },
+	[OP_LB] = { FRAGMENT("lb     "), FRAGMENT(""), FRAGMENT("       ") },
+	[OP_LH] = { FRAGMENT("lh     "), FRAGMENT(""), FRAGMENT("       ") },
+	[OP_LBU] = { FRAGMENT("lbu     "), FRAGMENT(""), FRAGMENT("       ") },
+	[OP_LHU] = { FRAGMENT("lhu     "), FRAGMENT(""), FRAGMENT("       ") },
+	[OP_LR] = { FRAGMENT("lr.w   "), FRAGMENT(""), FRAGMENT("       ") },
+	[OP_SC] = { FRAGMENT("sc.w   "), FRAGMENT(""), FRAGMENT("   ") },
+	[OP_AMOSWAP] = { FRAGMENT("amoswap.w "), FRAGMENT("="), FRAGMENT("   ") },
+	[OP_AMOADD] = { FRAGMENT("amoadd.w "), FRAGMENT("+="), FRAGMENT("   ") },
+	[OP_AMOXOR] = { FRAGMENT("amoxor.w "), FRAGMENT("^="), FRAGMENT("   ") },
+	[OP_AMOAND] = { FRAGMENT("amoand.w "), FRAGMENT("&="), FRAGMENT("   ") },
+	[OP_AMOOR] = { FRAGMENT("amoor.w "), FRAGMENT("|="), FRAGMENT("   ") },
+	[OP_AMOMIN] = { FRAGMENT("amomin.w "), FRAGMENT("min="), FRAGMENT("   ") },
+	[OP_AMOMAX] = { FRAGMENT("amomax.w "), FRAGMENT("max="), FRAGMENT("   ") },
+	[OP_AMOMINU] = { FRAGMENT("amominu.w "), FRAGMENT("minu="), FRAGMENT("   ") },
+	[OP_AMOMAXU] = { FRAGMENT("amomaxu.w "), FRAGMENT("maxu="), FRAGMENT("   ") },
+	[OP_JAL] = { FRAGMENT("jal    "), FRAGMENT(""), FRAGMENT("    ") },
+	[OP_EBREAK] = { FRAGMENT("ebreak"), FRAGMENT(""), FRAGMENT("") },
+	[OP_MHARTID] = { FRAGMENT("csrrs  "), FRAGMENT(""), FRAGMENT("  ") },
+	[OP_CSRRW] = { FRAGMENT("csrrw  "), FRAGMENT("="), FRAGMENT("  ") },
+	[OP_CSRRS] = { FRAGMENT("csrrs  "), FRAGMENT("|="), FRAGMENT("  ") },
+	[OP_CSRRC] = { FRAGMENT("csrrc  "), FRAGMENT("&=~"), FRAGMENT("  ") },
+	[OP_CSRRWI] = { FRAGMENT("csrrwi "), FRAGMENT("="), FRAGMENT("  ") },
+	[OP_CSRRSI] = { FRAGMENT("csrrsi "), FRAGMENT("|="), FRAGMENT("  ") },
+	[OP_CSRRCI] = { FRAGMENT("csrrci "), FRAGMENT("&=~"), FRAGMENT("  ") },
+	[OP_ECALL] = { FRAGMENT("ecall"), FRAGMENT(""), FRAGMENT("") },
+	[OP_MRET] = { FRAGMENT("mret"), FRAGMENT(""), FRAGMENT("") },
+};
+
+// CSR names (trace output, others are shown by number)
+static const struct {
+	uint16_t number;
+	fragment_t name;
+} csr_name[] = {
+	{ 0x300, FRAGMENT("mstatus") }, { 0x301, FRAGMENT("misa") }, { 0x304, FRAGMENT("mie") }, { 0x305, FRAGMENT("mtvec") },
+	{ 0x340, FRAGMENT("mscratch") }, { 0x341, FRAGMENT("mepc") }, { 0x342, FRAGMENT("mcause") }, { 0x343, FRAGMENT("mtval") },
+	{ 0x344, FRAGMENT("mip") }, { 0xB00, FRAGMENT("mcycle") }, { 0xB02, FRAGMENT("minstret") }, { 0xB80, FRAGMENT("mcycleh") },
+	{ 0xB82, FRAGMENT("minstreth") }, { 0xC00, FRAGMENT("cycle") }, { 0xC01, FRAGMENT("time") }, { 0xC02, FRAGMENT("instret") },
+	{ 0xC80, FRAGMENT("cycleh") }, { 0xC81, FRAGMENT("timeh") }, { 0xC82, FRAGMENT("instreth") }, { 0xF11, FRAGMENT("mvendorid") },
+	{ 0xF12, FRAGMENT("marchid") }, { 0xF13, FRAGMENT("mimpid") }, { 0xF14, FRAGMENT("mhartid") }
+};
+
+// Longest trace line (bytes reserved in the trace buffer per line)
+#define TRACE_LINE_MAX 160
+
+// Appends a string literal
+#define PUT(p, literal) (memcpy((p), (literal), sizeof(literal) - 1), (p) + sizeof(literal) - 1)
+
+/**
+ * Appends a text fragment (copies 16 bytes, advances by its length)
+ * @param p		Write position
+ * @param f		Fragment
+ * @return		Returns the new write position
+ */
+static inline char* put_fragment(char* p, const fragment_t* f) {
+	memcpy(p, f, 16);
+	return p + f->n;
+}
+
+/**
+ * Appends a value as 8 hexadecimal digits (%08x)
+ * @param p		Write position
+ * @param value	Value
+ * @return		Returns the new write position
+ */
+static inline char* put_hex8(char* p, uint32_t value) {
+	memcpy(p + 0, &hex_pair[((value >> 24) & 0xFF) * 2], 2);
+	memcpy(p + 2, &hex_pair[((value >> 16) & 0xFF) * 2], 2);
+	memcpy(p + 4, &hex_pair[((value >> 8) & 0xFF) * 2], 2);
+	memcpy(p + 6, &hex_pair[(value & 0xFF) * 2], 2);
+	return p + 8;
+}
+
+/**
+ * Appends a value in hexadecimal with at least width digits (%0<width>x)
+ * @param p		Write position
+ * @param value	Value
+ * @param width	Minimum number of digits
+ * @return		Returns the new write position
+ */
+static inline char* put_hex(char* p, uint32_t value, int width) {
+	// Counting significant digits
+	int digits = (value == 0) ? 1 : (32 - __builtin_clz(value) + 3) / 4;
+	if(digits < width) digits = width;
+	// Writing digits from the least significant one
+	for(int i = digits - 1; i >= 0; i--) {
+		p[i] = hex_pair[(value & 0xF) * 2 + 1];
+		value >>= 4;
+	}
+	return p + digits;
+}
+
+/**
+ * Appends a value in signed decimal (%d)
+ * @param p		Write position
+ * @param value	Value
+ * @return		Returns the new write position
+ */
+static inline char* put_dec(char* p, int32_t value) {
+	uint32_t magnitude = (uint32_t)value;
+	if(value < 0) {
+		*p++ = '-';
+		magnitude = -magnitude;
+	}
+	// Writing digits backwards into a scratch buffer
+	char digits[10];
+	int n = 0;
+	do {
+		digits[n++] = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while(magnitude != 0);
+	while(n > 0) *p++ = digits[--n];
+	return p;
+}
+
+/**
+ * Appends a CSR name (0x<number> for unnamed ones)
+ * @param p			Write position
+ * @param number	CSR number
+ * @return			Returns the new write position
+ */
+static char* put_csr(char* p, uint32_t number) {
+	for(uint32_t i = 0; i < sizeof(csr_name) / sizeof(csr_name[0]); i++) {
+		if(csr_name[i].number == number) return put_fragment(p, &csr_name[i].name);
+	}
+	p = PUT(p, "0x");
+	return put_hex(p, number, 3);
+}
+
+/**
+ * Outputs the trace line of an executed instruction
+ * @param buffer	Trace buffer
+ * @param pc		Instruction address
+ * @param d			Decoded instruction
+ * @param v1		rs1 value before execution
+ * @param v2		rs2 value before execution
+ * @param vd		rd value after execution
+ */
+static void trace_text(trace_buffer_t* buffer, uint32_t pc, const decoded_t* d, uint32_t v1, uint32_t v2, uint32_t vd) {
+	const uint8_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+	const int32_t imm = d->imm;
+	const op_text_t* text = &op_text[d->op];
+	// Register values after execution (only rd may have changed)
+	const uint32_t post1 = (rs1 == rd) ? vd : v1;
+	const uint32_t post2 = (rs2 == rd) ? vd : v2;
+	// Operands and result shown after the '=' sign
+	uint32_t a = v1, b = v2, result = vd;
+	// Reserving space for the line
+	if(buffer->used + TRACE_LINE_MAX > TRACE_BUFFER_SIZE) trace_flush(buffer);
+	char* const start = buffer->data + buffer->used;
+	char* p = start;
+	// Unknown instructions (no "0x<pc>:" prefix)
+	if(d->op == OP_UNKNOWN) {
+		p = PUT(p, "error: unknown instruction opcode at pc = 0x");
+		p = put_hex8(p, pc);
+		*p++ = '\n';
+		buffer->used += p - start;
+		return;
+	}
+	// Reserved encodings output nothing
+	if(d->op == OP_NOP || d->op == OP_BRANCH_RESERVED) return;
+	// Writing "0x<pc>:<mnemonic>"
+	p = PUT(p, "0x");
+	p = put_hex8(p, pc);
+	*p++ = ':';
+	if(d->size == 2) p = PUT(p, "c.");
+	p = put_fragment(p, &text->mnemonic);
+	switch(d->op) {
+		// I type: rd,rs1,imm  rd=rs1<op>imm=result
+		case OP_SLLI:
+		case OP_SRLI:
+		case OP_SRAI:
+			p = put_fragment(p, &x_fragment[rd]);
+			*p++ = ',';
+			p = put_fragment(p, &x_fragment[rs1]);
+			*p++ = ',';
+			p = put_dec(p, imm);
+			p = put_fragment(p, &text->gap);
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, "=0x");
+			p = put_hex8(p, v1);
+			p = put_fragment(p, &text->operator);
+			p = put_dec(p, imm);
+			p = PUT(p, "=0x");
+			p = put_hex8(p, (d->op == OP_SLLI) ? v1 << imm : vd);
+			break;
+		case OP_ADDI:
+		case OP_XORI:
+		case OP_ORI:
+		case OP_ANDI:
+			if(d->op == OP_ADDI) result = v1 + imm;
+			if(d->op == OP_XORI) result = v1 ^ imm;
+			if(d->op == OP_ORI) result = (rs1 == 0) ? (uint32_t)imm : v1 | imm;
+			if(d->op == OP_ANDI) result = v1 & imm;
+			p = put_fragment(p, &x_fragment[rd]);
+			*p++ = ',';
+			p = put_fragment(p, &x_fragment[rs1]);
+			p = PUT(p, ",0x");
+			p = put_hex(p, imm & 0xFFF, 3);
+			p = put_fragment(p, &text->gap);
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, "=0x");
+			p = put_hex8(p, v1);
+			p = put_fragment(p, &text->operator);
+			p = PUT(p, "0x");
+			p = put_hex8(p, imm);
+			p = PUT(p, "=0x");
+			p = put_hex8(p, result);
+			break;
+		// I type comparisons: rd,rs1,imm  rd=(rs1<imm)=result
+		case OP_SLTIU:
+		case OP_SLTI:
+			p = put_fragment(p, &x_fragment[rd]);
+			*p++ = ',';
+			p = put_fragment(p, &x_fragment[rs1]);
+			p = PUT(p, ",0x");
+			p = put_hex(p, imm & 0xFFF, 3);
+			p = put_fragment(p, &text->gap);
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, "=(0x");
+			p = put_hex8(p, post1);
+			p = PUT(p, "<0x");
+			p = put_hex8(p, imm);
+			p = PUT(p, ")=");
+			p = put_dec(p, vd);
+			break;
+		// U type: rd,imm  rd=...
+		case OP_AUIPC:
+		case OP_LUI:
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, ",0x");
+			p = put_hex(p, (uint32_t)imm >> 12, 5);
+			p = put_fragment(p, &text->gap);
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, "=0x");
+			if(d->op == OP_AUIPC) {
+				p = put_hex8(p, pc);
+				p = PUT(p, "+0x");
+				p = put_hex8(p, imm);
+				p = PUT(p, "=0x");
+				p = put_hex8(p, pc + imm);
+			} else {
+				p = put_hex8(p, vd);
+			}
+			break;
+		// R type: rd,rs1,rs2  rd=rs1<op>rs2=result
+		case OP_ADD:
+		case OP_SUB:
+		case OP_XOR:
+		case OP_OR:
+		case OP_AND:
+		case OP_MUL:
+		case OP_MULH:
+		case OP_MULHSU:
+		case OP_MULHU:
+		case OP_DIV:
+		case OP_DIVU:
+		case OP_REM:
+		case OP_REMU:
+			if(d->op == OP_ADD) result = (rs2 == 0) ? v1 : v1 + v2;
+			if(d->op == OP_SUB) result = (rs2 == 0) ? v1 : v1 - v2;
+			if(d->op == OP_XOR) result = (rs2 == 0) ? v1 : v1 ^ v2;
+			if(d->op == OP_OR) result = (rs2 == 0) ? v1 : (rs1 == 0) ? v2 : v1 | v2;
+			if(d->op == OP_AND) result = (rs1 == 0 || rs2 == 0) ? 0 : v1 & v2;
+			if(d->op == OP_MUL) b = post2;
+			if(d->op == OP_MULH) a = post1, b = post2;
+			if((d->op == OP_DIV || d->op == OP_DIVU) && v2 == 0) result = 0xffffffff;
+			p = put_fragment(p, &x_fragment[rd]);
+			*p++ = ',';
+			p = put_fragment(p, &x_fragment[rs1]);
+			*p++ = ',';
+			p = put_fragment(p, &x_fragment[rs2]);
+			p = put_fragment(p, &text->gap);
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, "=0x");
+			p = put_hex8(p, a);
+			p = put_fragment(p, &text->operator);
+			p = PUT(p, "0x");
+			p = put_hex8(p, b);
+			p = PUT(p, "=0x");
+			p = put_hex8(p, result);
+			break;
+		// R type shifts: rd,rs1,rs2  rd=rs1<op>shamt=result
+		case OP_SLL:
+		case OP_SRL:
+		case OP_SRA:
+			p = put_fragment(p, &x_fragment[rd]);
+			*p++ = ',';
+			p = put_fragment(p, &x_fragment[rs1]);
+			*p++ = ',';
+			p = put_fragment(p, &x_fragment[rs2]);
+			p = put_fragment(p, &text->gap);
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, "=0x");
+			p = put_hex8(p, post1);
+			p = put_fragment(p, &text->operator);
+			p = put_dec(p, v2 & 0x1F);
+			p = PUT(p, "=0x");
+			p = put_hex8(p, vd);
+			break;
+		// R type comparisons: rd,rs1,rs2  rd=(rs1<rs2)=result
+		case OP_SLT:
+		case OP_SLTU:
+			a = (rs1 == 0) ? 0 : v1;
+			result = (d->op == OP_SLT) ? ((int32_t)a < (int32_t)b) : (a < b);
+			p = put_fragment(p, &x_fragment[rd]);
+			*p++ = ',';
+			p = put_fragment(p, &x_fragment[rs1]);
+			*p++ = ',';
+			p = put_fragment(p, &x_fragment[rs2]);
+			p = put_fragment(p, &text->gap);
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, "=(0x");
+			p = put_hex8(p, a);
+			p = PUT(p, "<0x");
+			p = put_hex8(p, b);
+			p = PUT(p, ")=");
+			p = put_dec(p, result);
+			break;
+		// S type: rs2,imm(rs1)    mem[address]=value
+		case OP_SW:
+		case OP_SB:
+		case OP_SH:
+			p = put_fragment(p, &x_fragment[rs2]);
+			p = PUT(p, ",0x");
+			p = put_hex(p, imm, 3);
+			*p++ = '(';
+			p = put_fragment(p, &x_fragment[rs1]);
+			*p++ = ')';
+			p = put_fragment(p, &text->gap);
+			p = PUT(p, "mem[0x");
+			p = put_hex8(p, v1 + imm);
+			p = PUT(p, "]=0x");
+			if(d->op == OP_SW) p = put_hex8(p, v2);
+			if(d->op == OP_SB) p = put_hex(p, (uint8_t)v2, 2);
+			if(d->op == OP_SH) p = put_hex8(p, (uint16_t)v2);
+			break;
+		// lr.w: rd,(rs1)       rd=mem[address]=value
+		case OP_LR:
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, ",(");
+			p = put_fragment(p, &x_fragment[rs1]);
+			*p++ = ')';
+			p = put_fragment(p, &text->gap);
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, "=mem[0x");
+			p = put_hex8(p, v1);
+			p = PUT(p, "]=0x");
+			p = put_hex8(p, vd);
+			break;
+		// sc.w: rd,rs2,(rs1)   mem[address]=value,rd=0 (stored) or rd=1 (failed)
+		case OP_SC:
+			p = put_fragment(p, &x_fragment[rd]);
+			*p++ = ',';
+			p = put_fragment(p, &x_fragment[rs2]);
+			p = PUT(p, ",(");
+			p = put_fragment(p, &x_fragment[rs1]);
+			*p++ = ')';
+			p = put_fragment(p, &text->gap);
+			if(vd == 0) {
+				p = PUT(p, "mem[0x");
+				p = put_hex8(p, v1);
+				p = PUT(p, "]=0x");
+				p = put_hex8(p, v2);
+				*p++ = ',';
+			}
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, "=0x");
+			p = put_hex8(p, vd);
+			break;
+		// AMOs: rd,rs2,(rs1)   rd=mem[address]=old,mem[address]<op>value
+		case OP_AMOSWAP:
+		case OP_AMOADD:
+		case OP_AMOXOR:
+		case OP_AMOAND:
+		case OP_AMOOR:
+		case OP_AMOMIN:
+		case OP_AMOMAX:
+		case OP_AMOMINU:
+		case OP_AMOMAXU:
+			p = put_fragment(p, &x_fragment[rd]);
+			*p++ = ',';
+			p = put_fragment(p, &x_fragment[rs2]);
+			p = PUT(p, ",(");
+			p = put_fragment(p, &x_fragment[rs1]);
+			*p++ = ')';
+			p = put_fragment(p, &text->gap);
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, "=mem[0x");
+			p = put_hex8(p, v1);
+			p = PUT(p, "]=0x");
+			p = put_hex8(p, vd);
+			p = PUT(p, ",mem[0x");
+			p = put_hex8(p, v1);
+			*p++ = ']';
+			p = put_fragment(p, &text->operator);
+			p = PUT(p, "0x");
+			p = put_hex8(p, v2);
+			break;
+		// B type: rs1,rs2,imm   (rs1<op>rs2)=condition->pc=next
+		case OP_BLT:
+		case OP_BNE:
+		case OP_BEQ:
+		case OP_BGE:
+		case OP_BLTU:
+		case OP_BGEU:
+			{
+				int condition = 0;
+				if(d->op == OP_BLT) condition = (int32_t)v1 < (int32_t)v2;
+				if(d->op == OP_BNE) condition = v1 != v2;
+				if(d->op == OP_BEQ) condition = v1 == v2;
+				if(d->op == OP_BGE) condition = (int32_t)v1 >= (int32_t)v2;
+				if(d->op == OP_BLTU) condition = v1 < v2;
+				if(d->op == OP_BGEU) condition = v1 >= v2;
+				p = put_fragment(p, &x_fragment[rs1]);
+				*p++ = ',';
+				p = put_fragment(p, &x_fragment[rs2]);
+				p = PUT(p, ",0x");
+				// beq shows the byte offset, the others show it halved
+				p = put_hex(p, (d->op == OP_BEQ) ? imm & 0xFFF : (imm >> 1) & 0xFFF, 3);
+				p = put_fragment(p, &text->gap);
+				p = PUT(p, "(0x");
+				p = put_hex8(p, v1);
+				p = put_fragment(p, &text->operator);
+				p = PUT(p, "0x");
+				p = put_hex8(p, v2);
+				p = PUT(p, ")=");
+				*p++ = '0' + condition;
+				p = PUT(p, "->pc=0x");
+				p = put_hex8(p, condition ? pc + imm : pc + d->size);
+			}
+			break;
+		// jalr: rd,rs1,imm   pc=target+imm,rd=return
+		case OP_JALR:
+			p = put_fragment(p, &x_fragment[rd]);
+			*p++ = ',';
+			p = put_fragment(p, &x_fragment[rs1]);
+			p = PUT(p, ",0x");
+			p = put_hex(p, imm, 3);
+			p = put_fragment(p, &text->gap);
+			p = PUT(p, "pc=0x");
+			p = put_hex8(p, (v1 + imm) & ~1);
+			p = PUT(p, "+0x");
+			p = put_hex8(p, imm);
+			*p++ = ',';
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, "=0x");
+			p = put_hex8(p, pc + d->size);
+			break;
+		// I type loads: rd,imm(rs1)       rd=mem[address]=value
+		case OP_LW:
+		case OP_LB:
+		case OP_LH:
+		case OP_LBU:
+		case OP_LHU:
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, ",0x");
+			p = put_hex(p, imm, 3);
+			*p++ = '(';
+			p = put_fragment(p, &x_fragment[rs1]);
+			*p++ = ')';
+			p = put_fragment(p, &text->gap);
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, "=mem[0x");
+			p = put_hex8(p, v1 + imm);
+			p = PUT(p, "]=0x");
+			p = put_hex8(p, vd);
+			break;
+		// jal: rd,imm20    pc=target,rd=return
+		case OP_JAL:
+			{
+				// Retrieving raw 20-bit offset (printed unscaled, from the expansion of c.jal and c.j)
+				const uint32_t instruction = (d->size == 2) ? compressed_expand(d->instruction) : d->instruction;
+				const uint32_t imm20 = ((instruction >> 31) << 19) | (((instruction & (0b11111111 << 12)) >> 12) << 11) | (((instruction & (0b1 << 20)) >> 20) << 10) | ((instruction & (0b1111111111 << 21)) >> 21);
+				p = put_fragment(p, &x_fragment[rd]);
+				p = PUT(p, ",0x");
+				p = put_hex(p, imm20, 5);
+				p = put_fragment(p, &text->gap);
+				p = PUT(p, "pc=0x");
+				p = put_hex8(p, pc + imm);
+				*p++ = ',';
+				p = put_fragment(p, &x_fragment[rd]);
+				p = PUT(p, "=0x");
+				p = put_hex8(p, pc + d->size);
+			}
+			break;
+		// mhartid read: rd,mhartid,zero  rd=mhartid=value
+		case OP_MHARTID:
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, ",mhartid,zero");
+			p = put_fragment(p, &text->gap);
+			p = put_fragment(p, &x_fragment[rd]);
+			p = PUT(p, "=mhartid=0x");
+			p = put_hex8(p, vd);
+			break;
+		// CSR instructions: rd,csr,rs1  rd=csr=old,csr<op>rs1=source (the
+		// immediate forms show the source as a constant, writes to zero only
+		// the write and reads only the read)
+		case OP_CSRRW:
+		case OP_CSRRS:
+		case OP_CSRRC:
+		case OP_CSRRWI:
+		case OP_CSRRSI:
+		case OP_CSRRCI:
+			{
+				const int immediate = d->op >= OP_CSRRWI;
+				const int write = rs1 != 0 || d->op == OP_CSRRW || d->op == OP_CSRRWI;
+				p = put_fragment(p, &x_fragment[rd]);
+				*p++ = ',';
+				p = put_csr(p, imm & 0xFFF);
+				*p++ = ',';
+				if(immediate) {
+					p = PUT(p, "0x");
+					p = put_hex(p, rs1, 2);
+				} else {
+					p = put_fragment(p, &x_fragment[rs1]);
+				}
+				p = put_fragment(p, &text->gap);
+				if(rd != 0 || !write) {
+					p = put_fragment(p, &x_fragment[rd]);
+					*p++ = '=';
+					p = put_csr(p, imm & 0xFFF);
+					p = PUT(p, "=0x");
+					p = put_hex8(p, vd);
+					if(write) *p++ = ',';
+				}
+				if(write) {
+					p = put_csr(p, imm & 0xFFF);
+					p = put_fragment(p, &text->operator);
+					if(!immediate) {
+						p = put_fragment(p, &x_fragment[rs1]);
+						*p++ = '=';
+					}
+					p = PUT(p, "0x");
+					p = put_hex8(p, immediate ? rs1 : v1);
+				}
+			}
+			break;
+		// ebreak, ecall and mret have no operands
+		default:
+			break;
+	}
+	*p++ = '\n';
+	buffer->used += p - start;
+}
+
+/**
+ * Outputs the "[hart] " prefix of a merged trace line
+ * @param buffer	Trace buffer
+ * @param hartid	Hart index
+ */
+static void trace_prefix(trace_buffer_t* buffer, uint32_t hartid) {
+	if(buffer->used + TRACE_LINE_MAX > TRACE_BUFFER_SIZE) trace_flush(buffer);
+	char* const start = buffer->data + buffer->used;
+	char* p = start;
+	*p++ = '[';
+	p = put_dec(p, hartid);
+	p = PUT(p, "] ");
+	buffer->used += p - start;
+}
+
+/**
+ * Outputs the trace line of a memory fault
+ * @param buffer	Trace buffer
+ * @param pc		Faulting instruction address
+ * @param address	Faulting address
+ */
+static void trace_fault_text(trace_buffer_t* buffer, uint32_t pc, uint32_t address) {
+	if(buffer->used + TRACE_LINE_MAX > TRACE_BUFFER_SIZE) trace_flush(buffer);
+	char* const start = buffer->data + buffer->used;
+	char* p = start;
+	p = PUT(p, "error: memory fault at pc = 0x");
+	p = put_hex8(p, pc);
+	p = PUT(p, ", address = 0x");
+	p = put_hex8(p, address);
+	*p++ = '\n';
+	buffer->used += p - start;
+}
+
+/**
+ * Outputs the trace line of a trap (exception or interrupt)
+ * @param buffer	Trace buffer
+ * @param epc		Trapping instruction, or the interrupted one
+ * @param cause		mcause
+ * @param handler	Handler address
+ */
+static void trace_trap_text(trace_buffer_t* buffer, uint32_t epc, uint32_t cause, uint32_t handler) {
+	if(buffer->used + TRACE_LINE_MAX > TRACE_BUFFER_SIZE) trace_flush(buffer);
+	char* const start = buffer->data + buffer->used;
+	char* p = start;
+	p = PUT(p, "trap: mcause = 0x");
+	p = put_hex8(p, cause);
+	p = PUT(p, " at pc = 0x");
+	p = put_hex8(p, epc);
+	p = PUT(p, ", handler = 0x");
+	p = put_hex8(p, handler);
+	*p++ = '\n';
+	buffer->used += p - start;
+}
+
+/**
+ * Finds the symbol holding an instruction address
+ * @param symbols	Program symbols
+ * @param pc		Instruction address
+ * @return			Returns the closest symbol at or below pc (pc within its
+ * 					size when known), or NULL
+ */
+static const symbol_t* symbol_find(const symbols_t* symbols, uint32_t pc) {
+	uint32_t low = 0, high = symbols->count;
+	while(low < high) {
+		const uint32_t middle = (low + high) / 2;
+		if(symbols->entries[middle].address <= pc) low = middle + 1;
+		else high = middle;
+	}
+	if(low == 0) return NULL;
+	const symbol_t* symbol = &symbols->entries[low - 1];
+	if(symbol->size != 0 && pc - symbol->address >= symbol->size) return NULL;
+	return symbol;
+}
+
+/**
+ * Outputs a "<name>:" trace line before the first instruction of a symbol
+ * @param cpu	Simulator state (with program symbols)
+ * @param pc	Instruction address
+ */
+static NOINLINE void trace_label(cpu_t* cpu, uint32_t pc) {
+	const symbol_t* symbol = symbol_find(cpu->symbols, pc);
+	if(symbol == NULL || symbol->address != pc) return;
+	if(cpu->trace_merged) trace_prefix(cpu->trace, cpu->hartid);
+	trace_buffer_t* buffer = cpu->trace;
+	if(buffer->used + TRACE_LINE_MAX > TRACE_BUFFER_SIZE) trace_flush(buffer);
+	// Truncating long (C++) names to the line reserve
+	const char* name = cpu->symbols->names + symbol->name;
+	const size_t length = strnlen(name, TRACE_LINE_MAX - 4);
+	char* p = buffer->data + buffer->used;
+	*p++ = '<';
+	memcpy(p, name, length);
+	p = PUT(p + length, ">:\n");
+	buffer->used = p - buffer->data;
+}
+
+/**
+ * Checks whether the instruction at pc is inside the traced PC range and
+ * instruction window
+ * @param cpu	Simulator state
+ * @return		Returns 1 if the instruction must be traced
+ */
+static inline int trace_selected(const cpu_t* cpu) {
+	if(cpu->trace_mode == TRACE_ALL) return 1;
+	return cpu->pc - cpu->trace_pc_first <= cpu->trace_pc_span && cpu->instret - cpu->trace_first < cpu->trace_count;
+}
+
+/**
+ * Outputs a trap as a text line or binary record
+ * @param cpu		Simulator state (after entering the handler)
+ * @param epc		Trapping instruction, or the interrupted one
+ * @param handler	Handler address
+ */
+static void trace_trap(cpu_t* cpu, uint32_t epc, uint32_t handler) {
+	if(cpu->trace_binary) trace_record(cpu->trace, epc, TRACE_TRAP, cpu->csr.mcause, handler, 0);
+	else trace_trap_text(cpu->trace, epc, cpu->csr.mcause, handler);
+}
+
+/**
+ * Executes an instruction and outputs its trace line (if selected)
+ * @param cpu	Simulator state
+ * @param d		Decoded instruction
+ */
+static void trace_step(cpu_t* cpu, const decoded_t* d) {
+	// Executing untraced instructions directly
+	if(!trace_selected(cpu)) {
+		d->handler(cpu, d);
+		return;
+	}
+	// Saving pc and source values before execution
+	const uint32_t pc = cpu->pc;
+	const uint32_t v1 = cpu->x[d->rs1];
+	const uint32_t v2 = cpu->x[d->rs2];
+	// Executing instruction
+	cpu->trapped = 0;
+	d->handler(cpu, d);
+	// Labeling symbol entries (ELF input, text trace)
+	if(cpu->symbols != NULL && !cpu->trace_binary) trace_label(cpu, pc);
+	// Prefixing merged trace lines with the hart index (reserved encodings output nothing)
+	if(cpu->trace_merged && d->op != OP_NOP && d->op != OP_BRANCH_RESERVED) trace_prefix(cpu->trace, cpu->hartid);
+	// Outputting fault instead of the faulting instruction
+	if(cpu->fault) {
+		if(cpu->trace_binary) trace_record(cpu->trace, pc, TRACE_FAULT, cpu->fault_address, 0, 0);
+		else trace_fault_text(cpu->trace, pc, cpu->fault_address);
+		return;
+	}
+	// Outputting the trap instead of the trapping instruction (ecall outputs both)
+	if(cpu->trapped && d->op != OP_ECALL) {
+		trace_trap(cpu, pc, cpu->pc + 4);
+		return;
+	}
+	// Outputting instruction as text or binary record
+	if(cpu->trace_binary) trace_record(cpu->trace, pc, d->instruction, v1, v2, cpu->x[d->rd]);
+	else trace_text(cpu->trace, pc, d, v1, v2, cpu->x[d->rd]);
+	if(cpu->trapped) {
+		if(cpu->trace_merged) trace_prefix(cpu->trace, cpu->hartid);
+		trace_trap(cpu, pc, cpu->pc + 4);
+	}
+}
+
+/**
+ * Renders a binary trace as the text trace of the run that produced it
+ * @param input		Binary trace file
+ * @param output	Text trace file
+ * @return			Returns 0 on success
+ */
+static int trace_render(FILE* input, FILE* output) {
+	// Checking file header
+	uint32_t header[2];
+	if(fread(header, sizeof(header), 1, input) != 1 || header[0] != TRACE_MAGIC || header[1] != sizeof(trace_record_t)) {
+		fprintf(stderr, "Erro: arquivo de trace binario invalido\n");
+		return 1;
+	}
+	// Rendering records in chunks
+	static trace_record_t records[4096];
+	trace_buffer_t buffer = { (char*)(malloc(TRACE_BUFFER_SIZE)), 0, output };
+	size_t count;
+	while((count = fread(records, sizeof(trace_record_t), 4096, input)) > 0) {
+		for(size_t i = 0; i < count; i++) {
+			if(records[i].instruction == TRACE_FAULT) {
+				trace_fault_text(&buffer, records[i].pc, records[i].rs1_value);
+				continue;
+			}
+			if(records[i].instruction == TRACE_TRAP) {
+				trace_trap_text(&buffer, records[i].pc, records[i].rs1_value, records[i].rs2_value);
+				continue;
+			}
+			decoded_t d;
+			decode(&d, records[i].instruction);
+			trace_text(&buffer, records[i].pc, &d, records[i].rs1_value, records[i].rs2_value, records[i].rd_value);
+		}
+	}
+	trace_flush(&buffer);
+	free(buffer.data);
+	return 0;
+}
+
+// Set-associative cache (tags only, LRU replacement by last use stamp)
+typedef struct {
+	// Geometry (powers of two)
+	uint32_t sets;
+	uint32_t ways;
+	uint32_t line_bits;
+	// Line tags (TLB_INVALID when empty) and last use stamps, per set and way
+	uint32_t* tags;
+	uint64_t* stamps;
+	uint64_t clock;
+	// Last line hit (sequential fetches skip the lookup)
+	uint32_t last;
+	// Statistics
+	uint64_t accesses;
+	uint64_t misses;
+} cache_t;
+
+// Static costs of a straight-line run of instructions (known at translation)
+typedef struct {
+	// Stall cycles of divisions and of loads feeding the next instruction
+	uint32_t div;
+	uint32_t load_use;
+	// Destination of the last instruction when it is a load (0 for none)
+	uint8_t load_rd;
+} timing_static_t;
+
+// Timing model settings (cycles, cache geometry in bytes)
+typedef struct {
+	uint32_t fetch;
+	uint32_t decode;
+	uint32_t execute;
+	uint32_t div;
+	uint32_t branch;
+	uint32_t miss;
+	uint32_t icache[3];
+	uint32_t dcache[3];
+} timing_config_t;
+
+// Timing model of a hart: in-order pipeline with instruction and data caches
+struct timing {
+	timing_config_t config;
+	cache_t icache;
+	cache_t dcache;
+	// Issue cycles per instruction (slowest stage)
+	uint32_t issue;
+	// Destination of the previous instruction when it was a load (0 for none)
+	uint8_t load_rd;
+	// Cycles and stall cycles by cause
+	uint64_t cycles;
+	uint64_t stall_icache;
+	uint64_t stall_dcache;
+	uint64_t stall_div;
+	uint64_t stall_branch;
+	uint64_t stall_load_use;
+};
+
+// Default timing model (5-stage-like in-order core with 16 KiB 4-way caches)
+static const timing_config_t timing_default = {
+	.fetch = 1, .decode = 1, .execute = 1, .div = 34, .branch = 2, .miss = 20,
+	.icache = { 16 * 1024, 4, 64 }, .dcache = { 16 * 1024, 4, 64 }
+};
+
+/**
+ * Parses "key=value,..." timing settings over the defaults (keys fetch,
+ * decode, execute, div, branch and miss in cycles; icache and dcache as
+ * SIZE:WAYS:LINE in bytes, with optional K suffix on SIZE)
+ * @param config	Settings (defaults on entry)
+ * @param text		Settings text
+ * @return			Returns 0 on success
+ */
+static int timing_parse(timing_config_t* config, const char* text) {
+	char copy[256];
+	snprintf(copy, sizeof(copy), "%s", text);
+	char* save;
+	for(char* item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+		char key[16];
+		char value[64];
+		if(sscanf(item, "%15[^=]=%63s", key, value) != 2) return 1;
+		uint32_t* field = NULL;
+		if(strcmp(key, "fetch") == 0) field = &config->fetch;
+		if(strcmp(key, "decode") == 0) field = &config->decode;
+		if(strcmp(key, "execute") == 0) field = &config->execute;
+		if(strcmp(key, "div") == 0) field = &config->div;
+		if(strcmp(key, "branch") == 0) field = &config->branch;
+		if(strcmp(key, "miss") == 0) field = &config->miss;
+		if(field != NULL) {
+			char* end;
+			const unsigned long cycles = strtoul(value, &end, 10);
+			if(*end != '\0' || cycles > 1000000) return 1;
+			*field = (uint32_t)cycles;
+			continue;
+		}
+		uint32_t* geometry = (strcmp(key, "icache") == 0) ? config->icache : (strcmp(key, "dcache") == 0) ? config->dcache : NULL;
+		if(geometry == NULL) return 1;
+		unsigned int size, ways, line;
+		char unit = 0;
+		if(sscanf(value, "%u%c:%u:%u", &size, &unit, &ways, &line) == 4 && (unit == 'K' || unit == 'k')) size <<= 10;
+		else if(sscanf(value, "%u:%u:%u", &size, &ways, &line) != 3) return 1;
+		// Powers of two, at least one set
+		if(size == 0 || ways == 0 || line < 4 || (size & (size - 1)) || (ways & (ways - 1)) || (line & (line - 1)) || size < ways * line) return 1;
+		geometry[0] = size;
+		geometry[1] = ways;
+		geometry[2] = line;
+	}
+	// Stages take at least one cycle
+	return config->fetch == 0 || config->decode == 0 || config->execute == 0;
+}
+
+/**
+ * Creates an empty cache
+ * @param cache		Cache
+ * @param geometry	Size, ways and line size in bytes
+ */
+static void cache_create(cache_t* cache, const uint32_t geometry[3]) {
+	cache->ways = geometry[1];
+	cache->sets = geometry[0] / geometry[1] / geometry[2];
+	cache->line_bits = __builtin_ctz(geometry[2]);
+	cache->tags = (uint32_t*)(malloc(cache->sets * cache->ways * sizeof(uint32_t)));
+	cache->stamps = (uint64_t*)(calloc(cache->sets * cache->ways, sizeof(uint64_t)));
+	for(uint32_t i = 0; i < cache->sets * cache->ways; i++) cache->tags[i] = TLB_INVALID;
+	cache->last = TLB_INVALID;
+}
+
+/**
+ * Looks a line up, filling it (over the least recently used way) on a miss
+ * @param cache		Cache
+ * @param address	Guest address
+ * @return			Returns 1 on a miss
+ */
+static NOINLINE int cache_lookup(cache_t* cache, uint32_t address) {
+	const uint32_t line = address >> cache->line_bits;
+	uint32_t* tags = &cache->tags[(line & (cache->sets - 1)) * cache->ways];
+	uint64_t* stamps = &cache->stamps[(line & (cache->sets - 1)) * cache->ways];
+	cache->last = line;
+	uint32_t victim = 0;
+	for(uint32_t way = 0; way < cache->ways; way++) {
+		if(tags[way] == line) {
+			stamps[way] = ++cache->clock;
+			return 0;
+		}
+		if(stamps[way] < stamps[victim]) victim = way;
+	}
+	tags[victim] = line;
+	stamps[victim] = ++cache->clock;
+	cache->misses++;
+	return 1;
+}
+
+/**
+ * Creates the timing model of a hart
+ * @param config	Settings
+ * @return			Returns the model (pipeline filled on the first instruction)
+ */
+static timing_t* timing_create(const timing_config_t* config) {
+	timing_t* timing = (timing_t*)(calloc(1, sizeof(timing_t)));
+	timing->config = *config;
+	cache_create(&timing->icache, config->icache);
+	cache_create(&timing->dcache, config->dcache);
+	timing->issue = config->fetch;
+	if(config->decode > timing->issue) timing->issue = config->decode;
+	if(config->execute > timing->issue) timing->issue = config->execute;
+	timing->cycles = config->fetch + config->decode + config->execute - timing->issue;
+	return timing;
+}
+
+/**
+ * Releases the timing model of a hart
+ * @param timing	Timing model
+ */
+static void timing_destroy(timing_t* timing) {
+	free(timing->icache.tags);
+	free(timing->icache.stamps);
+	free(timing->dcache.tags);
+	free(timing->dcache.stamps);
+	free(timing);
+}
+
+// Operations accessing the data cache (loads, stores and atomics)
+#define TIMING_DATA(op) (((op) >= OP_SW && (op) <= OP_AMOMAXU) || ((op) >= OP_LW && (op) <= OP_LR))
+
+/**
+ * Checks whether an instruction reads a register (R, S, B and A types also read rs2)
+ * @param d		Decoded instruction
+ * @param r		Register (not zero)
+ * @return		Returns 1 if r is a source
+ */
+static inline int timing_reads(const decoded_t* d, uint8_t r) {
+	const uint8_t opcode = ((d->size == 2) ? compressed_expand(d->instruction) : d->instruction) & 0b1111111;
+	return d->rs1 == r || (d->rs2 == r && (opcode == 0b0110011 || opcode == 0b0100011 || opcode == 0b1100011 || opcode == 0b0101111));
+}
+
+/**
+ * Computes the costs of a straight-line run that do not depend on execution
+ * (division and internal load-use stalls, last load destination)
+ * @param timing	Timing model
+ * @param insn		Decoded instructions
+ * @param count		Number of instructions (at least one)
+ * @param costs		Static costs
+ */
+static inline void timing_static(const timing_t* timing, const decoded_t* insn, uint32_t count, timing_static_t* costs) {
+	const uint32_t div = (timing->config.div > timing->issue) ? timing->config.div - timing->issue : 0;
+	costs->div = 0;
+	costs->load_use = 0;
+	costs->load_rd = 0;
+	for(uint32_t i = 0; i < count; i++) {
+		const uint8_t op = insn[i].op;
+		if(costs->load_rd != 0 && timing_reads(&insn[i], costs->load_rd)) costs->load_use++;
+		costs->load_rd = ((op >= OP_LW && op <= OP_LR) || (op >= OP_SC && op <= OP_AMOMAXU)) ? insn[i].rd : 0;
+		if(op >= OP_DIV && op <= OP_REMU) costs->div += div;
+	}
+}
+
+/**
+ * Accounts a data access (after the instruction, faulting ones are not accounted)
+ * @param timing	Timing model
+ * @param address	Data address
+ */
+static inline void timing_data(timing_t* timing, uint32_t address) {
+	cache_t* dcache = &timing->dcache;
+	dcache->accesses++;
+	if(address >> dcache->line_bits != dcache->last && cache_lookup(dcache, address)) {
+		timing->cycles += timing->config.miss;
+		timing->stall_dcache += timing->config.miss;
+	}
+}
+
+/**
+ * Accounts the cycles of an executed straight-line run (data accesses apart)
+ * @param timing	Timing model
+ * @param insn		Decoded instructions
+ * @param pc		First instruction address
+ * @param count		Number of instructions (at least one)
+ * @param costs		Static costs of the run
+ * @param redirect	Control flow left the sequential path after the run
+ */
+static inline void timing_run(timing_t* timing, const decoded_t* insn, uint32_t pc, uint32_t count, const timing_static_t* costs, int redirect) {
+	const timing_config_t* config = &timing->config;
+	cache_t* icache = &timing->icache;
+	uint64_t cycles = (uint64_t)count * timing->issue + costs->div + costs->load_use;
+	// Fetching through the instruction cache (each line of the run once)
+	icache->accesses += count;
+	const uint32_t last = (pc + 4 * (count - 1)) >> icache->line_bits;
+	for(uint32_t line = pc >> icache->line_bits; line <= last; line++) {
+		if(line != icache->last && cache_lookup(icache, line << icache->line_bits)) {
+			cycles += config->miss;
+			timing->stall_icache += config->miss;
+		}
+	}
+	// Waiting for a load before the run
+	if(timing->load_rd != 0 && timing_reads(&insn[0], timing->load_rd)) {
+		cycles++;
+		timing->stall_load_use++;
+	}
+	timing->load_rd = costs->load_rd;
+	timing->stall_div += costs->div;
+	timing->stall_load_use += costs->load_use;
+	// Flushing the fetched path on taken branches and jumps
+	if(redirect) {
+		cycles += config->branch;
+		timing->stall_branch += config->branch;
+	}
+	timing->cycles += cycles;
+}
+
+/**
+ * Accounts the cycles of an executed instruction
+ * @param timing	Timing model
+ * @param d			Decoded instruction
+ * @param pc		Instruction address
+ * @param address	Data address (loads, stores and atomics)
+ * @param redirect	Control flow left the sequential path
+ */
+static void timing_account(timing_t* timing, const decoded_t* d, uint32_t pc, uint32_t address, int redirect) {
+	timing_static_t costs;
+	timing_static(timing, d, 1, &costs);
+	if(TIMING_DATA(d->op)) timing_data(timing, address);
+	timing_run(timing, d, pc, 1, &costs, redirect);
+}
+
+/**
+ * Outputs the timing model results to the console
+ * @param timing	Timing model
+ * @param instret	Executed instructions
+ */
+static void timing_report(const timing_t* timing, uint64_t instret) {
+	const cache_t* icache = &timing->icache;
+	const cache_t* dcache = &timing->dcache;
+	printf("cycles=%llu cpi=%.3f\n", (unsigned long long)timing->cycles, instret ? (double)timing->cycles / instret : 0.0);
+	printf("icache=%llu/%llu hit=%.2f%% dcache=%llu/%llu hit=%.2f%%\n",
+		(unsigned long long)(icache->accesses - icache->misses), (unsigned long long)icache->accesses, icache->accesses ? 100.0 * (icache->accesses - icache->misses) / icache->accesses : 0.0,
+		(unsigned long long)(dcache->accesses - dcache->misses), (unsigned long long)dcache->accesses, dcache->accesses ? 100.0 * (dcache->accesses - dcache->misses) / dcache->accesses : 0.0);
+	printf("stalls icache=%llu dcache=%llu div=%llu branch=%llu load-use=%llu\n",
+		(unsigned long long)timing->stall_icache, (unsigned long long)timing->stall_dcache, (unsigned long long)timing->stall_div,
+		(unsigned long long)timing->stall_branch, (unsigned long long)timing->stall_load_use);
+}
+
+// Most predictors simulated at once
+#define PREDICTORS_MAX 8
+
+// Branch predictor model: creates its state for 2^bits entries (per table),
+// predicts a conditional branch and learns its outcome (always right after
+// predicting it)
+typedef struct {
+	const char* name;
+	uint32_t bits;
+	void* (*create)(uint32_t bits);
+	int (*predict)(void* state, uint32_t pc, uint32_t target);
+	void (*update)(void* state, uint32_t pc, uint32_t target, int taken);
+} predictor_kind_t;
+
+/**
+ * Saturates a 2-bit counter toward the outcome
+ * @param counter	Counter (0 and 1 predict not taken, 2 and 3 taken)
+ * @param taken		Branch outcome
+ */
+static inline void counter_update(uint8_t* counter, int taken) {
+	if(taken && *counter < 3) (*counter)++;
+	if(!taken && *counter > 0) (*counter)--;
+}
+
+// Static predictor: backward branches (loops) taken, forward ones not taken
+
+/**
+ * Creates the static predictor state (no state, a placeholder allocation)
+ * @param bits	Unused
+ * @return		Returns the state (released with free)
+ */
+static void* static_create(uint32_t bits) {
+	return calloc(1, 1);
+}
+
+/**
+ * Predicts a conditional branch from its direction
+ * @param state		Predictor state
+ * @param pc		Branch address
+ * @param target	Branch target
+ * @return			Returns 1 when predicted taken
+ */
+static int static_predict(void* state, uint32_t pc, uint32_t target) {
+	return target < pc;
+}
+
+/**
+ * Learns a branch outcome (nothing to learn)
+ * @param state		Predictor state
+ * @param pc		Branch address
+ * @param target	Branch target
+ * @param taken		Branch outcome
+ */
+static void static_update(void* state, uint32_t pc, uint32_t target, int taken) {
+}
+
+// Bimodal predictor: 2-bit counters indexed by pc
+typedef struct {
+	uint32_t mask;
+	uint8_t counters[];
+} bimodal_t;
+
+/**
+ * Creates the bimodal predictor, counters starting weakly taken
+ * @param bits	Index bits
+ * @return		Returns the state (released with free)
+ */
+static void* bimodal_create(uint32_t bits) {
+	bimodal_t* bimodal = (bimodal_t*)(calloc(1, sizeof(bimodal_t) + (1u << bits)));
+	bimodal->mask = (1u << bits) - 1;
+	// Starting weakly taken
+	memset(bimodal->counters, 2, 1u << bits);
+	return bimodal;
+}
+
+/**
+ * Predicts a conditional branch from the counter of its pc
+ * @param state		Predictor state
+ * @param pc		Branch address
+ * @param target	Branch target
+ * @return			Returns 1 when predicted taken
+ */
+static int bimodal_predict(void* state, uint32_t pc, uint32_t target) {
+	const bimodal_t* bimodal = (const bimodal_t*)(state);
+	return bimodal->counters[(pc >> 2) & bimodal->mask] >= 2;
+}
+
+/**
+ * Trains the counter of the branch pc toward its outcome
+ * @param state		Predictor state
+ * @param pc		Branch address
+ * @param target	Branch target
+ * @param taken		Branch outcome
+ */
+static void bimodal_update(void* state, uint32_t pc, uint32_t target, int taken) {
+	bimodal_t* bimodal = (bimodal_t*)(state);
+	counter_update(&bimodal->counters[(pc >> 2) & bimodal->mask], taken);
+}
+
+// Gshare predictor: 2-bit counters indexed by pc xor global history (as many
+// history bits as index bits)
+typedef struct {
+	uint32_t mask;
+	uint32_t history;
+	uint8_t counters[];
+} gshare_t;
+
+/**
+ * Creates the gshare predictor, counters starting weakly taken
+ * @param bits	Index and history bits
+ * @return		Returns the state (released with free)
+ */
+static void* gshare_create(uint32_t bits) {
+	gshare_t* gshare = (gshare_t*)(calloc(1, sizeof(gshare_t) + (1u << bits)));
+	gshare->mask = (1u << bits) - 1;
+	memset(gshare->counters, 2, 1u << bits);
+	return gshare;
+}
+
+/**
+ * Predicts a conditional branch from the counter of its pc xor the history
+ * @param state		Predictor state
+ * @param pc		Branch address
+ * @param target	Branch target
+ * @return			Returns 1 when predicted taken
+ */
+static int gshare_predict(void* state, uint32_t pc, uint32_t target) {
+	const gshare_t* gshare = (const gshare_t*)(state);
+	return gshare->counters[((pc >> 2) ^ gshare->history) & gshare->mask] >= 2;
+}
+
+/**
+ * Trains the counter of the branch toward its outcome and shifts it into
+ * the history
+ * @param state		Predictor state
+ * @param pc		Branch address
+ * @param target	Branch target
+ * @param taken		Branch outcome
+ */
+static void gshare_update(void* state, uint32_t pc, uint32_t target, int taken) {
+	gshare_t* gshare = (gshare_t*)(state);
+	counter_update(&gshare->counters[((pc >> 2) ^ gshare->history) & gshare->mask], taken);
+	gshare->history = ((gshare->history << 1) | taken) & gshare->mask;
+}
+
+// TAGE-lite predictor: bimodal base and tagged tables indexed by pc and
+// geometrically longer global histories; the longest matching table provides
+// the prediction, mispredictions allocate an entry in a longer table
+#define TAGE_TABLES 4
+#define TAGE_TAG_BITS 9
+// Tag of empty entries (wider than any computed tag, so it never matches)
+#define TAGE_TAG_EMPTY (1u << TAGE_TAG_BITS)
+static const uint8_t tage_history[TAGE_TABLES] = { 5, 12, 25, 50 };
+
+// Tagged entry: partial tag, 3-bit signed counter (taken when >= 0), 2-bit usefulness
+typedef struct {
+	uint16_t tag;
+	int8_t counter;
+	uint8_t useful;
+} tage_entry_t;
+
+typedef struct {
+	uint32_t bits;
+	uint64_t history;
+	// Branches since the last usefulness decay
+	uint32_t branches;
+	// Lookup of the last prediction: indexes and tags, provider table (-1 for
+	// the base) and the alternate prediction
+	uint32_t index[TAGE_TABLES];
+	uint16_t tag[TAGE_TABLES];
+	int provider;
+	int alternate;
+	uint8_t* base;
+	tage_entry_t* tables[TAGE_TABLES];
+} tage_t;
+
+/**
+ * Folds the newest history bits into a narrower value (xor of chunks)
+ * @param history	Global history (newest outcome in bit 0)
+ * @param length	History bits used
+ * @param bits		Folded width
+ * @return			Returns the folded history
+ */
+static inline uint32_t tage_fold(uint64_t history, uint32_t length, uint32_t bits) {
+	history &= (length < 64) ? ((1ULL << length) - 1) : ~0ULL;
+	uint32_t folded = 0;
+	for(; history != 0; history >>= bits) folded ^= (uint32_t)(history & ((1u << bits) - 1));
+	return folded;
+}
+
+/**
+ * Creates the TAGE predictor, base counters starting weakly taken and tagged
+ * entries empty
+ * @param bits	Index bits of the base and of each tagged table
+ * @return		Returns the state (released with free)
+ */
+static void* tage_create(uint32_t bits) {
+	// Single allocation: state, base counters and tagged tables
+	const size_t entries = 1u << bits;
+	tage_t* tage = (tage_t*)(calloc(1, sizeof(tage_t) + entries + TAGE_TABLES * entries * sizeof(tage_entry_t) + sizeof(tage_entry_t)));
+	tage->bits = bits;
+	tage_entry_t* tables = (tage_entry_t*)(((uintptr_t)(tage + 1) + entries + sizeof(tage_entry_t) - 1) & ~(uintptr_t)(sizeof(tage_entry_t) - 1));
+	tage->base = (uint8_t*)(tage + 1);
+	memset(tage->base, 2, entries);
+	for(uint32_t t = 0; t < TAGE_TABLES; t++) tage->tables[t] = tables + t * entries;
+	for(size_t i = 0; i < TAGE_TABLES * entries; i++) tables[i].tag = TAGE_TAG_EMPTY;
+	return tage;
+}
+
+/**
+ * Predicts a conditional branch, recording the lookup (indexes, tags, provider
+ * and alternate) for the update
+ * @param state		Predictor state
+ * @param pc		Branch address
+ * @param target	Branch target
+ * @return			Returns 1 when predicted taken
+ */
+static int tage_predict(void* state, uint32_t pc, uint32_t target) {
+	tage_t* tage = (tage_t*)(state);
+	const uint32_t mask = (1u << tage->bits) - 1;
+	tage->provider = -1;
+	tage->alternate = tage->base[(pc >> 2) & mask] >= 2;
+	int prediction = tage->alternate;
+	for(uint32_t t = 0; t < TAGE_TABLES; t++) {
+		const uint32_t length = tage_history[t];
+		tage->index[t] = ((pc >> 2) ^ (pc >> (2 + tage->bits)) ^ tage_fold(tage->history, length, tage->bits)) & mask;
+		tage->tag[t] = ((pc >> 2) ^ tage_fold(tage->history, length, TAGE_TAG_BITS) ^ (tage_fold(tage->history, length, TAGE_TAG_BITS - 1) << 1)) & ((1u << TAGE_TAG_BITS) - 1);
+		const tage_entry_t* entry = &tage->tables[t][tage->index[t]];
+		if(entry->tag == tage->tag[t]) {
+			// Longer matches override (the previous prediction becomes the alternate)
+			tage->alternate = prediction;
+			tage->provider = t;
+			prediction = entry->counter >= 0;
+		}
+	}
+	return prediction;
+}
+
+/**
+ * Trains the provider (or the base) with the outcome of the last predicted
+ * branch, allocates longer entries on mispredictions and shifts the history
+ * @param state		Predictor state
+ * @param pc		Branch address
+ * @param target	Branch target
+ * @param taken		Branch outcome
+ */
+static void tage_update(void* state, uint32_t pc, uint32_t target, int taken) {
+	tage_t* tage = (tage_t*)(state);
+	const int provider = tage->provider;
+	int prediction = tage->alternate;
+	if(provider < 0) {
+		counter_update(&tage->base[(pc >> 2) & ((1u << tage->bits) - 1)], taken);
+	} else {
+		tage_entry_t* entry = &tage->tables[provider][tage->index[provider]];
+		prediction = entry->counter >= 0;
+		// Useful entries predict better than the alternate
+		if(prediction != tage->alternate) {
+			if(prediction == taken && entry->useful < 3) entry->useful++;
+			if(prediction != taken && entry->useful > 0) entry->useful--;
+		}
+		if(taken && entry->counter < 3) entry->counter++;
+		if(!taken && entry->counter > -4) entry->counter--;
+	}
+	// Allocating an entry in a longer table on mispredictions (aging them when all are useful)
+	if(prediction != taken) {
+		int allocated = 0;
+		for(int t = provider + 1; t < TAGE_TABLES && !allocated; t++) {
+			tage_entry_t* entry = &tage->tables[t][tage->index[t]];
+			if(entry->useful == 0) {
+				entry->tag = tage->tag[t];
+				entry->counter = taken ? 0 : -1;
+				allocated = 1;
+			}
+		}
+		for(int t = provider + 1; t < TAGE_TABLES && !allocated; t++) {
+			if(tage->tables[t][tage->index[t]].useful > 0) tage->tables[t][tage->index[t]].useful--;
+		}
+	}
+	// Halving usefulness periodically (stale entries become replaceable)
+	if(++tage->branches == 1u << 18) {
+		tage->branches = 0;
+		for(uint32_t t = 0; t < TAGE_TABLES; t++) {
+			for(uint32_t i = 0; i < 1u << tage->bits; i++) tage->tables[t][i].useful >>= 1;
+		}
+	}
+	tage->history = (tage->history << 1) | taken;
+}
+
+// Predictor models (name, default bits)
+static const predictor_kind_t predictor_kinds[] = {
+	{ "static", 0, static_create, static_predict, static_update },
+	{ "bimodal", 12, bimodal_create, bimodal_predict, bimodal_update },
+	{ "gshare", 12, gshare_create, gshare_predict, gshare_update },
+	{ "tage", 10, tage_create, tage_predict, tage_update },
+};
+
+// Simulated predictor (model and table size)
+typedef struct {
+	const predictor_kind_t* kind;
+	uint32_t bits;
+} predictor_config_t;
+
+// Conditional branch site statistics
+typedef struct {
+	// Branch address (TLB_INVALID when the slot is empty)
+	uint32_t pc;
+	uint64_t executed;
+	uint64_t taken;
+	uint64_t mispredicts[PREDICTORS_MAX];
+} branch_site_t;
+
+// Branch predictors of a hart, fed from every conditional branch outcome
+struct branch_unit {
+	uint32_t count;
+	predictor_config_t config[PREDICTORS_MAX];
+	void* state[PREDICTORS_MAX];
+	uint64_t mispredicts[PREDICTORS_MAX];
+	uint64_t branches;
+	// Sites by pc (open addressing, at most half full)
+	branch_site_t* sites;
+	uint32_t capacity;
+	uint32_t used;
+};
+
+/**
+ * Parses a predictor list ("name[:bits],...", names static, bimodal, gshare and tage)
+ * @param config	Predictors
+ * @param count		Number of predictors
+ * @param text		Predictor list
+ * @return			Returns 0 on success
+ */
+static int branch_parse(predictor_config_t* config, uint32_t* count, const char* text) {
+	char copy[256];
+	snprintf(copy, sizeof(copy), "%s", text);
+	char* save;
+	*count = 0;
+	for(char* item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+		if(*count == PREDICTORS_MAX) return 1;
+		char* bits = strchr(item, ':');
+		if(bits != NULL) *bits++ = '\0';
+		predictor_config_t* predictor = &config[(*count)++];
+		predictor->kind = NULL;
+		for(uint32_t i = 0; i < sizeof(predictor_kinds) / sizeof(predictor_kinds[0]); i++) {
+			if(strcmp(item, predictor_kinds[i].name) == 0) predictor->kind = &predictor_kinds[i];
+		}
+		if(predictor->kind == NULL) return 1;
+		predictor->bits = predictor->kind->bits;
+		if(bits != NULL) {
+			char* end;
+			const unsigned long value = strtoul(bits, &end, 10);
+			if(*end != '\0' || value < 1 || value > 24) return 1;
+			predictor->bits = (uint32_t)value;
+		}
+	}
+	return *count == 0;
+}
+
+/**
+ * Creates the branch predictors of a hart
+ * @param config	Predictors
+ * @param count		Number of predictors
+ * @return			Returns the branch unit
+ */
+static branch_unit_t* branch_create(const predictor_config_t* config, uint32_t count) {
+	branch_unit_t* unit = (branch_unit_t*)(calloc(1, sizeof(branch_unit_t)));
+	unit->count = count;
+	for(uint32_t i = 0; i < count; i++) {
+		unit->config[i] = config[i];
+		unit->state[i] = config[i].kind->create(config[i].bits);
+	}
+	unit->capacity = 64;
+	unit->sites = (branch_site_t*)(calloc(unit->capacity, sizeof(branch_site_t)));
+	for(uint32_t i = 0; i < unit->capacity; i++) unit->sites[i].pc = TLB_INVALID;
+	return unit;
+}
+
+/**
+ * Releases the branch predictors of a hart
+ * @param unit	Branch unit
+ */
+static void branch_destroy(branch_unit_t* unit) {
+	for(uint32_t i = 0; i < unit->count; i++) free(unit->state[i]);
+	free(unit->sites);
+	free(unit);
+}
+
+/**
+ * Retrieves the statistics of a branch site, creating them on first execution
+ * @param unit	Branch unit
+ * @param pc	Branch address
+ * @return		Returns the site
+ */
+static branch_site_t* branch_site(branch_unit_t* unit, uint32_t pc) {
+	// Doubling the table when half full
+	if(2 * (unit->used + 1) > unit->capacity) {
+		branch_site_t* sites = unit->sites;
+		const uint32_t capacity = unit->capacity;
+		unit->capacity *= 2;
+		unit->used = 0;
+		unit->sites = (branch_site_t*)(calloc(unit->capacity, sizeof(branch_site_t)));
+		for(uint32_t i = 0; i < unit->capacity; i++) unit->sites[i].pc = TLB_INVALID;
+		for(uint32_t i = 0; i < capacity; i++) {
+			if(sites[i].pc != TLB_INVALID) *branch_site(unit, sites[i].pc) = sites[i];
+		}
+		free(sites);
+	}
+	uint32_t slot = ((pc >> 2) * 0x9E3779B1u) & (unit->capacity - 1);
+	while(unit->sites[slot].pc != pc && unit->sites[slot].pc != TLB_INVALID) slot = (slot + 1) & (unit->capacity - 1);
+	if(unit->sites[slot].pc == TLB_INVALID) {
+		unit->sites[slot].pc = pc;
+		unit->used++;
+	}
+	return &unit->sites[slot];
+}
+
+/**
+ * Feeds a conditional branch outcome to every predictor
+ * @param unit		Branch unit
+ * @param pc		Branch address
+ * @param target	Taken target
+ * @param taken		Branch outcome
+ * @return			Returns 1 if the first predictor mispredicted it
+ */
+static int branch_record(branch_unit_t* unit, uint32_t pc, uint32_t target, int taken) {
+	branch_site_t* site = branch_site(unit, pc);
+	site->executed++;
+	site->taken += taken;
+	unit->branches++;
+	int first = 0;
+	for(uint32_t i = 0; i < unit->count; i++) {
+		const predictor_kind_t* kind = unit->config[i].kind;
+		const int mispredict = kind->predict(unit->state[i], pc, target) != taken;
+		kind->update(unit->state[i], pc, target, taken);
+		site->mispredicts[i] += mispredict;
+		unit->mispredicts[i] += mispredict;
+		if(i == 0) first = mispredict;
+	}
+	return first;
+}
+
+/**
+ * Compares branch sites by mispredictions of all predictors (descending), then pc
+ * @param a	First site
+ * @param b	Second site
+ * @return	Returns the ordering
+ */
+static int branch_site_compare(const void* a, const void* b) {
+	const branch_site_t* site_a = (const branch_site_t*)(a);
+	const branch_site_t* site_b = (const branch_site_t*)(b);
+	uint64_t total_a = 0, total_b = 0;
+	for(uint32_t i = 0; i < PREDICTORS_MAX; i++) {
+		total_a += site_a->mispredicts[i];
+		total_b += site_b->mispredicts[i];
+	}
+	if(total_a != total_b) return (total_a < total_b) - (total_a > total_b);
+	return (site_a->pc > site_b->pc) - (site_a->pc < site_b->pc);
+}
+
+// Branch sites listed in the summary (most mispredicted first)
+#define BRANCH_REPORT_SITES 16
+
+/**
+ * Labels a predictor ("name:bits", the static one by name)
+ * @param predictor	Predictor
+ * @param text		Label buffer
+ * @param size		Buffer size
+ * @return			Returns the label
+ */
+static const char* branch_label(const predictor_config_t* predictor, char* text, size_t size) {
+	if(predictor->kind->bits == 0) snprintf(text, size, "%s", predictor->kind->name);
+	else snprintf(text, size, "%s:%u", predictor->kind->name, predictor->bits);
+	return text;
+}
+
+/**
+ * Outputs mispredict rates per predictor and per branch site to the console
+ * @param unit	Branch unit
+ */
+static void branch_report(const branch_unit_t* unit) {
+	// Outputting predictors
+	char label[PREDICTORS_MAX][32];
+	for(uint32_t i = 0; i < unit->count; i++) {
+		branch_label(&unit->config[i], label[i], sizeof(label[i]));
+		printf("bpred=%s mispredicts=%llu/%llu rate=%.2f%%\n", label[i], (unsigned long long)unit->mispredicts[i], (unsigned long long)unit->branches,
+			unit->branches ? 100.0 * unit->mispredicts[i] / unit->branches : 0.0);
+	}
+	// Collecting and sorting sites
+	branch_site_t* sites = (branch_site_t*)(malloc((unit->used + 1) * sizeof(branch_site_t)));
+	uint32_t count = 0;
+	for(uint32_t i = 0; i < unit->capacity; i++) {
+		if(unit->sites[i].pc != TLB_INVALID) sites[count++] = unit->sites[i];
+	}
+	qsort(sites, count, sizeof(branch_site_t), branch_site_compare);
+	// Outputting sites (executions, taken rate and mispredict rate per predictor)
+	for(uint32_t s = 0; s < count && s < BRANCH_REPORT_SITES; s++) {
+		const branch_site_t* site = &sites[s];
+		printf("branch=0x%08x executed=%llu taken=%.2f%%", site->pc, (unsigned long long)site->executed, 100.0 * site->taken / site->executed);
+		for(uint32_t i = 0; i < unit->count; i++) printf(" %s=%.2f%%", label[i], 100.0 * site->mispredicts[i] / site->executed);
+		printf("\n");
+	}
+	if(count > BRANCH_REPORT_SITES) printf("branches=%u (%u not shown)\n", count, count - BRANCH_REPORT_SITES);
+	free(sites);
+}
+
+// Operation names (see OP_LIST, reported in lowercase)
+static const char* const op_name[OP_COUNT] = {
+#define X(name, handler) #name,
+	OP_LIST(X)
+#undef X
+};
+
+/**
+ * Outputs an operation name in lowercase
+ * @param op	Operation index
+ * @param text	Name buffer
+ * @param size	Buffer size
+ * @return		Returns the name
+ */
+static const char* profile_op(uint8_t op, char* text, size_t size) {
+	size_t i = 0;
+	for(; op_name[op][i] != '\0' && i + 1 < size; i++) text[i] = (op_name[op][i] == '_') ? '.' : op_name[op][i] | 0x20;
+	text[i] = '\0';
+	return text;
+}
+
+// Executed instruction of the profile (address and decoded slot)
+typedef struct {
+	uint32_t pc;
+	const decoded_t* d;
+} profile_pc_t;
+
+// Profiled basic block (straight-line run of equally executed instructions
+// ending at control flow)
+typedef struct {
+	uint32_t first;
+	uint32_t last;
+	uint64_t executions;
+	uint64_t instructions;
+} profile_block_t;
+
+/**
+ * Compares profiled instructions by executions (descending), then pc
+ * @param a	First instruction
+ * @param b	Second instruction
+ * @return	Returns the ordering
+ */
+static int profile_pc_compare(const void* a, const void* b) {
+	const profile_pc_t* pc_a = (const profile_pc_t*)(a);
+	const profile_pc_t* pc_b = (const profile_pc_t*)(b);
+	if(pc_a->d->count != pc_b->d->count) return (pc_a->d->count < pc_b->d->count) - (pc_a->d->count > pc_b->d->count);
+	return (pc_a->pc > pc_b->pc) - (pc_a->pc < pc_b->pc);
+}
+
+/**
+ * Compares profiled blocks by executed instructions (descending), then pc
+ * @param a	First block
+ * @param b	Second block
+ * @return	Returns the ordering
+ */
+static int profile_block_compare(const void* a, const void* b) {
+	const profile_block_t* block_a = (const profile_block_t*)(a);
+	const profile_block_t* block_b = (const profile_block_t*)(b);
+	if(block_a->instructions != block_b->instructions) return (block_a->instructions < block_b->instructions) - (block_a->instructions > block_b->instructions);
+	return (block_a->first > block_b->first) - (block_a->first < block_b->first);
+}
+
+/**
+ * Formats the " <name+0xoffset>" label of an instruction address
+ * @param symbols	Program symbols (NULL for none)
+ * @param pc		Instruction address
+ * @param label		Label buffer
+ * @param size		Label buffer size
+ * @return			Returns the label (empty without a symbol)
+ */
+static const char* profile_label(const symbols_t* symbols, uint32_t pc, char* label, size_t size) {
+	const symbol_t* symbol = (symbols != NULL) ? symbol_find(symbols, pc) : NULL;
+	if(symbol == NULL) label[0] = '\0';
+	else if(symbol->address == pc) snprintf(label, size, " <%s>", symbols->names + symbol->name);
+	else snprintf(label, size, " <%s+0x%x>", symbols->names + symbol->name, pc - symbol->address);
+	return label;
+}
+
+/**
+ * Outputs the profile of all harts (executions counted in the decoded slots)
+ * to the console: mnemonic histogram, load and store widths, executions per
+ * function (ELF input), hottest instructions and hottest basic blocks
+ * @param memory	Guest memory (blocks already folded into the slots)
+ * @param symbols	Program symbols (NULL for none)
+ * @param top		Functions, instructions and blocks listed
+ */
+static void profile_report(const memory_t* memory, const symbols_t* symbols, uint32_t top) {
+	uint64_t ops[OP_COUNT] = { 0 };
+	uint64_t instructions = 0;
+	uint32_t count = 0, capacity = 1024;
+	profile_pc_t* pcs = (profile_pc_t*)(malloc(capacity * sizeof(profile_pc_t)));
+	uint32_t block_count = 0, block_capacity = 256;
+	profile_block_t* blocks = (profile_block_t*)(malloc(block_capacity * sizeof(profile_block_t)));
+	profile_block_t* block = NULL;
+	// Collecting executed instructions in address order (basic blocks start
+	// after control flow, on execution count changes and after gaps)
+	for(uint32_t index = 0; index < memory->size >> PAGE_BITS; index++) {
+		const page_t* page = memory->pages[index];
+		if(page == NULL || page->code == NULL) {
+			block = NULL;
+			continue;
+		}
+		for(uint32_t offset = 0; offset < PAGE_SIZE; offset += 2) {
+			const decoded_t* d = &page->code[code_slot(offset)];
+			const uint64_t executions = d->count;
+			const uint32_t pc = memory->base + (index << PAGE_BITS) + offset;
+			if(executions == 0 || d->handler == NULL) {
+				block = NULL;
+				continue;
+			}
+			// Skipping the second halfword of 32-bit instructions
+			offset += d->size - 2;
+			instructions += executions;
+			ops[d->op] += executions;
+			if(count == capacity) pcs = (profile_pc_t*)(realloc(pcs, (capacity *= 2) * sizeof(profile_pc_t)));
+			pcs[count++] = (profile_pc_t){ pc, d };
+			if(block == NULL || block->executions != executions) {
+				if(block_count == block_capacity) blocks = (profile_block_t*)(realloc(blocks, (block_capacity *= 2) * sizeof(profile_block_t)));
+				block = &blocks[block_count++];
+				*block = (profile_block_t){ pc, pc, executions, 0 };
+			}
+			block->last = pc;
+			block->instructions += executions;
+			if(OP_CONTROL(d->op) || d->op == OP_EBREAK) block = NULL;
+		}
+	}
+	printf("profile instructions=%llu pcs=%u blocks=%u\n", (unsigned long long)instructions, count, block_count);
+	// Outputting load and store traffic by width
+	printf("loads lw=%llu lh=%llu lhu=%llu lb=%llu lbu=%llu stores sw=%llu sh=%llu sb=%llu\n",
+		(unsigned long long)ops[OP_LW], (unsigned long long)ops[OP_LH], (unsigned long long)ops[OP_LHU], (unsigned long long)ops[OP_LB], (unsigned long long)ops[OP_LBU],
+		(unsigned long long)ops[OP_SW], (unsigned long long)ops[OP_SH], (unsigned long long)ops[OP_SB]);
+	// Outputting mnemonic histogram (most executed first)
+	char name[32];
+	for(;;) {
+		uint32_t op = OP_COUNT;
+		for(uint32_t i = 0; i < OP_COUNT; i++) {
+			if(ops[i] != 0 && (op == OP_COUNT || ops[i] > ops[op])) op = i;
+		}
+		if(op == OP_COUNT) break;
+		printf("op=%s executed=%llu share=%.2f%%\n", profile_op(op, name, sizeof(name)), (unsigned long long)ops[op], 100.0 * ops[op] / instructions);
+		ops[op] = 0;
+	}
+	// Outputting executions per function (most executed first)
+	char label[160];
+	if(symbols != NULL) {
+		uint64_t* functions = (uint64_t*)(calloc(symbols->count, sizeof(uint64_t)));
+		for(uint32_t i = 0; i < count; i++) {
+			const symbol_t* symbol = symbol_find(symbols, pcs[i].pc);
+			if(symbol != NULL) functions[symbol - symbols->entries] += pcs[i].d->count;
+		}
+		for(uint32_t listed = 0; listed < top; listed++) {
+			uint32_t function = symbols->count;
+			for(uint32_t i = 0; i < symbols->count; i++) {
+				if(functions[i] != 0 && (function == symbols->count || functions[i] > functions[function])) function = i;
+			}
+			if(function == symbols->count) break;
+			printf("function=%s executed=%llu share=%.2f%%\n", symbols->names + symbols->entries[function].name, (unsigned long long)functions[function], 100.0 * functions[function] / instructions);
+			functions[function] = 0;
+		}
+		free(functions);
+	}
+	// Outputting hottest instructions and blocks
+	qsort(pcs, count, sizeof(profile_pc_t), profile_pc_compare);
+	for(uint32_t i = 0; i < count && i < top; i++) {
+		printf("pc=0x%08x executed=%llu share=%.2f%% %s%s\n", pcs[i].pc, (unsigned long long)pcs[i].d->count, 100.0 * pcs[i].d->count / instructions, profile_op(pcs[i].d->op, name, sizeof(name)),
+			profile_label(symbols, pcs[i].pc, label, sizeof(label)));
+	}
+	qsort(blocks, block_count, sizeof(profile_block_t), profile_block_compare);
+	for(uint32_t i = 0; i < block_count && i < top; i++) {
+		printf("block=0x%08x:0x%08x executions=%llu instructions=%llu share=%.2f%%%s\n", blocks[i].first, blocks[i].last,
+			(unsigned long long)blocks[i].executions, (unsigned long long)blocks[i].instructions, 100.0 * blocks[i].instructions / instructions,
+			profile_label(symbols, blocks[i].first, label, sizeof(label)));
+	}
+	free(pcs);
+	free(blocks);
+}
+
+// Basic block vectors (SimPoint format: one "T:id:count :id:count ..." line
+// per interval, blocks numbered from 1 in first execution order)
+typedef struct {
+	uint32_t pc;
+	uint32_t id;
+	uint64_t count;
+} bbv_block_t;
+
+struct bbv {
+	FILE* file;
+	// Interval and instruction count ending the current vector
+	uint64_t interval;
+	uint64_t next;
+	// Blocks by first pc (open addressing, at most half full)
+	bbv_block_t* blocks;
+	uint32_t capacity;
+	uint32_t used;
+	// Current block of the instruction by instruction path and its length
+	// (0 when the next instruction starts a block)
+	bbv_block_t* current;
+	uint32_t length;
+	uint8_t control;
+};
+
+/**
+ * Creates the basic block vector collection of a hart
+ * @param file		Vector file
+ * @param interval	Instructions per vector
+ * @return			Returns the collection
+ */
+static bbv_t* bbv_create(FILE* file, uint64_t interval) {
+	bbv_t* bbv = (bbv_t*)(calloc(1, sizeof(bbv_t)));
+	bbv->file = file;
+	bbv->interval = interval;
+	bbv->next = interval;
+	bbv->capacity = 64;
+	bbv->blocks = (bbv_block_t*)(calloc(bbv->capacity, sizeof(bbv_block_t)));
+	for(uint32_t i = 0; i < bbv->capacity; i++) bbv->blocks[i].pc = TLB_INVALID;
+	return bbv;
+}
+
+/**
+ * Retrieves a block, numbering it on first execution
+ * @param bbv	Collection
+ * @param pc	First instruction address
+ * @return		Returns the block
+ */
+static bbv_block_t* bbv_block(bbv_t* bbv, uint32_t pc) {
+	// Doubling the table when half full
+	if(2 * (bbv->used + 1) > bbv->capacity) {
+		bbv_block_t* blocks = bbv->blocks;
+		const uint32_t capacity = bbv->capacity;
+		bbv->capacity *= 2;
+		bbv->blocks = (bbv_block_t*)(calloc(bbv->capacity, sizeof(bbv_block_t)));
+		for(uint32_t i = 0; i < bbv->capacity; i++) bbv->blocks[i].pc = TLB_INVALID;
+		for(uint32_t i = 0; i < capacity; i++) {
+			if(blocks[i].pc == TLB_INVALID) continue;
+			uint32_t slot = ((blocks[i].pc >> 2) * 0x9E3779B1u) & (bbv->capacity - 1);
+			while(bbv->blocks[slot].pc != TLB_INVALID) slot = (slot + 1) & (bbv->capacity - 1);
+			bbv->blocks[slot] = blocks[i];
+		}
+		free(blocks);
+	}
+	uint32_t slot = ((pc >> 2) * 0x9E3779B1u) & (bbv->capacity - 1);
+	while(bbv->blocks[slot].pc != pc && bbv->blocks[slot].pc != TLB_INVALID) slot = (slot + 1) & (bbv->capacity - 1);
+	if(bbv->blocks[slot].pc == TLB_INVALID) {
+		bbv->blocks[slot].pc = pc;
+		bbv->blocks[slot].id = ++bbv->used;
+	}
+	return &bbv->blocks[slot];
+}
+
+/**
+ * Writes the current vector (blocks executed since the last one)
+ * @param bbv	Collection
+ */
+static void bbv_flush(bbv_t* bbv) {
+	fputc('T', bbv->file);
+	for(uint32_t i = 0; i < bbv->capacity; i++) {
+		bbv_block_t* block = &bbv->blocks[i];
+		if(block->pc == TLB_INVALID || block->count == 0) continue;
+		fprintf(bbv->file, ":%u:%llu ", block->id, (unsigned long long)block->count);
+		block->count = 0;
+	}
+	fputc('\n', bbv->file);
+}
+
+/**
+ * Starts a block, writing the vector first when its interval ended
+ * @param bbv		Collection
+ * @param pc		First instruction address
+ * @param instret	Instructions executed before the block
+ * @return			Returns the block
+ */
+static inline bbv_block_t* bbv_start(bbv_t* bbv, uint32_t pc, uint64_t instret) {
+	if(instret >= bbv->next) {
+		bbv_flush(bbv);
+		while(bbv->next <= instret) bbv->next += bbv->interval;
+	}
+	return bbv_block(bbv, pc);
+}
+
+/**
+ * Counts an instruction executed instruction by instruction (blocks split as
+ * translated: after control flow, on page starts and every BLOCK_MAX)
+ * @param bbv		Collection
+ * @param pc		Instruction address
+ * @param op		Operation
+ * @param instret	Instructions executed before it
+ */
+static void bbv_step(bbv_t* bbv, uint32_t pc, uint8_t op, uint64_t instret) {
+	if(bbv->length == 0 || bbv->control || bbv->length == BLOCK_MAX || (pc & PAGE_MASK) == 0) {
+		bbv->current = bbv_start(bbv, pc, instret);
+		bbv->length = 0;
+	}
+	bbv->current->count++;
+	bbv->length++;
+	bbv->control = OP_CONTROL(op);
+}
+
+/**
+ * Counts the instructions executed by a block
+ * @param bbv		Collection
+ * @param pc		Block address
+ * @param instret	Instructions executed before the block
+ * @param count		Instructions executed
+ */
+static NOINLINE void bbv_count(bbv_t* bbv, uint32_t pc, uint64_t instret, uint32_t count) {
+	bbv_start(bbv, pc, instret)->count += count;
+	// The next instruction starts a block
+	bbv->length = 0;
+}
+
+/**
+ * Writes the last (partial) vector and releases the collection
+ * @param bbv	Collection
+ */
+static void bbv_destroy(bbv_t* bbv) {
+	for(uint32_t i = 0; i < bbv->capacity; i++) {
+		if(bbv->blocks[i].pc != TLB_INVALID && bbv->blocks[i].count != 0) {
+			bbv_flush(bbv);
+			break;
+		}
+	}
+	fclose(bbv->file);
+	free(bbv->blocks);
+	free(bbv);
+}
+
+// Reverse execution: an undo log of the state each instruction overwrites
+// (previous rd value and stored bytes) since the newest checkpoint, and a
+// ring of checkpoints (registers, pc and touched pages) taken every interval,
+// so going back beyond the log restores a checkpoint and executes forward
+typedef struct {
+	// Instruction address
+	uint32_t pc;
+	// Previous destination register value
+	uint32_t rd_value;
+	uint8_t rd;
+	// Store size in bytes (0 for none), address and previous bytes
+	uint8_t size;
+	uint32_t address;
+	uint32_t data;
+	// Changed state the log cannot restore (CSRs, traps and device registers):
+	// going back over it executes again from the checkpoint
+	uint8_t barrier;
+} undo_entry_t;
+
+// Checkpoint (state before the instret-th instruction)
+typedef struct {
+	uint64_t instret;
+	uint32_t pc;
+	uint32_t x[32];
+	// CSRs and the hart CLINT registers
+	csr_t csr;
+	uint64_t mtimecmp;
+	uint64_t mtime_offset;
+	uint32_t msip;
+	// Touched pages: page indexes and contents
+	uint32_t pages;
+	uint32_t* index;
+	uint8_t* data;
+} checkpoint_t;
+
+struct reverse {
+	// Instructions between checkpoints
+	uint64_t interval;
+	// Checkpoint ring (oldest slot and stored checkpoints)
+	checkpoint_t* checkpoints;
+	uint32_t capacity;
+	uint32_t first;
+	uint32_t count;
+	// Undo log since the newest checkpoint (one entry per instruction)
+	undo_entry_t* log;
+	uint64_t length;
+};
+
+/**
+ * Creates the reverse execution state of a hart
+ * @param capacity	Checkpoints kept
+ * @param interval	Instructions between checkpoints
+ * @return			Returns the state
+ */
+static reverse_t* reverse_create(uint32_t capacity, uint64_t interval) {
+	reverse_t* reverse = (reverse_t*)(calloc(1, sizeof(reverse_t)));
+	reverse->interval = interval;
+	reverse->capacity = capacity;
+	reverse->checkpoints = (checkpoint_t*)(calloc(capacity, sizeof(checkpoint_t)));
+	reverse->log = (undo_entry_t*)(malloc(interval * sizeof(undo_entry_t)));
+	return reverse;
+}
+
+/**
+ * Releases the reverse execution state
+ * @param reverse	State
+ */
+static void reverse_destroy(reverse_t* reverse) {
+	for(uint32_t i = 0; i < reverse->capacity; i++) {
+		free(reverse->checkpoints[i].index);
+		free(reverse->checkpoints[i].data);
+	}
+	free(reverse->checkpoints);
+	free(reverse->log);
+	free(reverse);
+}
+
+/**
+ * Retrieves the newest checkpoint
+ * @param reverse	State (at least one checkpoint)
+ * @return			Returns the checkpoint
+ */
+static inline checkpoint_t* reverse_newest(reverse_t* reverse) {
+	return &reverse->checkpoints[(reverse->first + reverse->count - 1) % reverse->capacity];
+}
+
+/**
+ * Takes a checkpoint, replacing the oldest one when the ring is full, and
+ * empties the undo log
+ * @param reverse	State
+ * @param cpu		Simulator state (single hart)
+ */
+static NOINLINE void reverse_checkpoint(reverse_t* reverse, const cpu_t* cpu) {
+	const memory_t* memory = cpu->memory;
+	if(reverse->count == reverse->capacity) {
+		reverse->first = (reverse->first + 1) % reverse->capacity;
+		reverse->count--;
+	}
+	reverse->count++;
+	checkpoint_t* checkpoint = reverse_newest(reverse);
+	checkpoint->instret = cpu->instret;
+	checkpoint->pc = cpu->pc;
+	memcpy(checkpoint->x, cpu->x, sizeof(checkpoint->x));
+	checkpoint->csr = cpu->csr;
+	if(memory->devices != NULL) {
+		checkpoint->mtimecmp = memory->devices->mtimecmp[cpu->hartid];
+		checkpoint->mtime_offset = memory->devices->mtime_offset;
+		checkpoint->msip = memory->devices->msip[cpu->hartid];
+	}
+	// Copying the touched pages (reusing the buffers of the replaced checkpoint)
+	if(checkpoint->pages != memory->allocated) {
+		checkpoint->index = (uint32_t*)(realloc(checkpoint->index, memory->allocated * sizeof(uint32_t)));
+		checkpoint->data = (uint8_t*)(realloc(checkpoint->data, (size_t)(memory->allocated) * PAGE_SIZE));
+	}
+	checkpoint->pages = 0;
+	for(uint32_t index = 0; index < memory->size >> PAGE_BITS; index++) {
+		if(memory->pages[index] == NULL) continue;
+		checkpoint->index[checkpoint->pages] = index;
+		memcpy(&checkpoint->data[(size_t)(checkpoint->pages++) * PAGE_SIZE], memory->pages[index]->data, PAGE_SIZE);
+	}
+	reverse->length = 0;
+}
+
+/**
+ * Logs the state an instruction is about to overwrite (taking a checkpoint
+ * first when the log is full)
+ * @param reverse	State
+ * @param cpu		Simulator state
+ * @param d			Decoded instruction
+ */
+static inline void reverse_record(reverse_t* reverse, cpu_t* cpu, const decoded_t* d) {
+	if(reverse->length == reverse->interval || reverse->count == 0) reverse_checkpoint(reverse, cpu);
+	undo_entry_t* entry = &reverse->log[reverse->length++];
+	entry->pc = cpu->pc;
+	// Every instruction keeps rd (unchanged by the ones not writing it)
+	entry->rd = d->rd;
+	entry->rd_value = cpu->x[d->rd];
+	entry->size = 0;
+	entry->barrier = (d->op >= OP_CSRRW && d->op <= OP_UNKNOWN);
+	if(d->op >= OP_SW && d->op <= OP_AMOMAXU) {
+		entry->address = cpu->x[d->rs1] + ((d->op <= OP_SH) ? d->imm : 0);
+		entry->size = (d->op == OP_SB) ? 1 : (d->op == OP_SH) ? 2 : 4;
+		entry->data = mem_peek(cpu, entry->address);
+		if(cpu->memory->devices != NULL && entry->address - cpu->memory->base >= cpu->memory->size) entry->barrier = 1;
+	}
+}
+
+/**
+ * Undoes the last logged instruction. The hart becomes runnable again and
+ * loses its load reservation (sc.w may fail spuriously).
+ * @param reverse	State (non-empty log)
+ * @param cpu		Simulator state
+ */
+static void reverse_undo(reverse_t* reverse, cpu_t* cpu) {
+	const undo_entry_t* entry = &reverse->log[--reverse->length];
+	cpu->x[entry->rd] = entry->rd_value;
+	if(entry->size != 0) mem_poke(cpu, entry->address, entry->size, entry->data);
+	cpu->pc = entry->pc;
+	cpu->instret--;
+	cpu->run = 1;
+	cpu->fault = 0;
+	cpu->exited = 0;
+	cpu->reserved = 0;
+}
+
+/**
+ * Restores the newest checkpoint: registers, CSRs, CLINT registers of the
+ * hart, pc and memory (pages touched since then get their initial contents
+ * back, decoded instructions of changed pages are dropped)
+ * @param reverse	State (at least one checkpoint)
+ * @param cpu		Simulator state
+ */
+static void reverse_restore(reverse_t* reverse, cpu_t* cpu) {
+	memory_t* memory = cpu->memory;
+	static const uint8_t zero[PAGE_SIZE];
+	const checkpoint_t* checkpoint = reverse_newest(reverse);
+	uint32_t stored = 0;
+	for(uint32_t index = 0; index < memory->size >> PAGE_BITS; index++) {
+		page_t* page = memory->pages[index];
+		if(page == NULL) continue;
+		const uint8_t* data;
+		if(stored < checkpoint->pages && checkpoint->index[stored] == index) data = &checkpoint->data[(size_t)(stored++) * PAGE_SIZE];
+		else data = (mem_image(memory, index) != NULL) ? mem_image(memory, index) : zero;
+		if(memcmp(page->data, data, PAGE_SIZE) == 0) continue;
+		memcpy(page->data, data, PAGE_SIZE);
+		if(page->code != NULL) {
+			for(uint32_t i = 0; i < PAGE_SLOTS; i++) page->code[i].handler = NULL;
+			page->version++;
+		}
+	}
+	cpu->pc = checkpoint->pc;
+	memcpy(cpu->x, checkpoint->x, sizeof(cpu->x));
+	cpu->csr = checkpoint->csr;
+	if(memory->devices != NULL) {
+		memory->devices->mtimecmp[cpu->hartid] = checkpoint->mtimecmp;
+		memory->devices->mtime_offset = checkpoint->mtime_offset;
+		memory->devices->msip[cpu->hartid] = checkpoint->msip;
+	}
+	cpu->instret = checkpoint->instret;
+	cpu->run = 1;
+	cpu->fault = 0;
+	cpu->exited = 0;
+	cpu->reserved = 0;
+	reverse->length = 0;
+	trap_update(cpu);
+}
+
+// Sampled simulation (fast-forward, then warmup and a measured window at the
+// end of every period, with the side channels attached only in detail)
+struct sample {
+	// Period, warmup and measured window (instructions)
+	uint64_t period;
+	uint64_t warmup;
+	uint64_t window;
+	// Side channels (detached while fast-forwarding)
+	uint8_t trace_mode;
+	timing_t* timing;
+	branch_unit_t* branches;
+	uint32_t profile;
+	// Measured windows, instructions run in detail and sums of the window CPI
+	// and mispredicts per instruction (and of their squares)
+	uint64_t windows;
+	uint64_t detailed;
+	double cpi;
+	double cpi2;
+	double mpi[PREDICTORS_MAX];
+	double mpi2[PREDICTORS_MAX];
+};
+
+/**
+ * Selects the engines' path (observe_step while any side channel is attached)
+ * @param cpu	Simulator state
+ */
+static inline void observe_update(cpu_t* cpu) {
+	cpu->observed = (cpu->trace_mode != TRACE_OFF || cpu->timing != NULL || cpu->branches != NULL || cpu->profile != 0 || cpu->snapshot != NULL || cpu->bbv != NULL || cpu->reverse != NULL);
+}
+
+/**
+ * Executes an instruction through the enabled side channels (profiler, undo
+ * log, trace output, branch predictors and timing model), on the engines' slow path
+ * @param cpu	Simulator state
+ * @param d		Decoded instruction
+ */
+static void observe_step(cpu_t* cpu, const decoded_t* d) {
+	const uint32_t pc = cpu->pc;
+	// Stopping at a debugger breakpoint before the side channels see it
+	if(d->op == OP_UNKNOWN && cpu->debug != NULL && debug_breakpoint(cpu->debug, pc)) {
+		d->handler(cpu, d);
+		return;
+	}
+	// Writing the pending snapshot before its instruction (then leaving the
+	// slow path unless other side channels need it)
+	if(cpu->snapshot != NULL && (cpu->instret == cpu->snapshot->at || pc == cpu->snapshot->pc)) {
+		snapshot_write(cpu, cpu->snapshot->file);
+		cpu->snapshot = NULL;
+		observe_update(cpu);
+	}
+	if(cpu->bbv != NULL) bbv_step(cpu->bbv, pc, d->op, cpu->instret);
+	// Counting in the decoded slot (shared by harts, the fetch fault one is read-only)
+	if(cpu->profile != 0 && d->op != OP_FETCH_FAULT) __atomic_fetch_add(&((decoded_t*)(d))->count, 1, __ATOMIC_RELAXED);
+	const uint32_t address = cpu->x[d->rs1] + d->imm;
+	if(cpu->reverse != NULL) reverse_record(cpu->reverse, cpu, d);
+	if(cpu->trace_mode != TRACE_OFF) trace_step(cpu, d);
+	else d->handler(cpu, d);
+	if(cpu->fault) {
+		// Faulting stores write nothing
+		if(cpu->reverse != NULL) cpu->reverse->log[cpu->reverse->length - 1].size = 0;
+		return;
+	}
+	// Handlers leave pc at the next instruction minus 4 (mispredicted
+	// conditional branches redirect the fetch when predictors are simulated)
+	int redirect = cpu->pc != pc + d->size - 4;
+	if(cpu->branches != NULL && d->op >= OP_BLT && d->op <= OP_BGEU) redirect = branch_record(cpu->branches, pc, pc + d->imm, redirect);
+	if(cpu->timing != NULL) timing_account(cpu->timing, d, pc, address, redirect);
+}
+
+// Fetch outside memory (raises a fault)
+static const decoded_t decoded_fetch_fault = { .handler = exec_fetch_fault, .op = OP_FETCH_FAULT, .size = 4, .dispatch = OP_FETCH_FAULT };
+
+/**
+ * Resolves a fetch through the instruction TLB, creating the page decoded
+ * instructions on its first fetch
+ * @param cpu	Simulator state
+ * @param pc	Instruction address
+ * @return		Returns the page, or NULL outside memory
+ */
+static page_t* code_page(cpu_t* cpu, uint32_t pc) {
+	tlb_entry_t* entry = &cpu->itlb[(pc >> PAGE_BITS) & (TLB_SIZE - 1)];
+	if(entry->tag != pc >> PAGE_BITS) {
+		page_t* page = mem_page(cpu->memory, pc);
+		if(page == NULL) return NULL;
+		if(__atomic_load_n(&page->code, __ATOMIC_ACQUIRE) == NULL) {
+			pthread_mutex_lock(&cpu->memory->lock);
+			if(page->code == NULL) __atomic_store_n(&page->code, (decoded_t*)(calloc(PAGE_SLOTS, sizeof(decoded_t))), __ATOMIC_RELEASE);
+			pthread_mutex_unlock(&cpu->memory->lock);
+		}
+		entry->tag = pc >> PAGE_BITS;
+		entry->page = page;
+	}
+	return entry->page;
+}
+
+/**
+ * Decodes the instruction at an offset of a page. The handler is published
+ * last, so harts that find it set also see the other fields.
+ * @param memory	Guest memory
+ * @param d			Decoded instruction slot
+ * @param page		Page
+ * @param offset	Instruction offset inside the page (2 byte aligned)
+ */
+static NOINLINE void code_decode(memory_t* memory, decoded_t* d, const page_t* page, uint32_t offset) {
+	decoded_t decoded;
+	// The last halfword only holds compressed instructions (fetches of
+	// crossing ones decode them apart)
+	uint32_t instruction = 0;
+	memcpy(&instruction, &page->data[offset], (offset + 4 <= PAGE_SIZE) ? 4 : 2);
+	decode(&decoded, instruction);
+	pthread_mutex_lock(&memory->lock);
+	d->instruction = decoded.instruction;
+	d->imm = decoded.imm;
+	d->rd = decoded.rd;
+	d->rs1 = decoded.rs1;
+	d->rs2 = decoded.rs2;
+	d->op = decoded.op;
+	d->size = decoded.size;
+	d->dispatch = decoded.dispatch;
+	__atomic_store_n(&d->handler, decoded.handler, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&memory->lock);
+}
+
+/**
+ * Retrieves the decoded instruction at an offset of a page, decoding it on
+ * first execution (or after being overwritten)
+ * @param memory	Guest memory
+ * @param page		Page
+ * @param offset	Instruction offset inside the page (2 byte aligned)
+ * @return			Returns the decoded instruction
+ */
+static inline decoded_t* code_decoded(memory_t* memory, page_t* page, uint32_t offset) {
+	decoded_t* d = &page->code[code_slot(offset)];
+	if(__atomic_load_n(&d->handler, __ATOMIC_ACQUIRE) == NULL) code_decode(memory, d, page, offset);
+	return d;
+}
+
+/**
+ * Fetches the decoded instruction at pc on a page change or first execution
+ * @param cpu	Simulator state
+ * @return		Returns the decoded instruction
+ */
+static NOINLINE const decoded_t* fetch_slow(cpu_t* cpu) {
+	const uint32_t pc = cpu->pc;
+	// Fetching outside memory halts the simulation
+	page_t* page = code_page(cpu, pc);
+	if(page == NULL) return &decoded_fetch_fault;
+	cpu->fetch_tag = pc & ~PAGE_MASK;
+	cpu->fetch_code = page->code;
+	// Decoding 32-bit instructions crossing into the next page on every fetch
+	// (their slot stays empty unless a debugger breakpoint is armed in it, so
+	// stores to either page need no invalidation)
+	if((pc & PAGE_MASK) == PAGE_SIZE - 2 && (page->data[PAGE_SIZE - 2] & 0b11) == 0b11 && __atomic_load_n(&page->code[code_slot(PAGE_SIZE - 2)].handler, __ATOMIC_ACQUIRE) == NULL) {
+		page_t* next = code_page(cpu, pc + 2);
+		if(next == NULL) return &decoded_fetch_fault;
+		decode(&cpu->straddle, page->data[PAGE_SIZE - 2] | (page->data[PAGE_SIZE - 1] << 8) | (next->data[0] << 16) | ((uint32_t)(next->data[1]) << 24));
+		return &cpu->straddle;
+	}
+	// Retrieving decoded instruction slot (2 byte alignment)
+	return code_decoded(cpu->memory, page, pc & PAGE_MASK);
+}
+
+/**
+ * Fetches the decoded instruction at pc, decoding it on first execution
+ * @param cpu	Simulator state
+ * @return		Returns the decoded instruction
+ */
+static inline const decoded_t* fetch(cpu_t* cpu) {
+	const uint32_t pc = cpu->pc;
+	// Fast path (same page as the last fetch, word aligned, already decoded)
+	if((pc & (~PAGE_MASK | 2)) == cpu->fetch_tag) {
+		const decoded_t* d = &cpu->fetch_code[(pc & PAGE_MASK) >> 2];
+		if(__atomic_load_n(&d->handler, __ATOMIC_ACQUIRE) != NULL) return d;
+	}
+	return fetch_slow(cpu);
+}
+
+/**
+ * Takes a pending interrupt once the hart reached its boundary after control
+ * flow (so every engine takes it at the same instruction), mepc being the
+ * next instruction
+ * @param cpu	Simulator state
+ */
+static NOINLINE void trap_boundary(cpu_t* cpu) {
+	const uint32_t cause = trap_update(cpu);
+	if(cpu->instret < cpu->interrupt_at) return;
+	// Undoing the previous instruction must also undo the trap
+	reverse_t* reverse = cpu->reverse;
+	if(reverse != NULL && reverse->length != 0) reverse->log[reverse->length - 1].barrier = 1;
+	const uint32_t pc = cpu->pc;
+	trap_enter(cpu, CAUSE_INTERRUPT | cause, 0, 0);
+	cpu->trapped = 0;
+	if(cpu->trace_mode != TRACE_OFF && trace_selected(cpu)) {
+		if(cpu->trace_merged) trace_prefix(cpu->trace, cpu->hartid);
+		trace_trap(cpu, pc, cpu->pc);
+	}
+}
+
+/**
+ * Executes the instruction at pc (without checking for interrupts)
+ * @param cpu	Simulator state
+ * @return		Returns the executed operation
+ */
+static inline uint8_t execute(cpu_t* cpu) {
+	// Executing instruction (tracing only when enabled)
+	const decoded_t* d = fetch(cpu);
+	const uint8_t op = d->op;
+	if(cpu->observed) observe_step(cpu, d);
+	else d->handler(cpu, d);
+	cpu->instret++;
+	// Incrementing pc by 4
+	cpu->pc = cpu->pc + 4;
+	return op;
+}
+
+/**
+ * Executes the instruction at pc, then takes a pending interrupt after
+ * control flow
+ * @param cpu	Simulator state
+ * @return		Returns the executed operation
+ */
+static inline uint8_t step(cpu_t* cpu) {
+	const uint8_t op = execute(cpu);
+	if(OP_CONTROL(op) && trap_due(cpu)) trap_boundary(cpu);
+	return op;
+}
+
+/**
+ * Runs the simulation calling the handler bound to each decoded instruction
+ * @param cpu	Simulator state
+ */
+static void run_interp(cpu_t* cpu) {
+	// Loop while condition is true (taking pending interrupts and returning at
+	// the limit after control flow)
+	while(cpu->run) {
+		const uint8_t op = execute(cpu);
+		if(OP_CONTROL(op) && trap_due(cpu)) {
+			trap_boundary(cpu);
+			if(cpu->instret >= cpu->limit) return;
+		}
+	}
+}
+
+/**
+ * Runs the simulation with threaded dispatch: each operation jumps straight
+ * into the next one through the label table (computed goto), or through a
+ * dense switch on the operation index when the compiler lacks it
+ * @param cpu	Simulator state
+ */
+static void run_threaded(cpu_t* cpu) {
+	const decoded_t* d = fetch(cpu);
+#if defined(__GNUC__)
+	// Label table, indexed by operation (compressed instructions last)
+	static void* const label[OP_COUNT + 1] = {
+#define X(name, handler) &&op_##name,
+		OP_LIST(X)
+#undef X
+		&&op_compressed
+	};
+	// Jumping to first operation
+	goto *label[d->dispatch];
+	// Only ebreak, unknown instructions (and illegal CSR accesses) and memory
+	// accesses (faults) can halt the simulation
+#define OP_MAY_HALT(op) ((op) == OP_EBREAK || ((op) >= OP_CSRRW && (op) <= OP_UNKNOWN) || (op) == OP_FETCH_FAULT || \
+	((op) >= OP_SW && (op) <= OP_AMOMAXU) || ((op) >= OP_LW && (op) <= OP_LR))
+#define X(name, handler) \
+	op_##name: \
+		if(cpu->observed) observe_step(cpu, d); \
+		else handler(cpu, d); \
+		cpu->instret++; \
+		cpu->pc = cpu->pc + 4; \
+		if(OP_MAY_HALT(OP_##name) && !cpu->run) return; \
+		if(OP_CONTROL(OP_##name) && trap_due(cpu)) { \
+			trap_boundary(cpu); \
+			if(cpu->instret >= cpu->limit) return; \
+		} \
+		d = fetch(cpu); \
+		goto *label[d->dispatch];
+	OP_LIST(X)
+#undef X
+#undef OP_MAY_HALT
+	// Compressed instructions run through their bound handler
+	op_compressed:
+		if(cpu->observed) observe_step(cpu, d);
+		else d->handler(cpu, d);
+		cpu->instret++;
+		cpu->pc = cpu->pc + 4;
+		if(!cpu->run) return;
+		if(OP_CONTROL(d->op) && trap_due(cpu)) {
+			trap_boundary(cpu);
+			if(cpu->instret >= cpu->limit) return;
+		}
+		d = fetch(cpu);
+		goto *label[d->dispatch];
+#else
+	while(cpu->run) {
+		// Compressed instructions run through their bound handler
+		if(d->size == 2 && !cpu->observed) d->handler(cpu, d);
+		else switch(d->op) {
+#define X(name, handler) case OP_##name: if(cpu->observed) observe_step(cpu, d); else handler(cpu, d); break;
+			OP_LIST(X)
+#undef X
+		}
+		cpu->instret++;
+		cpu->pc = cpu->pc + 4;
+		if(OP_CONTROL(d->op) && trap_due(cpu)) {
+			trap_boundary(cpu);
+			if(cpu->instret >= cpu->limit) return;
+		}
+		d = fetch(cpu);
+	}
+#endif
+}
+
+// Micro-op: a decoded instruction whose handler is bound to a closure that
+// knows its pc, possibly fused with the following instruction. The decoded
+// instruction comes first, so closures and handlers share a signature.
+typedef struct {
+	// Bound instruction (first one of fused pairs)
+	decoded_t d;
+	// Address of the first guest instruction
+	uint32_t pc;
+	// Precomputed value (jump target or constant result)
+	uint32_t target;
+	// Branch registers (branches and fused compare and branch pairs)
+	uint8_t b_rs1;
+	uint8_t b_rs2;
+	// Guest instructions (2 for fused pairs, 0 for the block exit)
+	uint8_t count;
+} uop_t;
+
+// Compiled block (returns NULL, or the micro-op that halted the simulation)
+typedef const uop_t* (*jit_code_t)(cpu_t* cpu);
+
+// Translated basic block (straight-line code up to a control flow instruction)
+struct block {
+	// First instruction address
+	uint32_t pc;
+	// Page code version the block was translated from
+	uint32_t version;
+	// Page holding the block
+	page_t* page;
+	// Guest instructions and micro-ops
+	uint32_t count;
+	uint32_t length;
+	// Decoded guest instructions (executed one by one when tracing)
+	decoded_t* insn;
+	// Micro-ops (the last one always sets pc)
+	uop_t* uops;
+	// Cached successors and their addresses
+	uint32_t next_pc[2];
+	block_t* next[2];
+	// Executions and machine code (jit engine, NULL until compiled)
+	uint32_t runs;
+	jit_code_t jit;
+	// Static costs (timing model)
+	timing_static_t timing;
+	// Complete executions (profiler, folded into the page decoded slots)
+	uint64_t executions;
+};
+
+// Micro-ops that need pc in the simulator state (faults and ebreak)
+#define SYNC_LIST(X) \
+	X(LW, exec_lw) X(LB, exec_lb) X(LH, exec_lh) X(LBU, exec_lbu) X(LHU, exec_lhu) X(LR, exec_lr) \
+	X(EBREAK, exec_ebreak)
+#define X(name, handler) \
+	static void uop_##name(cpu_t* cpu, const decoded_t* d) { \
+		const uint32_t address = cpu->x[d->rs1] + d->imm; \
+		cpu->pc = ((const uop_t*)d)->pc; \
+		handler(cpu, d); \
+		if(TIMING_DATA(OP_##name) && cpu->timing != NULL && !cpu->fault) timing_data(cpu->timing, address); \
+	}
+SYNC_LIST(X)
+#undef X
+
+// Stores and atomics (also leaving the block when its own code is overwritten)
+#define STORE_LIST(X) X(SW, exec_sw) X(SB, exec_sb) X(SH, exec_sh) \
+	X(SC, exec_sc) X(AMOSWAP, exec_amoswap) X(AMOADD, exec_amoadd) X(AMOXOR, exec_amoxor) \
+	X(AMOAND, exec_amoand) X(AMOOR, exec_amoor) X(AMOMIN, exec_amomin) X(AMOMAX, exec_amomax) \
+	X(AMOMINU, exec_amominu) X(AMOMAXU, exec_amomaxu)
+#define X(name, handler) \
+	static void uop_##name(cpu_t* cpu, const decoded_t* d) { \
+		const block_t* block = cpu->block; \
+		const uint32_t address = cpu->x[d->rs1] + d->imm; \
+		cpu->pc = ((const uop_t*)d)->pc; \
+		handler(cpu, d); \
+		if(cpu->timing != NULL && !cpu->fault) timing_data(cpu->timing, address); \
+		if(block->version != code_version(block->page)) cpu->run = 0; \
+	}
+STORE_LIST(X)
+#undef X
+
+// System operations (ending blocks, setting the next pc unless they halted:
+// CSR instructions read exact counters, traps and mret redirect)
+#define SYSTEM_LIST(X) X(CSRRW, exec_csr) X(CSRRS, exec_csr) X(CSRRC, exec_csr) \
+	X(CSRRWI, exec_csr) X(CSRRSI, exec_csr) X(CSRRCI, exec_csr) X(ECALL, exec_ecall) \
+	X(MRET, exec_mret) X(UNKNOWN, exec_unknown)
+#define X(name, handler) \
+	static void uop_##name(cpu_t* cpu, const decoded_t* d) { \
+		cpu->pc = ((const uop_t*)d)->pc; \
+		handler(cpu, d); \
+		if(cpu->run) cpu->pc = cpu->pc + 4; \
+	}
+SYSTEM_LIST(X)
+#undef X
+
+// auipc and fused lui + addi (precomputed result)
+static void uop_constant(cpu_t* cpu, const decoded_t* d) {
+	const uop_t* u = (const uop_t*)d;
+	if(d->rd != 0) cpu->x[d->rd] = u->target;
+}
+
+// jal
+static void uop_jal(cpu_t* cpu, const decoded_t* d) {
+	const uop_t* u = (const uop_t*)d;
+	if(d->rd != 0) cpu->x[d->rd] = u->pc + 4;
+	cpu->pc = u->target;
+}
+
+// jalr
+static void uop_jalr(cpu_t* cpu, const decoded_t* d) {
+	const uop_t* u = (const uop_t*)d;
+	const uint32_t target_address = (cpu->x[d->rs1] + d->imm) & ~1;
+	if(d->rd != 0) cpu->x[d->rd] = u->pc + 4;
+	cpu->pc = target_address;
+}
+
+// Branch with reserved funct3 (pc is kept)
+static void uop_branch_reserved(cpu_t* cpu, const decoded_t* d) {
+	cpu->pc = ((const uop_t*)d)->pc;
+}
+
+// Block exit without control flow (page boundary or longest block)
+static void uop_exit(cpu_t* cpu, const decoded_t* d) {
+	cpu->pc = ((const uop_t*)d)->target;
+}
+
+// Branches alone (first operation NOP) and fused with the preceding ALU
+// operation (executed first), with conditions on a = x[rs1] and b = x[rs2]
+#define FUSE_BRANCHES(X, first, handler) \
+	X(first, handler, BLT, (int32_t)a < (int32_t)b) X(first, handler, BNE, a != b) \
+	X(first, handler, BEQ, a == b) X(first, handler, BGE, (int32_t)a >= (int32_t)b) \
+	X(first, handler, BLTU, a < b) X(first, handler, BGEU, a >= b)
+#define FUSED_LIST(X) \
+	FUSE_BRANCHES(X, NOP, exec_nop) FUSE_BRANCHES(X, ADDI, exec_addi) \
+	FUSE_BRANCHES(X, SLTI, exec_slti) FUSE_BRANCHES(X, SLTIU, exec_sltiu) \
+	FUSE_BRANCHES(X, SLT, exec_slt) FUSE_BRANCHES(X, SLTU, exec_sltu)
+
+#define X(first, handler, branch, condition) \
+	static void uop_##first##_##branch(cpu_t* cpu, const decoded_t* d) { \
+		const uop_t* u = (const uop_t*)d; \
+		handler(cpu, d); \
+		const uint32_t a = cpu->x[u->b_rs1], b = cpu->x[u->b_rs2]; \
+		cpu->pc = (condition) ? u->target : u->pc + 4 * u->count; \
+	}
+FUSED_LIST(X)
+#undef X
+
+/**
+ * Retrieves the closure of a branch, alone or fused with the preceding operation
+ * @param first		Preceding operation (OP_NOP for a branch alone)
+ * @param branch	Branch operation
+ * @return			Returns the closure, or NULL when the pair cannot be fused
+ */
+static handler_t uop_branch(uint8_t first, uint8_t branch) {
+#define X(first_op, handler, branch_op, condition) if(first == OP_##first_op && branch == OP_##branch_op) return uop_##first_op##_##branch_op;
+	FUSED_LIST(X)
+#undef X
+	return NULL;
+}
+
+/**
+ * Folds the executions counted by a block (complete runs and counts of its
+ * instruction copies) into the page decoded slots
+ * @param block	Block
+ */
+static void block_profile(block_t* block) {
+	decoded_t* code = &block->page->code[code_slot(block->pc & PAGE_MASK)];
+	for(uint32_t i = 0; i < block->count; i++) {
+		const uint64_t executions = block->executions + block->insn[i].count;
+		if(executions != 0) __atomic_fetch_add(&code[i].count, executions, __ATOMIC_RELAXED);
+		block->insn[i].count = 0;
+	}
+	block->executions = 0;
+}
+
+/**
+ * Translates the instructions starting at the block address into micro-ops
+ * @param cpu	Simulator state
+ * @param block	Block (pc and page already set)
+ */
+static void block_translate(cpu_t* cpu, block_t* block) {
+	page_t* page = block->page;
+	// Reading the version first (stores during the translation retranslate it)
+	block->version = code_version(page);
+	// Collecting instructions up to control flow, a compressed instruction,
+	// the page end or BLOCK_MAX
+	decoded_t insn[BLOCK_MAX];
+	uint32_t count = 0;
+	if(cpu->profile != 0) block_profile(block);
+	for(uint32_t offset = block->pc & PAGE_MASK; offset < PAGE_SIZE && count < BLOCK_MAX; offset += 4) {
+		const decoded_t* d = code_decoded(cpu->memory, page, offset);
+		if(d->size != 4) break;
+		insn[count++] = *d;
+		if(OP_CONTROL(d->op)) break;
+	}
+	block->count = count;
+	// Blocks starting with a compressed instruction stay empty (executed one
+	// by one)
+	block->jit = NULL;
+	if(count == 0) {
+		block->length = 0;
+		return;
+	}
+	// Static costs (also while the sampler detached the timing model)
+	const timing_t* timing = (cpu->sample != NULL) ? cpu->sample->timing : cpu->timing;
+	if(timing != NULL) timing_static(timing, insn, count, &block->timing);
+	block->runs = 0;
+	block->insn = (decoded_t*)(realloc(block->insn, count * sizeof(decoded_t)));
+	memcpy(block->insn, insn, count * sizeof(decoded_t));
+	for(uint32_t i = 0; i < count; i++) block->insn[i].count = 0;
+	block->uops = (uop_t*)(realloc(block->uops, (count + 1) * sizeof(uop_t)));
+	// Binding closures (fusing pairs when possible)
+	uint32_t length = 0;
+	for(uint32_t i = 0; i < count; i++) {
+		const decoded_t* d = &insn[i];
+		const decoded_t* next = (i + 1 < count) ? &insn[i + 1] : NULL;
+		uop_t* u = &block->uops[length++];
+		u->d = *d;
+		u->pc = block->pc + 4 * i;
+		u->count = 1;
+		switch(d->op) {
+#define X(name, exec) case OP_##name: u->d.handler = uop_##name; break;
+			SYNC_LIST(X)
+			STORE_LIST(X)
+			SYSTEM_LIST(X)
+#undef X
+			case OP_AUIPC:
+				u->d.handler = uop_constant;
+				u->target = u->pc + d->imm;
+				break;
+			case OP_LUI:
+				// lui + addi on the same register (lui writes rd even when it is x0)
+				if(d->rd != 0 && next != NULL && next->op == OP_ADDI && next->rd == d->rd && next->rs1 == d->rd) {
+					u->d.handler = uop_constant;
+					u->target = d->imm + next->imm;
+					u->count = 2;
+					i++;
+				}
+				break;
+			case OP_JAL:
+				u->d.handler = uop_jal;
+				u->target = u->pc + d->imm;
+				break;
+			case OP_JALR:
+				u->d.handler = uop_jalr;
+				break;
+			case OP_BRANCH_RESERVED:
+				u->d.handler = uop_branch_reserved;
+				break;
+			default:
+				// Compare and branch pairs
+				if(next != NULL && uop_branch(d->op, next->op) != NULL) {
+					u->d.handler = uop_branch(d->op, next->op);
+					u->b_rs1 = next->rs1;
+					u->b_rs2 = next->rs2;
+					u->target = u->pc + 4 + next->imm;
+					u->count = 2;
+					i++;
+				} else if(uop_branch(OP_NOP, d->op) != NULL) {
+					u->d.handler = uop_branch(OP_NOP, d->op);
+					u->b_rs1 = d->rs1;
+					u->b_rs2 = d->rs2;
+					u->target = u->pc + d->imm;
+				}
+				break;
+		}
+	}
+	// Leaving through the next address when the block ends without control flow
+	if(!OP_CONTROL(insn[count - 1].op)) {
+		uop_t* u = &block->uops[length++];
+		u->d.handler = uop_exit;
+		u->pc = block->pc + 4 * count;
+		u->target = u->pc;
+		u->count = 0;
+	}
+	block->length = length;
+}
+
+/**
+ * Retrieves the block starting at pc, translating it when needed
+ * @param cpu	Simulator state
+ * @param pc	Block address
+ * @return		Returns the block, or NULL for unaligned or faulting fetches
+ */
+static block_t* block_lookup(cpu_t* cpu, uint32_t pc) {
+	if(pc & 3) return NULL;
+	page_t* page = code_page(cpu, pc);
+	if(page == NULL) return NULL;
+	// Retrieving the hart block slot (each hart translates its own blocks)
+	if(cpu->blocks == NULL) cpu->blocks = (block_t***)(calloc(cpu->memory->size >> PAGE_BITS, sizeof(block_t**)));
+	block_t*** blocks = &cpu->blocks[(pc - cpu->memory->base) >> PAGE_BITS];
+	if(*blocks == NULL) *blocks = (block_t**)(calloc(PAGE_SIZE / 4, sizeof(block_t*)));
+	block_t** slot = &(*blocks)[(pc & PAGE_MASK) >> 2];
+	if(*slot == NULL) {
+		*slot = (block_t*)(calloc(1, sizeof(block_t)));
+		(*slot)->pc = pc;
+		(*slot)->page = page;
+		block_translate(cpu, *slot);
+	}
+	return *slot;
+}
+
+/**
+ * Rebuilds pc and instret after a micro-op halted the simulation inside a
+ * block (only micro-ops that need pc can halt it)
+ * @param cpu	Simulator state
+ * @param block	Block
+ * @param u		Halting micro-op
+ */
+static void block_halt(cpu_t* cpu, const block_t* block, const uop_t* u) {
+	// A debugger breakpoint stops before its instruction (exec_unknown left pc
+	// before it and uncounted it)
+	const uint32_t stopped = (cpu->pc != u->pc);
+	const uint32_t executed = ((u->pc - block->pc) >> 2) + 1 - stopped;
+	cpu->instret += executed + stopped;
+	if(cpu->bbv != NULL) bbv_count(cpu->bbv, block->pc, cpu->instret - executed, executed);
+	if(cpu->profile != 0) {
+		for(uint32_t i = 0; i < executed; i++) block->insn[i].count++;
+	}
+	// Accounting the executed prefix (without the faulting instruction)
+	if(cpu->timing != NULL && executed - cpu->fault > 0) {
+		timing_static_t costs;
+		timing_static(cpu->timing, block->insn, executed - cpu->fault, &costs);
+		timing_run(cpu->timing, block->insn, block->pc, executed - cpu->fault, &costs, 0);
+	}
+	cpu->pc = cpu->pc + 4;
+	// Stores (and atomics) overwriting the block continue at the next
+	// instruction (unless a debugger watchpoint or the halt register stopped them)
+	if(!cpu->fault && !cpu->exited && u->d.op >= OP_SW && u->d.op <= OP_AMOMAXU && (cpu->debug == NULL || cpu->debug->stop == DEBUG_NONE)) cpu->run = 1;
+}
+
+/**
+ * Accounts a completely executed block (profiler, branch predictors and
+ * timing model)
+ * @param cpu	Simulator state (pc at the successor)
+ * @param block	Block
+ */
+static inline void block_account(cpu_t* cpu, block_t* block) {
+	if(cpu->profile != 0) block->executions++;
+	if(cpu->bbv != NULL) bbv_count(cpu->bbv, block->pc, cpu->instret - block->count, block->count);
+	int redirect = cpu->pc != block->pc + 4 * block->count;
+	// Conditional branches only end blocks
+	const decoded_t* last = &block->insn[block->count - 1];
+	if(cpu->branches != NULL && last->op >= OP_BLT && last->op <= OP_BGEU) {
+		const uint32_t pc = block->pc + 4 * (block->count - 1);
+		redirect = branch_record(cpu->branches, pc, pc + last->imm, redirect);
+	}
+	if(cpu->timing != NULL) timing_run(cpu->timing, block->insn, block->pc, block->count, &block->timing, redirect);
+}
+
+/**
+ * Executes a block micro-op by micro-op
+ * @param cpu	Simulator state
+ * @param block	Block
+ */
+static void block_execute(cpu_t* cpu, block_t* block) {
+	const uop_t* const end = block->uops + block->length;
+	for(const uop_t* u = block->uops; u < end; u++) {
+		u->d.handler(cpu, &u->d);
+		if(!cpu->run) {
+			block_halt(cpu, block, u);
+			return;
+		}
+	}
+	cpu->instret += block->count;
+	block_account(cpu, block);
+}
+
+/**
+ * Executes a block instruction by instruction through the side channels
+ * (trace output and timing model)
+ * @param cpu	Simulator state
+ * @param block	Block
+ */
+static void block_observe(cpu_t* cpu, const block_t* block) {
+	for(uint32_t i = 0; i < block->count && cpu->run; i++) {
+		observe_step(cpu, &block->insn[i]);
+		cpu->instret++;
+		cpu->pc = cpu->pc + 4;
+		// Leaving the block when its own code is overwritten
+		if(block->version != code_version(block->page)) return;
+	}
+}
+
+#if defined(__x86_64__)
+// Machine code buffer size (blocks are no longer compiled when it is full)
+#define JIT_BUFFER_SIZE (16 << 20)
+// Longest machine code of a guest instruction (bytes)
+#define JIT_INSN_MAX 64
+// Block executions before compiling
+#define JIT_THRESHOLD 16
+
+
+// Host registers (guest registers live in the simulator state, pointed by rbx)
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3 };
+
+// Simulator state displacements
+#define JIT_X(r) ((uint32_t)(offsetof(cpu_t, x) + 4 * (r)))
+#define JIT_PC ((uint32_t)offsetof(cpu_t, pc))
+#define JIT_RUN ((uint32_t)offsetof(cpu_t, run))
+#define JIT_HARTID ((uint32_t)offsetof(cpu_t, hartid))
+
+// Appends bytes
+#define EMIT(p, ...) do { static const uint8_t bytes[] = { __VA_ARGS__ }; memcpy((p), bytes, sizeof(bytes)); (p) += sizeof(bytes); } while(0)
+
+/**
+ * Appends a 32-bit little endian value
+ * @param p		Write position
+ * @param value	Value
+ * @return		Returns the new write position
+ */
+static inline uint8_t* emit_u32(uint8_t* p, uint32_t value) {
+	memcpy(p, &value, 4);
+	return p + 4;
+}
+
+/**
+ * Appends a 64-bit little endian value
+ * @param p		Write position
+ * @param value	Value
+ * @return		Returns the new write position
+ */
+static inline uint8_t* emit_u64(uint8_t* p, uint64_t value) {
+	memcpy(p, &value, 8);
+	return p + 8;
+}
+
+/**
+ * Appends an instruction with a [rbx + disp32] operand
+ * @param p			Write position
+ * @param opcode	Opcode (0x0F prefixed opcodes as 0x0Fxx)
+ * @param reg		ModRM reg field (register or opcode extension)
+ * @param disp		Displacement
+ * @return			Returns the new write position
+ */
+static inline uint8_t* emit_rbx(uint8_t* p, uint16_t opcode, int reg, uint32_t disp) {
+	if(opcode > 0xFF) *p++ = opcode >> 8;
+	*p++ = (uint8_t)opcode;
+	*p++ = 0x80 | (reg << 3) | RBX;
+	return emit_u32(p, disp);
+}
+
+// Loads and stores of guest registers, ALU operations with a guest register
+#define emit_load(p, reg, r) emit_rbx((p), 0x8B, (reg), JIT_X(r))
+#define emit_store(p, reg, r) emit_rbx((p), 0x89, (reg), JIT_X(r))
+#define emit_alu(p, opcode, reg, r) emit_rbx((p), (opcode), (reg), JIT_X(r))
+
+/**
+ * Appends "mov dword [rbx + disp], imm32"
+ * @param p		Write position
+ * @param disp	Displacement
+ * @param value	Immediate
+ * @return		Returns the new write position
+ */
+static inline uint8_t* emit_store_imm(uint8_t* p, uint32_t disp, uint32_t value) {
+	p = emit_rbx(p, 0xC7, 0, disp);
+	return emit_u32(p, value);
+}
+
+/**
+ * Appends an ALU operation on eax with an immediate ("81 /n eax, imm32")
+ * @param p			Write position
+ * @param extension	Opcode extension (0 add, 1 or, 4 and, 6 xor, 7 cmp)
+ * @param value		Immediate
+ * @return			Returns the new write position
+ */
+static inline uint8_t* emit_alu_imm(uint8_t* p, int extension, uint32_t value) {
+	*p++ = 0x81;
+	*p++ = 0xC0 | (extension << 3) | RAX;
+	return emit_u32(p, value);
+}
+
+/**
+ * Appends the block exit: sets pc and returns NULL (no halting micro-op)
+ * @param p		Write position
+ * @param pc	Next pc
+ * @return		Returns the new write position
+ */
+static inline uint8_t* emit_exit(uint8_t* p, uint32_t pc) {
+	p = emit_store_imm(p, JIT_PC, pc);
+	// xor eax, eax; pop rbx; ret
+	EMIT(p, 0x31, 0xC0, 0x5B, 0xC3);
+	return p;
+}
+
+/**
+ * Appends the comparison "eax <cc> x[rs2]" leaving 0 or 1 in x[rd]
+ * @param p		Write position
+ * @param setcc	Second byte of the setcc opcode (0x9C setl, 0x92 setb)
+ * @param rd	Destination register
+ * @return		Returns the new write position
+ */
+static inline uint8_t* emit_compare(uint8_t* p, uint8_t setcc, uint8_t rd) {
+	*p++ = 0x0F;
+	*p++ = setcc;
+	// setcc al; movzx eax, al
+	*p++ = 0xC0;
+	EMIT(p, 0x0F, 0xB6, 0xC0);
+	return emit_store(p, RAX, rd);
+}
+
+/**
+ * Compiles a guest instruction that needs no simulator call
+ * @param p		Write position
+ * @param d		Decoded instruction
+ * @param pc	Instruction address
+ * @return		Returns the new write position
+ */
+static uint8_t* jit_insn(uint8_t* p, const decoded_t* d, uint32_t pc) {
+	const uint8_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+	const uint32_t imm = d->imm;
+	uint8_t* skip;
+	// Handlers writing rd without checking for x[0] are compiled the same way
+	switch(d->op) {
+		case OP_ADDI:
+		case OP_XORI:
+		case OP_ANDI:
+		case OP_SLLI:
+			if(rd == 0) break;
+			p = emit_load(p, RAX, rs1);
+			if(d->op == OP_ADDI) p = emit_alu_imm(p, 0, imm);
+			if(d->op == OP_XORI) p = emit_alu_imm(p, 6, imm);
+			if(d->op == OP_ANDI) p = emit_alu_imm(p, 4, imm);
+			// shl eax, imm8
+			if(d->op == OP_SLLI) *p++ = 0xC1, *p++ = 0xE0, *p++ = (uint8_t)imm;
+			p = emit_store(p, RAX, rd);
+			break;
+		case OP_ORI:
+			if(rd == 0) break;
+			if(rs1 == 0) {
+				p = emit_store_imm(p, JIT_X(rd), imm);
+				break;
+			}
+			p = emit_load(p, RAX, rs1);
+			p = emit_alu_imm(p, 1, imm);
+			p = emit_store(p, RAX, rd);
+			break;
+		case OP_SRLI:
+		case OP_SRAI:
+			p = emit_load(p, RAX, rs1);
+			// shr/sar eax, imm8
+			*p++ = 0xC1, *p++ = (d->op == OP_SRLI) ? 0xE8 : 0xF8, *p++ = (uint8_t)imm;
+			p = emit_store(p, RAX, rd);
+			break;
+		case OP_SLTIU:
+		case OP_SLTI:
+			p = emit_load(p, RAX, rs1);
+			p = emit_alu_imm(p, 7, imm);
+			p = emit_compare(p, (d->op == OP_SLTI) ? 0x9C : 0x92, rd);
+			break;
+		case OP_AUIPC:
+			if(rd != 0) p = emit_store_imm(p, JIT_X(rd), pc + imm);
+			break;
+		case OP_LUI:
+			p = emit_store_imm(p, JIT_X(rd), imm);
+			break;
+		case OP_MHARTID:
+			if(rd == 0) break;
+			p = emit_rbx(p, 0x8B, RAX, JIT_HARTID);
+			p = emit_store(p, RAX, rd);
+			break;
+		case OP_ADD:
+		case OP_SUB:
+		case OP_XOR:
+			if(rd == 0) break;
+			p = emit_load(p, RAX, rs1);
+			if(rs2 != 0) p = emit_alu(p, (d->op == OP_ADD) ? 0x03 : (d->op == OP_SUB) ? 0x2B : 0x33, RAX, rs2);
+			p = emit_store(p, RAX, rd);
+			break;
+		case OP_OR:
+			if(rd == 0) break;
+			// A zero operand yields only the other register
+			p = emit_load(p, RAX, (rs1 == 0) ? rs2 : rs1);
+			if(rs1 != 0 && rs2 != 0) p = emit_alu(p, 0x0B, RAX, rs2);
+			p = emit_store(p, RAX, rd);
+			break;
+		case OP_AND:
+			if(rd == 0) break;
+			if(rs1 == 0 || rs2 == 0) {
+				p = emit_store_imm(p, JIT_X(rd), 0);
+				break;
+			}
+			p = emit_load(p, RAX, rs1);
+			p = emit_alu(p, 0x23, RAX, rs2);
+			p = emit_store(p, RAX, rd);
+			break;
+		case OP_SLL:
+		case OP_SRL:
+		case OP_SRA:
+			p = emit_load(p, RAX, rs1);
+			p = emit_load(p, RCX, rs2);
+			// shl/shr/sar eax, cl (the count is masked to 5 bits)
+			*p++ = 0xD3, *p++ = (d->op == OP_SLL) ? 0xE0 : (d->op == OP_SRL) ? 0xE8 : 0xF8;
+			p = emit_store(p, RAX, rd);
+			break;
+		case OP_SLT:
+		case OP_SLTU:
+			if(rd == 0) break;
+			// rs1 == zero compares against 0
+			if(rs1 == 0) EMIT(p, 0x31, 0xC0);
+			else p = emit_load(p, RAX, rs1);
+			p = emit_alu(p, 0x3B, RAX, rs2);
+			p = emit_compare(p, (d->op == OP_SLT) ? 0x9C : 0x92, rd);
+			break;
+		case OP_MUL:
+			p = emit_load(p, RAX, rs1);
+			p = emit_alu(p, 0x0FAF, RAX, rs2);
+			p = emit_store(p, RAX, rd);
+			break;
+		case OP_MULH:
+		case OP_MULHU:
+			// imul/mul dword [rs2] (high half in edx)
+			p = emit_load(p, RAX, rs1);
+			p = emit_rbx(p, 0xF7, (d->op == OP_MULH) ? 5 : 4, JIT_X(rs2));
+			p = emit_store(p, RDX, rd);
+			break;
+		case OP_MULHSU:
+			// movsxd rax, [rs1]; mov ecx, [rs2]; imul rax, rcx; shr rax, 32
+			*p++ = 0x48;
+			p = emit_rbx(p, 0x63, RAX, JIT_X(rs1));
+			p = emit_load(p, RCX, rs2);
+			EMIT(p, 0x48, 0x0F, 0xAF, 0xC1, 0x48, 0xC1, 0xE8, 0x20);
+			p = emit_store(p, RAX, rd);
+			break;
+		case OP_DIV:
+		case OP_DIVU:
+		case OP_REM:
+		case OP_REMU:
+			// Signed operands are sign-extended (a 64-bit division cannot overflow)
+			if(d->op == OP_DIV || d->op == OP_REM) {
+				// movsxd rcx, [rs2]; movsxd rax, [rs1]
+				*p++ = 0x48;
+				p = emit_rbx(p, 0x63, RCX, JIT_X(rs2));
+				*p++ = 0x48;
+				p = emit_rbx(p, 0x63, RAX, JIT_X(rs1));
+			} else {
+				p = emit_load(p, RCX, rs2);
+				p = emit_load(p, RAX, rs1);
+			}
+			// test ecx, ecx; jz skip (division by zero)
+			EMIT(p, 0x85, 0xC9, 0x74, 0x00);
+			skip = p;
+			// cqo; idiv rcx or xor edx, edx; div ecx
+			if(d->op == OP_DIV || d->op == OP_REM) EMIT(p, 0x48, 0x99, 0x48, 0xF7, 0xF9);
+			else EMIT(p, 0x31, 0xD2, 0xF7, 0xF1);
+			if(d->op == OP_DIV || d->op == OP_DIVU) {
+				// div/divu by zero leave rd unchanged
+				p = emit_store(p, RAX, rd);
+				skip[-1] = (uint8_t)(p - skip);
+			} else {
+				// rem/remu by zero yield the dividend (mov eax, edx otherwise)
+				EMIT(p, 0x89, 0xD0);
+				skip[-1] = (uint8_t)(p - skip);
+				p = emit_store(p, RAX, rd);
+			}
+			break;
+		case OP_BLT:
+		case OP_BNE:
+		case OP_BEQ:
+		case OP_BGE:
+		case OP_BLTU:
+		case OP_BGEU:
+			{
+				static const uint8_t jcc[OP_COUNT] = { [OP_BLT] = 0x8C, [OP_BNE] = 0x85, [OP_BEQ] = 0x84, [OP_BGE] = 0x8D, [OP_BLTU] = 0x82, [OP_BGEU] = 0x83 };
+				p = emit_load(p, RAX, rs1);
+				p = emit_alu(p, 0x3B, RAX, rs2);
+				*p++ = 0x0F;
+				*p++ = jcc[d->op];
+				p = emit_u32(p, 0);
+				uint8_t* const taken = p;
+				p = emit_exit(p, pc + 4);
+				emit_u32(taken - 4, (uint32_t)(p - taken));
+				p = emit_exit(p, pc + imm);
+			}
+			break;
+		case OP_BRANCH_RESERVED:
+			p = emit_exit(p, pc);
+			break;
+		case OP_JAL:
+			if(rd != 0) p = emit_store_imm(p, JIT_X(rd), pc + 4);
+			p = emit_exit(p, pc + imm);
+			break;
+		case OP_JALR:
+			p = emit_load(p, RAX, rs1);
+			p = emit_alu_imm(p, 0, imm);
+			p = emit_alu_imm(p, 4, ~1u);
+			if(rd != 0) p = emit_store_imm(p, JIT_X(rd), pc + 4);
+			p = emit_rbx(p, 0x89, RAX, JIT_PC);
+			EMIT(p, 0x31, 0xC0, 0x5B, 0xC3);
+			break;
+		default:
+			break;
+	}
+	return p;
+}
+
+/**
+ * Checks whether a micro-op runs through its closure (loads, stores, ebreak
+ * and system operations, which need pc and may halt the simulation)
+ * @param u		Micro-op
+ * @return		Returns 1 if the compiled code must call the closure
+ */
+static int jit_calls(const uop_t* u) {
+	switch(u->d.op) {
+#define X(name, exec) case OP_##name:
+		SYNC_LIST(X)
+		STORE_LIST(X)
+		SYSTEM_LIST(X)
+#undef X
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/**
+ * Compiles a block into machine code returning NULL, or the halting micro-op
+ * @param cpu	Simulator state (owner of the machine code buffer)
+ * @param block	Block
+ */
+static void jit_compile(cpu_t* cpu, block_t* block) {
+	jit_buffer_t* jit = &cpu->jit;
+	// Mapping the buffer on first use (compiling nothing when it cannot be mapped)
+	if(jit->code == NULL && !jit->failed) {
+		void* code = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(code == MAP_FAILED) jit->failed = 1;
+		else jit->code = (uint8_t*)(code);
+	}
+	if(jit->code == NULL || jit->used + (block->count + 1) * JIT_INSN_MAX > JIT_BUFFER_SIZE) return;
+	uint8_t* const start = jit->code + jit->used;
+	uint8_t* p = start;
+	// push rbx; mov rbx, rdi (simulator state)
+	EMIT(p, 0x53, 0x48, 0x89, 0xFB);
+	const decoded_t* insn = block->insn;
+	for(uint32_t i = 0; i < block->length; i++) {
+		const uop_t* u = &block->uops[i];
+		if(jit_calls(u)) {
+			// mov rdi, rbx; mov rsi, u; mov rax, closure; call rax
+			EMIT(p, 0x48, 0x89, 0xDF, 0x48, 0xBE);
+			p = emit_u64(p, (uintptr_t)u);
+			EMIT(p, 0x48, 0xB8);
+			p = emit_u64(p, (uintptr_t)u->d.handler);
+			EMIT(p, 0xFF, 0xD0);
+			// cmp byte [rbx + run], 0; jne continue
+			p = emit_rbx(p, 0x80, 7, JIT_RUN);
+			EMIT(p, 0x00, 0x75, 0x0C);
+			// mov rax, u; pop rbx; ret (halted)
+			EMIT(p, 0x48, 0xB8);
+			p = emit_u64(p, (uintptr_t)u);
+			EMIT(p, 0x5B, 0xC3);
+			// xor eax, eax; pop rbx; ret (system operations set pc and end the block)
+			if(u->d.op >= OP_CSRRW && u->d.op <= OP_UNKNOWN) EMIT(p, 0x31, 0xC0, 0x5B, 0xC3);
+		} else if(u->count == 0) {
+			p = emit_exit(p, u->target);
+		} else {
+			for(uint32_t j = 0; j < u->count; j++) p = jit_insn(p, &insn[j], u->pc + 4 * j);
+		}
+		insn += u->count;
+	}
+	jit->used += p - start;
+	block->jit = (jit_code_t)(start);
+}
+#endif
+
+/**
+ * Runs the simulation block by block, following cached successors
+ * @param cpu	Simulator state
+ * @param jit	Compile hot blocks to machine code (when not tracing)
+ */
+static void run_blocks(cpu_t* cpu, int jit) {
+	block_t* block = NULL;
+	while(cpu->run) {
+		// Taking pending interrupts and returning at the limit after control
+		// flow (blocks end with it)
+		if(block != NULL && trap_due(cpu) && OP_CONTROL(block->insn[block->count - 1].op)) {
+			trap_boundary(cpu);
+			if(cpu->instret >= cpu->limit) return;
+		}
+		const uint32_t pc = cpu->pc;
+		// Following cached successors (looking the block up otherwise)
+		block_t* next;
+		if(block != NULL && block->next_pc[0] == pc && block->next[0] != NULL) next = block->next[0];
+		else if(block != NULL && block->next_pc[1] == pc && block->next[1] != NULL) next = block->next[1];
+		else {
+			next = block_lookup(cpu, pc);
+			if(block != NULL && next != NULL) {
+				const int slot = (block->next[0] != NULL);
+				block->next_pc[slot] = pc;
+				block->next[slot] = next;
+			}
+		}
+		// Translating again blocks whose code was overwritten
+		if(next != NULL && next->version != code_version(next->page)) block_translate(cpu, next);
+		// Executing unaligned, compressed and faulting fetches one by one
+		if(next == NULL || next->count == 0) {
+			step(cpu);
+			block = NULL;
+			continue;
+		}
+		block = next;
+		cpu->block = block;
+		// Observing trace output, the undo log and the block reaching a pending
+		// snapshot instruction by instruction (the timing model, branch
+		// predictors and profiler alone account whole blocks)
+		if(cpu->trace_mode != TRACE_OFF || cpu->reverse != NULL || (cpu->snapshot != NULL && (cpu->snapshot->at - cpu->instret < block->count || cpu->snapshot->pc - block->pc < 4 * block->count))) {
+			block_observe(cpu, block);
+			continue;
+		}
+		// Executing by micro-ops (instructions counted at the block end)
+		cpu->block_pc = block->pc;
+#if defined(__x86_64__)
+		// Compiling hot blocks, running compiled ones
+		if(jit && block->jit == NULL && ++block->runs == JIT_THRESHOLD) jit_compile(cpu, block);
+		if(block->jit != NULL) {
+			const uop_t* halted = block->jit(cpu);
+			cpu->block_pc = TLB_INVALID;
+			if(halted != NULL) {
+				block_halt(cpu, block, halted);
+			} else {
+				cpu->instret += block->count;
+				block_account(cpu, block);
+			}
+			continue;
+		}
+#endif
+		block_execute(cpu, block);
+		cpu->block_pc = TLB_INVALID;
+	}
+}
+
+/**
+ * Runs the simulation block by block
+ * @param cpu	Simulator state
+ */
+static void run_block(cpu_t* cpu) {
+	run_blocks(cpu, 0);
+}
+
+/**
+ * Runs the simulation block by block, compiling hot blocks to x86-64 machine
+ * code (the block engine elsewhere)
+ * @param cpu	Simulator state
+ */
+static void run_jit(cpu_t* cpu) {
+	run_blocks(cpu, 1);
+}
+
+/**
+ * Executes again up to an instruction count with the side channels detached
+ * (their instructions were already traced and accounted), logging undo
+ * entries and taking checkpoints as the first execution did
+ * @param cpu		Simulator state
+ * @param target	Instruction count (stops earlier when the hart halts)
+ */
+static void reverse_replay(cpu_t* cpu, uint64_t target) {
+	const uint8_t trace_mode = cpu->trace_mode;
+	timing_t* timing = cpu->timing;
+	branch_unit_t* branches = cpu->branches;
+	const uint32_t profile = cpu->profile;
+	bbv_t* bbv = cpu->bbv;
+	const snapshot_point_t* snapshot = cpu->snapshot;
+	cpu->trace_mode = TRACE_OFF;
+	cpu->timing = NULL;
+	cpu->branches = NULL;
+	cpu->profile = 0;
+	cpu->bbv = NULL;
+	cpu->snapshot = NULL;
+	cpu->muted = 1;
+	observe_update(cpu);
+	while(cpu->run && cpu->instret < target) step(cpu);
+	cpu->muted = 0;
+	cpu->trace_mode = trace_mode;
+	cpu->timing = timing;
+	cpu->branches = branches;
+	cpu->profile = profile;
+	cpu->bbv = bbv;
+	cpu->snapshot = snapshot;
+	observe_update(cpu);
+}
+
+/**
+ * Moves the hart to the state before the target-th instruction: back through
+ * the undo log, or from the closest checkpoint executing forward when nearer
+ * (checkpoints after the target are dropped), and forward by executing
+ * @param cpu		Simulator state
+ * @param target	Instruction count
+ * @return			Returns 0 on success, 1 when the target is before the
+ *					oldest checkpoint or after the hart halts
+ */
+static int reverse_goto(cpu_t* cpu, uint64_t target) {
+	reverse_t* reverse = cpu->reverse;
+	if(cpu->instret > target && reverse->count != 0) {
+		const uint32_t count = reverse->count;
+		while(reverse->count > 1 && reverse_newest(reverse)->instret > target) reverse->count--;
+		const uint64_t newest = reverse_newest(reverse)->instret;
+		if(reverse->count != count || target < newest || cpu->instret - target > target - newest) reverse_restore(reverse, cpu);
+		while(cpu->instret > target && reverse->length != 0 && !reverse->log[reverse->length - 1].barrier) reverse_undo(reverse, cpu);
+		// Executing forward from the checkpoint past state the log cannot restore
+		if(cpu->instret > target) reverse_restore(reverse, cpu);
+	}
+	reverse_replay(cpu, target);
+	return cpu->instret != target;
+}
+
+/**
+ * Retrieves the undo entry of the previous instruction, executing the previous
+ * interval again from its checkpoint when the log is empty
+ * @param cpu	Simulator state
+ * @return		Returns the entry, or NULL at the oldest checkpoint
+ */
+static const undo_entry_t* reverse_previous(cpu_t* cpu) {
+	reverse_t* reverse = cpu->reverse;
+	if(reverse->length == 0) {
+		if(reverse->count <= 1) return NULL;
+		const uint64_t end = cpu->instret;
+		reverse->count--;
+		reverse_restore(reverse, cpu);
+		reverse_replay(cpu, end);
+	}
+	return &reverse->log[reverse->length - 1];
+}
+
+/**
+ * Moves the hart back before the previous instruction (executing again from
+ * the checkpoint up to it when its entry is a barrier)
+ * @param cpu	Simulator state (non-empty undo log)
+ */
+static void reverse_back(cpu_t* cpu) {
+	reverse_t* reverse = cpu->reverse;
+	if(!reverse->log[reverse->length - 1].barrier) {
+		reverse_undo(reverse, cpu);
+		return;
+	}
+	const uint64_t target = cpu->instret - 1;
+	reverse_restore(reverse, cpu);
+	reverse_replay(cpu, target);
+}
+
+/**
+ * Moves the hart back to the last store (or atomic) writing a byte, leaving
+ * it before that instruction
+ * @param cpu		Simulator state
+ * @param address	Guest address
+ * @return			Returns 1 when found, 0 otherwise (hart back where it started)
+ */
+static int reverse_last_write(cpu_t* cpu, uint32_t address) {
+	const uint64_t instret = cpu->instret;
+	const undo_entry_t* entry;
+	while((entry = reverse_previous(cpu)) != NULL) {
+		const int found = address - entry->address < entry->size;
+		reverse_back(cpu);
+		if(found) return 1;
+	}
+	reverse_goto(cpu, instret);
+	return 0;
+}
+
+/**
+ * Outputs the reverse execution window to the console (oldest reachable
+ * instruction and memory held by checkpoints and the undo log)
+ * @param reverse	State
+ */
+static void reverse_report(const reverse_t* reverse) {
+	uint64_t bytes = reverse->interval * sizeof(undo_entry_t);
+	for(uint32_t i = 0; i < reverse->capacity; i++) bytes += (uint64_t)(reverse->checkpoints[i].pages) * PAGE_SIZE;
+	const uint64_t oldest = (reverse->count != 0) ? reverse->checkpoints[reverse->first].instret : 0;
+	printf("reverse checkpoints=%u/%u interval=%llu oldest=%llu log=%llu memory=%llu KiB\n", reverse->count, reverse->capacity,
+		(unsigned long long)reverse->interval, (unsigned long long)oldest, (unsigned long long)reverse->length, (unsigned long long)(bytes / 1024));
+}
+
+/**
+ * Estimates a per-instruction metric from the measured windows: mean and
+ * half width of its 95% confidence interval (normal approximation)
+ * @param sum		Sum of the window values
+ * @param squares	Sum of their squares
+ * @param n			Number of windows (at least 2)
+ * @param half		Half width of the interval
+ * @return			Returns the mean
+ */
+static double sample_estimate(double sum, double squares, double n, double* half) {
+	const double mean = sum / n;
+	const double variance = (squares - n * mean * mean) / (n - 1);
+	// Standard error by Newton iterations (keeping the build free of libm)
+	const double error = (variance > 0) ? variance / n : 0.0;
+	double root = (error > 1) ? error : 1.0;
+	for(uint32_t i = 0; i < 64 && error > 0; i++) root = (root + error / root) / 2;
+	*half = (error > 0) ? 1.96 * root : 0.0;
+	return mean;
+}
+
+/**
+ * Outputs the sampled simulation estimates to the console: totals
+ * extrapolated from the mean of the measured windows over all executed
+ * instructions, with 95% confidence intervals
+ * @param cpu	Simulator state
+ */
+static void sample_report(const cpu_t* cpu) {
+	const sample_t* sample = cpu->sample;
+	const double instret = cpu->instret;
+	printf("sample period=%llu warmup=%llu window=%llu windows=%llu detailed=%llu (%.2f%%)\n", (unsigned long long)sample->period, (unsigned long long)sample->warmup,
+		(unsigned long long)sample->window, (unsigned long long)sample->windows, (unsigned long long)sample->detailed, instret > 0 ? 100.0 * sample->detailed / instret : 0.0);
+	if(sample->windows < 2) return;
+	double half;
+	const double cpi = sample_estimate(sample->cpi, sample->cpi2, sample->windows, &half);
+	printf("sample cycles=%.0f +-%.0f cpi=%.4f +-%.4f\n", cpi * instret, half * instret, cpi, half);
+	for(uint32_t i = 0; sample->branches != NULL && i < sample->branches->count; i++) {
+		char label[32];
+		const double mpi = sample_estimate(sample->mpi[i], sample->mpi2[i], sample->windows, &half);
+		printf("sample bpred=%s mispredicts=%.0f +-%.0f mpki=%.3f +-%.3f\n", branch_label(&sample->branches->config[i], label, sizeof(label)),
+			mpi * instret, half * instret, 1000 * mpi, 1000 * half);
+	}
+}
+
+/**
+ * Outputs the final registers and the emulation throughput to the console
+ * @param harts		Simulator state of each hart
+ * @param count		Number of harts
+ * @param seconds	Wall time spent running the engine
+ */
+static void print_summary(cpu_t* const* harts, uint32_t count, double seconds) {
+	const memory_t* memory = harts[0]->memory;
+	uint64_t instret = 0;
+	for(uint32_t k = 0; k < count; k++) instret += harts[k]->instret;
+	// Outputting executed instructions and throughput (of all harts together)
+	if(count == 1) printf("pc=0x%08x instructions=%llu time=%.6fs mips=%.2f\n", harts[0]->pc, (unsigned long long)instret, seconds, seconds > 0 ? instret / seconds / 1e6 : 0.0);
+	else printf("harts=%u instructions=%llu time=%.6fs mips=%.2f\n", count, (unsigned long long)instret, seconds, seconds > 0 ? instret / seconds / 1e6 : 0.0);
+	// Outputting touched memory
+	printf("memory=%u KiB pages=%u/%u\n", memory->size / 1024, memory->allocated, memory->size >> PAGE_BITS);
+	if(memory->devices != NULL) printf("console=%llu bytes\n", (unsigned long long)memory->devices->console_bytes);
+	for(uint32_t k = 0; k < count; k++) {
+		const cpu_t* cpu = harts[k];
+		if(count > 1) printf("hart=%u pc=0x%08x instructions=%llu\n", k, cpu->pc, (unsigned long long)cpu->instret);
+		if(cpu->fault) printf("fault=0x%08x\n", cpu->fault_address);
+		if(cpu->exited) printf("exit=%u\n", cpu->exit_code);
+		if(cpu->timing != NULL) timing_report(cpu->timing, cpu->instret);
+		if(cpu->branches != NULL) branch_report(cpu->branches);
+		if(cpu->sample != NULL) sample_report(cpu);
+		if(cpu->reverse != NULL) reverse_report(cpu->reverse);
+		// Outputting registers (four per line)
+		for(uint32_t i = 0; i < 32; i++) {
+			printf("%-4s=0x%08x%s", x_label[i], cpu->x[i], (i % 4 == 3) ? "\n" : " ");
+		}
+	}
+	// Outputting the profile of all harts (counts of blocks folded first)
+	if(harts[0]->profile != 0) {
+		for(uint32_t k = 0; k < count; k++) {
+			if(harts[k]->blocks == NULL) continue;
+			for(uint32_t index = 0; index < memory->size >> PAGE_BITS; index++) {
+				if(harts[k]->blocks[index] == NULL) continue;
+				for(uint32_t i = 0; i < PAGE_SIZE / 4; i++) {
+					if(harts[k]->blocks[index][i] != NULL) block_profile(harts[k]->blocks[index][i]);
+				}
+			}
+		}
+		profile_report(memory, harts[0]->symbols, harts[0]->profile);
+	}
+}
+
+/**
+ * Writes the touched memory pages in the input hexadecimal format
+ * @param memory	Guest memory
+ * @param file		Output file
+ */
+static void dump_memory(const memory_t* memory, FILE* file) {
+	for(uint32_t index = 0; index < memory->size >> PAGE_BITS; index++) {
+		const uint8_t* data = mem_contents(memory, index);
+		if(data == NULL) continue;
+		fprintf(file, "@%08x\n", memory->base + (index << PAGE_BITS));
+		for(uint32_t i = 0; i < PAGE_SIZE; i++) {
+			fprintf(file, "%02X%c", data[i], (i % 16 == 15) ? '\n' : ' ');
+		}
+	}
+}
+
+// Hexadecimal digit values (digit value | 0x10, 0 for other characters)
+static const uint8_t hex_digit[256] = {
+	['0'] = 0x10, ['1'] = 0x11, ['2'] = 0x12, ['3'] = 0x13, ['4'] = 0x14,
+	['5'] = 0x15, ['6'] = 0x16, ['7'] = 0x17, ['8'] = 0x18, ['9'] = 0x19,
+	['A'] = 0x1A, ['B'] = 0x1B, ['C'] = 0x1C, ['D'] = 0x1D, ['E'] = 0x1E, ['F'] = 0x1F,
+	['a'] = 0x1A, ['b'] = 0x1B, ['c'] = 0x1C, ['d'] = 0x1D, ['e'] = 0x1E, ['f'] = 0x1F
+};
+
+/**
+ * Loads a hexadecimal file ("@address" records followed by byte pairs) into
+ * memory. The file is mapped (or read) at once and decoded with hex_digit.
+ * @param memory	Memory for both data and instructions
+ * @param input		Input hexadecimal file
+ * @return			Returns 0 on success
+ */
+static int load_hex(memory_t* memory, FILE* input) {
+	// Mapping the whole file (reading it when it cannot be mapped)
+	struct stat info;
+	if(fstat(fileno(input), &info) != 0) return 1;
+	const size_t size = info.st_size;
+	if(size == 0) return 0;
+	char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(input), 0);
+	const int mapped = (data != MAP_FAILED);
+	if(!mapped) {
+		data = (char*)(malloc(size));
+		if(data == NULL || fread(data, 1, size, input) != size) {
+			fprintf(stderr, "Erro: nao foi possivel ler o arquivo de entrada\n");
+			free(data);
+			return 1;
+		}
+	}
+	// Decoding bytes (first address is the memory offset when there is no record)
+	const uint8_t* p = (const uint8_t*)(data);
+	const uint8_t* const end = p + size;
+	uint32_t address = memory->base;
+	uint32_t line = 1;
+	page_t* page = NULL;
+	int status = 0;
+	while(p < end) {
+		// Skipping separators
+		if(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+			if(*p++ == '\n') line++;
+			continue;
+		}
+		// Address record
+		if(*p == '@') {
+			address = 0;
+			page = NULL;
+			for(p++; p < end && hex_digit[*p]; p++) address = (address << 4) | (hex_digit[*p] & 0xF);
+			continue;
+		}
+		// Byte (two hexadecimal digits)
+		const uint8_t high = hex_digit[p[0]];
+		const uint8_t low = (p + 1 < end) ? hex_digit[p[1]] : 0;
+		if(!(high & low & 0x10) || (p + 2 < end && hex_digit[p[2]])) {
+			fprintf(stderr, "Erro ao converter os dados na linha %u\n", line);
+			status = 1;
+			break;
+		}
+		// Retrieving page on page boundaries and address records (checking memory limits)
+		if(page == NULL || (address & PAGE_MASK) == 0) page = mem_page(memory, address);
+		if(page == NULL) {
+			fprintf(stderr, "Erro: endereco 0x%08x fora da memoria de %u KiB (linha %u)\n", address, memory->size / 1024, line);
+			status = 1;
+			break;
+		}
+		page->data[address++ & PAGE_MASK] = (uint8_t)((high << 4) | (low & 0xF));
+		p += 2;
+	}
+	// Releasing file contents
+	if(mapped) munmap(data, size);
+	else free(data);
+	return status;
+}
+
+/**
+ * Checks whether the input starts with the ELF magic number
+ * @param input	Input file
+ * @return		Returns 1 for an ELF file
+ */
+static int load_is_elf(FILE* input) {
+	uint8_t magic[SELFMAG];
+	const int elf = fread(magic, 1, SELFMAG, input) == SELFMAG && memcmp(magic, ELFMAG, SELFMAG) == 0;
+	rewind(input);
+	return elf;
+}
+
+/**
+ * Copies bytes into memory page by page (zeros only overwrite allocated
+ * pages, untouched pages being already zero)
+ * @param memory	Guest memory
+ * @param address	First guest address (range inside memory)
+ * @param data		Bytes (NULL for zeros)
+ * @param size		Size in bytes
+ */
+static void load_copy(memory_t* memory, uint32_t address, const uint8_t* data, uint32_t size) {
+	while(size != 0) {
+		const uint32_t offset = address & PAGE_MASK;
+		const uint32_t chunk = (size < PAGE_SIZE - offset) ? size : PAGE_SIZE - offset;
+		if(data != NULL) {
+			memcpy(&mem_page(memory, address)->data[offset], data, chunk);
+			data += chunk;
+		} else {
+			page_t* page = memory->pages[(address - memory->base) >> PAGE_BITS];
+			if(page != NULL) memset(&page->data[offset], 0, chunk);
+		}
+		address += chunk;
+		size -= chunk;
+	}
+}
+
+/**
+ * Compares symbols by address, then size (descending)
+ * @param a	First symbol
+ * @param b	Second symbol
+ * @return	Returns the ordering
+ */
+static int symbol_compare(const void* a, const void* b) {
+	const symbol_t* symbol_a = (const symbol_t*)(a);
+	const symbol_t* symbol_b = (const symbol_t*)(b);
+	if(symbol_a->address != symbol_b->address) return (symbol_a->address > symbol_b->address) - (symbol_a->address < symbol_b->address);
+	return (symbol_a->size < symbol_b->size) - (symbol_a->size > symbol_b->size);
+}
+
+/**
+ * Keeps the function symbols of an ELF file (functions and global labels,
+ * one per address), sorted by address
+ * @param symbols	Program symbols (filled, empty without a symbol table)
+ * @param data		ELF file contents
+ * @param size		ELF file size
+ * @param header	ELF header
+ */
+static void load_symbols(symbols_t* symbols, const uint8_t* data, size_t size, const Elf32_Ehdr* header) {
+	if(header->e_shentsize != sizeof(Elf32_Shdr) || (uint64_t)(header->e_shoff) + (uint64_t)(header->e_shnum) * sizeof(Elf32_Shdr) > size) return;
+	for(uint32_t i = 0; i < header->e_shnum; i++) {
+		Elf32_Shdr table, strings;
+		memcpy(&table, data + header->e_shoff + i * sizeof(Elf32_Shdr), sizeof(table));
+		if(table.sh_type != SHT_SYMTAB || table.sh_link >= header->e_shnum) continue;
+		memcpy(&strings, data + header->e_shoff + table.sh_link * sizeof(Elf32_Shdr), sizeof(strings));
+		if((uint64_t)(table.sh_offset) + table.sh_size > size || (uint64_t)(strings.sh_offset) + strings.sh_size > size || strings.sh_size == 0) return;
+		// Copying names (terminated) and selecting symbols
+		symbols->names = (char*)(malloc(strings.sh_size));
+		memcpy(symbols->names, data + strings.sh_offset, strings.sh_size);
+		symbols->names[strings.sh_size - 1] = '\0';
+		symbols->entries = (symbol_t*)(malloc((table.sh_size / sizeof(Elf32_Sym) + 1) * sizeof(symbol_t)));
+		for(uint32_t k = 0; k < table.sh_size / sizeof(Elf32_Sym); k++) {
+			Elf32_Sym symbol;
+			memcpy(&symbol, data + table.sh_offset + k * sizeof(Elf32_Sym), sizeof(symbol));
+			const uint8_t type = ELF32_ST_TYPE(symbol.st_info);
+			const uint8_t bind = ELF32_ST_BIND(symbol.st_info);
+			if(symbol.st_shndx == SHN_UNDEF || symbol.st_shndx >= SHN_LORESERVE || symbol.st_name == 0 || symbol.st_name >= strings.sh_size) continue;
+			if(type != STT_FUNC && !(type == STT_NOTYPE && bind != STB_LOCAL)) continue;
+			// Skipping mapping symbols ($x, $d)
+			if(symbols->names[symbol.st_name] == '$') continue;
+			symbols->entries[symbols->count++] = (symbol_t){ symbol.st_value, symbol.st_size, symbol.st_name };
+		}
+		// Sorting and keeping the largest symbol of each address
+		qsort(symbols->entries, symbols->count, sizeof(symbol_t), symbol_compare);
+		uint32_t kept = 0;
+		for(uint32_t k = 0; k < symbols->count; k++) {
+			if(kept == 0 || symbols->entries[kept - 1].address != symbols->entries[k].address) symbols->entries[kept++] = symbols->entries[k];
+		}
+		symbols->count = kept;
+		return;
+	}
+}
+
+/**
+ * Loads an RV32 ELF executable by mapping it: PT_LOAD segments are copied to
+ * their physical addresses (the rest of their memory size is zero) and the
+ * function symbols are kept
+ * @param memory	Memory for both data and instructions
+ * @param symbols	Program symbols (filled)
+ * @param input		Input ELF file
+ * @param entry		Entry point (filled)
+ * @return			Returns 0 on success
+ */
+static int load_elf(memory_t* memory, symbols_t* symbols, FILE* input, uint32_t* entry) {
+	struct stat info;
+	if(fstat(fileno(input), &info) != 0 || (size_t)(info.st_size) < sizeof(Elf32_Ehdr)) {
+		fprintf(stderr, "Erro: executavel ELF invalido\n");
+		return 1;
+	}
+	const size_t size = info.st_size;
+	const uint8_t* data = (const uint8_t*)(mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(input), 0));
+	if(data == MAP_FAILED) {
+		fprintf(stderr, "Erro: nao foi possivel mapear o executavel ELF\n");
+		return 1;
+	}
+	// Checking header (32-bit little-endian RISC-V executable) and program header table
+	Elf32_Ehdr header;
+	memcpy(&header, data, sizeof(header));
+	const uint64_t headers = (uint64_t)(header.e_phoff) + (uint64_t)(header.e_phnum) * sizeof(Elf32_Phdr);
+	int status = header.e_ident[EI_CLASS] != ELFCLASS32 || header.e_ident[EI_DATA] != ELFDATA2LSB || header.e_type != ET_EXEC || header.e_machine != EM_RISCV ||
+		header.e_phentsize != sizeof(Elf32_Phdr) || headers > size;
+	if(status != 0) fprintf(stderr, "Erro: executavel ELF invalido (esperado executavel RV32 little-endian)\n");
+	// Copying segments (a segment holding only the ELF headers may lie outside memory)
+	for(uint32_t i = 0; i < header.e_phnum && status == 0; i++) {
+		Elf32_Phdr segment;
+		memcpy(&segment, data + header.e_phoff + i * sizeof(Elf32_Phdr), sizeof(segment));
+		if(segment.p_type != PT_LOAD || segment.p_memsz == 0) continue;
+		if(segment.p_filesz > segment.p_memsz || (uint64_t)(segment.p_offset) + segment.p_filesz > size) {
+			fprintf(stderr, "Erro: segmento ELF %u invalido\n", i);
+			status = 1;
+			break;
+		}
+		if(segment.p_paddr - memory->base >= memory->size || segment.p_memsz > memory->size - (segment.p_paddr - memory->base)) {
+			if(segment.p_offset == 0 && segment.p_filesz <= headers) continue;
+			fprintf(stderr, "Erro: segmento ELF em 0x%08x (%u bytes) fora da memoria de %u KiB (use --mem-size)\n", segment.p_paddr, segment.p_memsz, memory->size / 1024);
+			status = 1;
+			break;
+		}
+		load_copy(memory, segment.p_paddr, data + segment.p_offset, segment.p_filesz);
+		load_copy(memory, segment.p_paddr + segment.p_filesz, NULL, segment.p_memsz - segment.p_filesz);
+	}
+	if(status == 0) {
+		load_symbols(symbols, data, size, &header);
+		*entry = header.e_entry;
+	}
+	munmap((void*)(data), size);
+	return status;
+}
+
+// Program generator: random RV32IM programs in the hexadecimal input format
+// (a fuzz corpus for co-simulation and reproducible throughput workloads).
+// Programs set every register, then run GENERATE_LOOPS loops of random
+// instructions drawn from a mix, over a data window of random bytes (the
+// last page of memory, addressed from s0), and end with the halt sequence.
+// Bodies never write s0, t5 (jalr base) or t6 (loop counter).
+#define GENERATE_LOOPS 64
+
+// Instruction classes of the mixes
+enum {
+	GENERATE_ALU_IMM,
+	GENERATE_ALU_REG,
+	GENERATE_MUL,
+	GENERATE_UPPER,
+	GENERATE_LOAD,
+	GENERATE_STORE,
+	GENERATE_BRANCH,
+	GENERATE_JUMP,
+	GENERATE_CLASSES
+};
+
+// Instruction mix (weight of each class)
+typedef struct {
+	const char* name;
+	uint8_t weight[GENERATE_CLASSES];
+} generate_mix_t;
+
+// Instruction mixes (ALU immediate, ALU register, M extension, lui and auipc,
+// loads, stores, forward branches, jal and jalr)
+static const generate_mix_t generate_mixes[] = {
+	{ "alu", { 40, 35, 4, 6, 5, 4, 4, 2 } },
+	{ "mul", { 15, 15, 50, 4, 6, 4, 4, 2 } },
+	{ "mem", { 15, 10, 3, 4, 35, 25, 6, 2 } },
+	{ "branch", { 20, 15, 3, 4, 8, 5, 35, 10 } },
+	{ "mixed", { 25, 20, 10, 6, 14, 10, 11, 4 } },
+};
+
+// Generated program (instructions are written up to the data window)
+typedef struct {
+	memory_t* memory;
+	uint32_t address;
+	uint32_t end;
+	uint32_t count;
+	// Random generator state (splitmix64)
+	uint64_t random;
+} generator_t;
+
+/**
+ * Draws a random number
+ * @param generator	Generated program
+ * @param range		Range size (nonzero)
+ * @return			Returns a number in [0, range)
+ */
+static uint32_t generate_random(generator_t* generator, uint32_t range) {
+	uint64_t z = (generator->random += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return (uint32_t)((z ^ (z >> 31)) % range);
+}
+
+/**
+ * Appends an instruction (dropped past the data window, checked at the end)
+ * @param generator		Generated program
+ * @param instruction	Instruction word
+ */
+static void generate_emit(generator_t* generator, uint32_t instruction) {
+	if(generator->address + 4 <= generator->end) {
+		page_t* page = mem_page(generator->memory, generator->address);
+		memcpy(&page->data[generator->address & PAGE_MASK], &instruction, 4);
+	}
+	generator->address += 4;
+	generator->count++;
+}
+
+// Instruction formats
+#define R(funct7, rs2, rs1, funct3, rd, opcode) (((funct7) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((funct3) << 12) | ((rd) << 7) | (opcode))
+#define I(imm, rs1, funct3, rd, opcode) ((((uint32_t)(imm) & 0xFFF) << 20) | ((rs1) << 15) | ((funct3) << 12) | ((rd) << 7) | (opcode))
+#define S(imm, rs2, rs1, funct3) (((((uint32_t)(imm) >> 5) & 0x7F) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((funct3) << 12) | (((imm) & 0x1F) << 7) | 0b0100011)
+#define B(imm, rs2, rs1, funct3) (((((uint32_t)(imm) >> 12) & 1) << 31) | ((((imm) >> 5) & 0x3F) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((funct3) << 12) | ((((imm) >> 1) & 0xF) << 8) | ((((imm) >> 11) & 1) << 7) | 0b1100011)
+#define U(imm, rd, opcode) ((((uint32_t)(imm) & 0xFFFFF) << 12) | ((rd) << 7) | (opcode))
+#define J(imm, rd) (((((uint32_t)(imm) >> 20) & 1) << 31) | ((((imm) >> 1) & 0x3FF) << 21) | ((((imm) >> 11) & 1) << 20) | ((((imm) >> 12) & 0xFF) << 12) | ((rd) << 7) | 0b1101111)
+// Registers reserved by the generated code
+#define GENERATE_S0 8
+#define GENERATE_T5 30
+#define GENERATE_T6 31
+
+/**
+ * Appends lui and addi setting a register to a value
+ * @param generator	Generated program
+ * @param rd		Destination register
+ * @param value		Value
+ */
+static void generate_li(generator_t* generator, uint32_t rd, uint32_t value) {
+	generate_emit(generator, U((value + 0x800) >> 12, rd, 0b0110111));
+	generate_emit(generator, I(value & 0xFFF, rd, 0b000, rd, 0b0010011));
+}
+
+/**
+ * Draws a destination register (any but zero and the reserved ones)
+ * @param generator	Generated program
+ * @return			Returns the register index
+ */
+static uint32_t generate_rd(generator_t* generator) {
+	uint32_t rd;
+	do rd = 1 + generate_random(generator, GENERATE_T5 - 1);
+	while(rd == GENERATE_S0);
+	return rd;
+}
+
+/**
+ * Appends a random instruction of a class (with the instructions skipped by
+ * branches and jumps)
+ * @param generator	Generated program
+ * @param type		Instruction class
+ */
+static void generate_instruction(generator_t* generator, uint32_t type) {
+	static const uint8_t alu_imm[9][2] = { { 0b000, 0 }, { 0b010, 0 }, { 0b011, 0 }, { 0b100, 0 }, { 0b110, 0 }, { 0b111, 0 }, { 0b001, 0 }, { 0b101, 0 }, { 0b101, 0b0100000 } };
+	static const uint8_t alu_reg[10][2] = { { 0b000, 0 }, { 0b000, 0b0100000 }, { 0b001, 0 }, { 0b010, 0 }, { 0b011, 0 }, { 0b100, 0 }, { 0b101, 0 }, { 0b101, 0b0100000 }, { 0b110, 0 }, { 0b111, 0 } };
+	// Loads and stores: funct3 and access size
+	static const uint8_t load[5][2] = { { 0b000, 1 }, { 0b001, 2 }, { 0b010, 4 }, { 0b100, 1 }, { 0b101, 2 } };
+	static const uint8_t store[3][2] = { { 0b000, 1 }, { 0b001, 2 }, { 0b010, 4 } };
+	static const uint8_t branch[6] = { 0b000, 0b001, 0b100, 0b101, 0b110, 0b111 };
+	const uint32_t rd = generate_rd(generator);
+	const uint32_t rs1 = generate_random(generator, 32);
+	const uint32_t rs2 = generate_random(generator, 32);
+	switch(type) {
+		case GENERATE_ALU_IMM:
+			{
+				const uint8_t* op = alu_imm[generate_random(generator, 9)];
+				// Shifts take a 5-bit amount and funct7
+				const uint32_t imm = (op[0] == 0b001 || op[0] == 0b101) ? (op[1] << 5) | generate_random(generator, 32) : generate_random(generator, 4096);
+				generate_emit(generator, I(imm, rs1, op[0], rd, 0b0010011));
+			}
+			break;
+		case GENERATE_ALU_REG:
+			{
+				const uint8_t* op = alu_reg[generate_random(generator, 10)];
+				generate_emit(generator, R(op[1], rs2, rs1, op[0], rd, 0b0110011));
+			}
+			break;
+		case GENERATE_MUL:
+			generate_emit(generator, R(0b0000001, rs2, rs1, generate_random(generator, 8), rd, 0b0110011));
+			break;
+		case GENERATE_UPPER:
+			generate_emit(generator, U(generate_random(generator, 1 << 20), rd, generate_random(generator, 2) ? 0b0110111 : 0b0010111));
+			break;
+		// Aligned accesses inside the data window
+		case GENERATE_LOAD:
+			{
+				const uint8_t* op = load[generate_random(generator, 5)];
+				const int32_t offset = ((int32_t)(generate_random(generator, 4096)) - 2048) & -(int32_t)(op[1]);
+				generate_emit(generator, I(offset, GENERATE_S0, op[0], rd, 0b0000011));
+			}
+			break;
+		case GENERATE_STORE:
+			{
+				const uint8_t* op = store[generate_random(generator, 3)];
+				const int32_t offset = ((int32_t)(generate_random(generator, 4096)) - 2048) & -(int32_t)(op[1]);
+				generate_emit(generator, S(offset, rs2, GENERATE_S0, op[0]));
+			}
+			break;
+		// Forward branches and jumps over 1 to 3 instructions (jalr over 1,
+		// from auipc)
+		case GENERATE_BRANCH:
+		case GENERATE_JUMP:
+			{
+				uint32_t skipped = 1 + generate_random(generator, 3);
+				if(type == GENERATE_BRANCH) {
+					generate_emit(generator, B(4 * (skipped + 1), rs2, rs1, branch[generate_random(generator, 6)]));
+				} else if(generate_random(generator, 2)) {
+					generate_emit(generator, J(4 * (skipped + 1), rd));
+				} else {
+					generate_emit(generator, U(0, GENERATE_T5, 0b0010111));
+					generate_emit(generator, I(12, GENERATE_T5, 0b000, rd, 0b1100111));
+					skipped = 1;
+				}
+				while(skipped-- > 0) generate_instruction(generator, GENERATE_ALU_IMM);
+			}
+			break;
+	}
+}
+
+/**
+ * Writes a random program as a hexadecimal file
+ * @param output	Output file
+ * @param mix		Instruction mix
+ * @param length	Executed instructions (approximately)
+ * @param seed		Random seed
+ * @param mem_size	Guest memory size (the data window is its last page)
+ * @return			Returns 0 on success
+ */
+static int generate_program(FILE* output, const generate_mix_t* mix, uint64_t length, uint64_t seed, uint32_t mem_size) {
+	memory_t memory;
+	mem_create(&memory, MEM_OFFSET, mem_size);
+	generator_t generator = { &memory, MEM_OFFSET, MEM_OFFSET + mem_size - PAGE_SIZE, 0, seed };
+	uint32_t total = 0;
+	for(uint32_t type = 0; type < GENERATE_CLASSES; type++) total += mix->weight[type];
+	// Filling the data window with random bytes
+	page_t* data = mem_page(&memory, generator.end);
+	for(uint32_t i = 0; i < PAGE_SIZE; i++) data->data[i] = (uint8_t)(generate_random(&generator, 256));
+	// Setting every register (s0 in the middle of the data window)
+	for(uint32_t rd = 1; rd < 32; rd++) generate_li(&generator, rd, (rd == GENERATE_S0) ? generator.end + PAGE_SIZE / 2 : generate_random(&generator, 0xFFFFFFFF));
+	// Looping over bodies of 8 to 32 instructions (and the ones they skip)
+	for(uint32_t loop = 0; loop < GENERATE_LOOPS; loop++) {
+		const uint32_t size = 8 + generate_random(&generator, 25);
+		const uint64_t iterations = length / GENERATE_LOOPS / (size + 2);
+		generate_li(&generator, GENERATE_T6, (iterations > 1) ? (uint32_t)((iterations < 0xFFFFFFFF) ? iterations : 0xFFFFFFFF) : 1);
+		const uint32_t start = generator.address;
+		for(uint32_t i = 0; i < size; i++) {
+			uint32_t pick = generate_random(&generator, total);
+			uint32_t type = 0;
+			while(pick >= mix->weight[type]) pick -= mix->weight[type++];
+			generate_instruction(&generator, type);
+		}
+		generate_emit(&generator, I(-1, GENERATE_T6, 0b000, GENERATE_T6, 0b0010011));
+		generate_emit(&generator, B(start - generator.address, 0, GENERATE_T6, 0b001));
+	}
+	// Halting (slli zero, zero, 31; ebreak; srai zero, zero, 7)
+	generate_emit(&generator, 0x01f01013);
+	generate_emit(&generator, 0x00100073);
+	generate_emit(&generator, 0x40705013);
+	int status = 0;
+	if(generator.address > generator.end) {
+		fprintf(stderr, "Erro: programa gerado (%u bytes) nao cabe na memoria de %u KiB (use --mem-size)\n", generator.address - MEM_OFFSET, mem_size / 1024);
+		status = 1;
+	} else {
+		dump_memory(&memory, output);
+		printf("generate mix=%s length=%llu seed=%llu instructions=%u bytes=%u\n", mix->name, (unsigned long long)length, (unsigned long long)seed, generator.count, generator.address - MEM_OFFSET);
+	}
+	mem_destroy(&memory);
+	return status;
+}
+#undef R
+#undef I
+#undef S
+#undef B
+#undef U
+#undef J
+#undef GENERATE_S0
+#undef GENERATE_T5
+#undef GENERATE_T6
+
+// Execution engines
+typedef struct {
+	const char* name;
+	void (*run)(cpu_t* cpu);
+} engine_t;
+
+static const engine_t engines[] = {
+	{ "interp", run_interp },
+	{ "threaded", run_threaded },
+	{ "block", run_block },
+	{ "jit", run_jit },
+};
+
+// Most harts (host threads)
+#define HARTS_MAX 256
+
+// Hart running on its own host thread
+typedef struct {
+	cpu_t* cpu;
+	const engine_t* engine;
+	pthread_t thread;
+} hart_t;
+
+/**
+ * Runs the engine of a hart (host thread entry)
+ * @param argument	Hart
+ * @return			Returns NULL
+ */
+static void* hart_thread(void* argument) {
+	hart_t* hart = (hart_t*)(argument);
+	hart->engine->run(hart->cpu);
+	return NULL;
+}
+
+/**
+ * Runs the harts round-robin, one instruction each, on the calling thread
+ * (deterministic interleaving for the merged trace)
+ * @param harts	Simulator state of each hart
+ * @param count	Number of harts
+ */
+static void run_merged(cpu_t* const* harts, uint32_t count) {
+	for(uint32_t running = count; running > 0; ) {
+		running = 0;
+		for(uint32_t k = 0; k < count; k++) {
+			if(!harts[k]->run) continue;
+			step(harts[k]);
+			running += harts[k]->run;
+		}
+	}
+}
+
+/**
+ * Runs a hart sampled: fast-forwards without side channels, then warms the
+ * timing model and predictors up and measures a window (traced and
+ * profiled) at the end of every period. Engines return at the first control
+ * flow from their limit, so every engine samples the same instructions.
+ * @param run	Engine
+ * @param cpu	Simulator state
+ */
+static void run_sampled(void (*run)(cpu_t* cpu), cpu_t* cpu) {
+	sample_t* sample = cpu->sample;
+	branch_unit_t* branches = sample->branches;
+	const uint32_t predictors = (branches != NULL) ? branches->count : 0;
+	for(uint64_t end = sample->period; cpu->run; end += sample->period) {
+		// Fast-forwarding
+		cpu->trace_mode = TRACE_OFF;
+		cpu->timing = NULL;
+		cpu->branches = NULL;
+		cpu->profile = 0;
+		observe_update(cpu);
+		trap_limit(cpu, end - sample->window - sample->warmup);
+		run(cpu);
+		// Warming the timing model and predictors up
+		const uint64_t detailed = cpu->instret;
+		cpu->timing = sample->timing;
+		cpu->branches = branches;
+		observe_update(cpu);
+		trap_limit(cpu, end - sample->window);
+		if(cpu->run && sample->warmup != 0) run(cpu);
+		// Measuring the window
+		const uint64_t instret = cpu->instret;
+		const uint64_t cycles = sample->timing->cycles;
+		uint64_t mispredicts[PREDICTORS_MAX];
+		for(uint32_t i = 0; i < predictors; i++) mispredicts[i] = branches->mispredicts[i];
+		cpu->trace_mode = sample->trace_mode;
+		cpu->profile = sample->profile;
+		observe_update(cpu);
+		trap_limit(cpu, end);
+		if(cpu->run) run(cpu);
+		sample->detailed += cpu->instret - detailed;
+		// Accumulating complete windows
+		if(!cpu->run || cpu->instret == instret) continue;
+		const double executed = cpu->instret - instret;
+		const double cpi = (sample->timing->cycles - cycles) / executed;
+		sample->windows++;
+		sample->cpi += cpi;
+		sample->cpi2 += cpi * cpi;
+		for(uint32_t i = 0; i < predictors; i++) {
+			const double mpi = (branches->mispredicts[i] - mispredicts[i]) / executed;
+			sample->mpi[i] += mpi;
+			sample->mpi2[i] += mpi * mpi;
+		}
+	}
+	// Attaching the side channels for the summary
+	cpu->trace_mode = sample->trace_mode;
+	cpu->timing = sample->timing;
+	cpu->branches = branches;
+	cpu->profile = sample->profile;
+	observe_update(cpu);
+	trap_limit(cpu, UINT64_MAX);
+}
+
+/**
+ * Creates a hart with its registers zeroed, pc at the memory offset, empty
+ * TLBs and no limit (side channels are attached by the caller)
+ * @param memory	Guest memory (devices already created)
+ * @param hartid	Hart index
+ * @return			Returns the simulator state
+ */
+static cpu_t* hart_create(memory_t* memory, uint32_t hartid) {
+	cpu_t* cpu = (cpu_t*)(calloc(1, sizeof(cpu_t)));
+	cpu->hartid = hartid;
+	cpu->memory = memory;
+	trap_limit(cpu, UINT64_MAX);
+	// Creating pc register initialized with memory offset
+	cpu->pc = MEM_OFFSET;
+	// Creating empty TLBs
+	for(uint32_t i = 0; i < TLB_SIZE; i++) {
+		cpu->dtlb[i].tag = TLB_INVALID;
+		cpu->itlb[i].tag = TLB_INVALID;
+	}
+	cpu->fetch_tag = TLB_INVALID;
+	cpu->block_pc = TLB_INVALID;
+	// Setting run condition
+	cpu->run = 1;
+	return cpu;
+}
+
+/**
+ * Releases a hart: translated blocks, machine code and trace buffer
+ * @param cpu	Simulator state
+ * @param owner	Hart owns its trace buffer (not shared by a merged trace)
+ */
+static void hart_destroy(cpu_t* cpu, int owner) {
+	if(cpu->blocks != NULL) {
+		for(uint32_t index = 0; index < cpu->memory->size >> PAGE_BITS; index++) {
+			block_t** blocks = cpu->blocks[index];
+			if(blocks == NULL) continue;
+			for(uint32_t i = 0; i < PAGE_SIZE / 4; i++) {
+				if(blocks[i] == NULL) continue;
+				free(blocks[i]->insn);
+				free(blocks[i]->uops);
+				free(blocks[i]);
+			}
+			free(blocks);
+		}
+		free(cpu->blocks);
+	}
+	if(cpu->timing != NULL) timing_destroy(cpu->timing);
+	if(cpu->branches != NULL) branch_destroy(cpu->branches);
+	if(cpu->bbv != NULL) bbv_destroy(cpu->bbv);
+	free(cpu->sample);
+	if(cpu->reverse != NULL) reverse_destroy(cpu->reverse);
+#if defined(__x86_64__)
+	if(cpu->jit.code != NULL) munmap(cpu->jit.code, JIT_BUFFER_SIZE);
+#endif
+	if(owner) {
+		free(cpu->trace->data);
+		free(cpu->trace);
+	}
+	free(cpu);
+}
+
+// Lock-step co-simulation: the selected engine runs a copy of the image (own
+// memory and devices, no side channels, console muted) one segment at a time,
+// each ending at the first control flow (where engines return at their
+// limit), while the interpreter steps the hart itself through the same
+// instructions, logging what each one writes. Both harts are compared after
+// every segment (pc, registers, CSRs, timer compare and the logged stores) and
+// their whole memory at the end; the first divergence outputs the logged
+// instructions of its segment and the differences.
+
+// Logged instruction of the interpreter
+typedef struct {
+	uint64_t instret;
+	uint32_t pc;
+	uint8_t op;
+	// Written register (COSIM_NONE for none) and its value after execution
+	uint8_t rd;
+	uint32_t rd_value;
+	// Store size in bytes (0 for none), address and bytes after execution
+	uint8_t size;
+	uint32_t address;
+	uint32_t data;
+} cosim_entry_t;
+
+// Instruction log of the running segment
+typedef struct {
+	cosim_entry_t* entries;
+	uint32_t length;
+	uint32_t capacity;
+} cosim_log_t;
+
+// No written register
+#define COSIM_NONE 32
+// Most differences and logged instructions output on a divergence
+#define COSIM_REPORT_MAX 64
+
+// Operations writing rd (all but stores, branches, halts and the system ones
+// without a destination)
+#define OP_WRITES_RD(op) (((op) < OP_SW || (op) > OP_SH) && ((op) < OP_BLT || (op) > OP_BRANCH_RESERVED) && \
+	((op) < OP_ECALL || (op) > OP_UNKNOWN) && (op) != OP_NOP && (op) != OP_EBREAK && (op) != OP_FETCH_FAULT)
+
+/**
+ * Steps the interpreter through an instruction, logging its pc, written
+ * register and stored bytes
+ * @param cpu	Simulator state
+ * @param log	Segment log
+ */
+static void cosim_step(cpu_t* cpu, cosim_log_t* log) {
+	if(log->length == log->capacity) {
+		log->capacity = (log->capacity != 0) ? 2 * log->capacity : 256;
+		log->entries = (cosim_entry_t*)(realloc(log->entries, log->capacity * sizeof(cosim_entry_t)));
+	}
+	const decoded_t* d = fetch(cpu);
+	cosim_entry_t* entry = &log->entries[log->length++];
+	entry->instret = cpu->instret;
+	entry->pc = cpu->pc;
+	entry->op = d->op;
+	entry->rd = OP_WRITES_RD(d->op) ? d->rd : COSIM_NONE;
+	entry->size = 0;
+	if(d->op >= OP_SW && d->op <= OP_AMOMAXU) {
+		entry->address = cpu->x[d->rs1] + ((d->op <= OP_SH) ? d->imm : 0);
+		entry->size = (d->op == OP_SB) ? 1 : (d->op == OP_SH) ? 2 : 4;
+	}
+	step(cpu);
+	if(entry->rd != COSIM_NONE) entry->rd_value = cpu->x[entry->rd];
+	if(entry->size != 0) entry->data = mem_peek(cpu, entry->address);
+}
+
+/**
+ * Checks whether a logged store is the last one of the segment writing a byte
+ * @param log		Segment log
+ * @param i			Logged instruction index
+ * @param address	Byte address
+ * @return			Returns 1 when no later instruction stores to the byte
+ */
+static int cosim_last_store(const cosim_log_t* log, uint32_t i, uint32_t address) {
+	for(uint32_t j = i + 1; j < log->length; j++) {
+		if(address - log->entries[j].address < log->entries[j].size) return 0;
+	}
+	return 1;
+}
+
+/**
+ * Counts a difference between both harts, outputting it when reporting
+ * @param differences	Differences found
+ * @param report		Outputting differences
+ * @param name			State name
+ * @param reference		Interpreter value
+ * @param engine		Engine value
+ */
+static void cosim_differ(uint32_t* differences, int report, const char* name, uint32_t reference, uint32_t engine) {
+	if(reference == engine) return;
+	if(report && *differences < COSIM_REPORT_MAX) printf("cosim %s reference=0x%08x engine=0x%08x\n", name, reference, engine);
+	(*differences)++;
+}
+
+/**
+ * Compares both harts: instruction count, run condition, pc, registers,
+ * CSRs, timer compare and the bytes stored by the logged instructions (or
+ * the whole memory)
+ * @param reference	Interpreter hart
+ * @param engine	Engine hart
+ * @param log		Segment log
+ * @param report	Outputting differences
+ * @param full		Comparing the whole memory instead of the logged stores
+ * @return			Returns the number of differences
+ */
+static uint32_t cosim_compare(cpu_t* reference, cpu_t* engine, const cosim_log_t* log, int report, int full) {
+	uint32_t differences = 0;
+	if(reference->instret != engine->instret) {
+		if(report) printf("cosim instructions reference=%llu engine=%llu\n", (unsigned long long)reference->instret, (unsigned long long)engine->instret);
+		differences++;
+	}
+	cosim_differ(&differences, report, "run", reference->run, engine->run);
+	cosim_differ(&differences, report, "fault", reference->fault ? reference->fault_address : 0, engine->fault ? engine->fault_address : 0);
+	cosim_differ(&differences, report, "exit", reference->exited ? reference->exit_code : 0, engine->exited ? engine->exit_code : 0);
+	cosim_differ(&differences, report, "pc", reference->pc, engine->pc);
+	for(uint32_t i = 0; i < 32; i++) cosim_differ(&differences, report, x_label[i], reference->x[i], engine->x[i]);
+	for(uint32_t i = 0; i < sizeof(csr_name) / sizeof(csr_name[0]); i++) {
+		uint32_t a = 0, b = 0;
+		csr_read(reference, csr_name[i].number, &a);
+		csr_read(engine, csr_name[i].number, &b);
+		cosim_differ(&differences, report, csr_name[i].name.s, a, b);
+	}
+	if(reference->memory->devices != NULL) {
+		const uint64_t a = reference->memory->devices->mtimecmp[reference->hartid], b = engine->memory->devices->mtimecmp[engine->hartid];
+		cosim_differ(&differences, report, "mtimecmp", (uint32_t)(a), (uint32_t)(b));
+		cosim_differ(&differences, report, "mtimecmph", (uint32_t)(a >> 32), (uint32_t)(b >> 32));
+	}
+	// Comparing the stored bytes (each one once, at its last store)
+	for(uint32_t i = 0; i < log->length && !full; i++) {
+		const cosim_entry_t* entry = &log->entries[i];
+		for(uint32_t k = 0; k < entry->size; k++) {
+			const uint32_t address = entry->address + k;
+			const uint8_t a = (uint8_t)(mem_peek(reference, address)), b = (uint8_t)(mem_peek(engine, address));
+			if(a == b || (report && !cosim_last_store(log, i, address))) continue;
+			if(report && differences < COSIM_REPORT_MAX) printf("cosim mem=0x%08x reference=0x%02x engine=0x%02x\n", address, a, b);
+			differences++;
+		}
+	}
+	// Comparing every touched page (untouched ones read as zeros)
+	const memory_t* memory = reference->memory;
+	static const uint8_t zero[PAGE_SIZE];
+	for(uint32_t index = 0; index < memory->size >> PAGE_BITS && full; index++) {
+		const uint8_t* a = mem_contents(memory, index);
+		const uint8_t* b = mem_contents(engine->memory, index);
+		if(a == NULL && b == NULL) continue;
+		if(a == NULL) a = zero;
+		if(b == NULL) b = zero;
+		for(uint32_t offset = 0; offset < PAGE_SIZE; offset++) {
+			if(a[offset] == b[offset]) continue;
+			if(report && differences < COSIM_REPORT_MAX) printf("cosim mem=0x%08x reference=0x%02x engine=0x%02x\n", memory->base + (index << PAGE_BITS) + offset, a[offset], b[offset]);
+			differences++;
+		}
+	}
+	return differences;
+}
+
+/**
+ * Finds the first logged instruction whose write differs from the engine
+ * state at the end of the segment (the last write of a register or byte),
+ * or the last one (control flow) when none does
+ * @param reference	Interpreter hart
+ * @param engine	Engine hart
+ * @param log		Segment log
+ * @return			Returns the logged instruction, or NULL for an empty log
+ */
+static const cosim_entry_t* cosim_divergence(cpu_t* reference, cpu_t* engine, const cosim_log_t* log) {
+	for(uint32_t i = 0; i < log->length; i++) {
+		const cosim_entry_t* entry = &log->entries[i];
+		if(entry->rd != COSIM_NONE && reference->x[entry->rd] != engine->x[entry->rd]) {
+			uint32_t j = i + 1;
+			while(j < log->length && log->entries[j].rd != entry->rd) j++;
+			if(j == log->length) return entry;
+		}
+		for(uint32_t k = 0; k < entry->size; k++) {
+			const uint32_t address = entry->address + k;
+			if((uint8_t)(mem_peek(reference, address)) != (uint8_t)(mem_peek(engine, address)) && cosim_last_store(log, i, address)) return entry;
+		}
+	}
+	return (log->length != 0) ? &log->entries[log->length - 1] : NULL;
+}
+
+/**
+ * Outputs a divergence: the instruction it was found at, the logged
+ * instructions of the segment (the latest ones) and the differences
+ * @param name		Engine name
+ * @param reference	Interpreter hart
+ * @param engine	Engine hart
+ * @param log		Segment log
+ * @param segments	Compared segments
+ * @param full		Found comparing the whole memory at the end
+ */
+static void cosim_report(const char* name, cpu_t* reference, cpu_t* engine, const cosim_log_t* log, uint64_t segments, int full) {
+	const cosim_entry_t* divergence = full ? NULL : cosim_divergence(reference, engine, log);
+	const uint64_t instret = (divergence != NULL) ? divergence->instret : reference->instret;
+	const uint32_t pc = (divergence != NULL) ? divergence->pc : reference->pc;
+	fprintf(stderr, "Erro: a engine %s divergiu do interpretador na instrucao %llu (pc = 0x%08x)\n", name, (unsigned long long)instret, pc);
+	printf("cosim engine=%s reference=interp segments=%llu divergence=%llu pc=0x%08x\n", name, (unsigned long long)segments, (unsigned long long)instret, pc);
+	for(uint32_t i = (log->length > COSIM_REPORT_MAX && !full) ? log->length - COSIM_REPORT_MAX : 0; i < log->length && !full; i++) {
+		const cosim_entry_t* entry = &log->entries[i];
+		char text[16];
+		printf("cosim instruction=%llu pc=0x%08x op=%s", (unsigned long long)entry->instret, entry->pc, profile_op(entry->op, text, sizeof(text)));
+		if(entry->rd != COSIM_NONE) printf(" %s=0x%08x", x_label[entry->rd], entry->rd_value);
+		if(entry->size != 0) printf(" store=0x%08x:%u data=0x%08x", entry->address, entry->size, (entry->size == 4) ? entry->data : entry->data & ((1u << (8 * entry->size)) - 1));
+		printf("%s\n", (entry == divergence) ? " diverged" : "");
+	}
+	cosim_compare(reference, engine, log, 1, full);
+}
+
+/**
+ * Runs a hart in lock-step co-simulation: the engine on a copy of the image
+ * against the interpreter stepping the hart itself (traced and observed as
+ * configured)
+ * @param engine	Checked engine
+ * @param cpu		Simulator state (single hart, image loaded)
+ * @return			Returns 0 when both harts agree up to their halt
+ */
+static int run_cosim(const engine_t* engine, cpu_t* cpu) {
+	// Copying the image, registers and CSRs into the engine hart
+	const memory_t* source = cpu->memory;
+	memory_t memory;
+	mem_create(&memory, source->base, source->size);
+	if(source->devices != NULL) memory.devices = device_create(source->devices->base, 1);
+	cpu_t* checked = hart_create(&memory, 0);
+	cpu_t* const harts[1] = { checked };
+	if(memory.devices != NULL) memory.devices->cpus = harts;
+	for(uint32_t index = 0; index < memory.size >> PAGE_BITS; index++) {
+		const uint8_t* data = mem_contents(source, index);
+		if(data != NULL) memcpy(mem_page(&memory, memory.base + (index << PAGE_BITS))->data, data, PAGE_SIZE);
+	}
+	checked->pc = cpu->pc;
+	memcpy(checked->x, cpu->x, sizeof(checked->x));
+	checked->csr = cpu->csr;
+	checked->muted = 1;
+	// Running a segment on the engine, then stepping the interpreter up to
+	// the same instruction count, until a divergence or both harts halt
+	cosim_log_t log = { NULL, 0, 0 };
+	uint64_t segments = 0;
+	uint32_t differences = 0;
+	while(differences == 0 && (cpu->run || checked->run)) {
+		log.length = 0;
+		if(checked->run) {
+			trap_limit(checked, checked->instret + 1);
+			engine->run(checked);
+		}
+		while(cpu->run && cpu->instret < checked->instret) cosim_step(cpu, &log);
+		segments++;
+		differences = cosim_compare(cpu, checked, &log, 0, 0);
+	}
+	const int full = (differences == 0);
+	if(full) differences = cosim_compare(cpu, checked, &log, 0, 1);
+	if(differences != 0) cosim_report(engine->name, cpu, checked, &log, segments, full);
+	else printf("cosim engine=%s reference=interp segments=%llu instructions=%llu\n", engine->name, (unsigned long long)segments, (unsigned long long)cpu->instret);
+	// Releasing the engine hart
+	free(log.entries);
+	hart_destroy(checked, 0);
+	if(memory.devices != NULL) device_destroy(memory.devices);
+	mem_destroy(&memory);
+	return differences != 0;
+}
+
+// Simulation settings (command line options)
+typedef struct {
+	const engine_t* engine;
+	uint32_t mem_size;
+	uint32_t hart_count;
+	uint8_t merge_trace;
+	uint8_t trace_mode;
+	uint8_t trace_binary;
+	uint32_t trace_pc_first;
+	uint32_t trace_pc_last;
+	uint64_t trace_first;
+	uint64_t trace_count;
+	// Timing model (per hart)
+	uint8_t timing;
+	timing_config_t timing_config;
+	// Branch predictors (per hart, none when empty)
+	uint32_t predictor_count;
+	predictor_config_t predictors[PREDICTORS_MAX];
+	// Profiler hottest entries listed (0 when disabled)
+	uint32_t profile;
+	// Snapshot point (single hart) and snapshot input instead of a hexadecimal file
+	snapshot_point_t snapshot;
+	uint8_t restore;
+	// Sampled simulation (period 0 when disabled) and basic block vectors (single hart)
+	uint64_t sample_period;
+	uint64_t sample_window;
+	uint64_t sample_warmup;
+	const char* bbv_file;
+	uint64_t bbv_interval;
+	// Reverse execution (single hart, 0 checkpoints when disabled) and the
+	// moves back after the run: last write of an address (UINT64_MAX for
+	// none), instructions stepped back and instruction count (UINT64_MAX for none)
+	uint32_t reverse_checkpoints;
+	uint64_t reverse_interval;
+	uint64_t reverse_last_write;
+	uint64_t reverse_back;
+	uint64_t reverse_to;
+	// GDB stub TCP port or Unix socket path (single hart, NULL when disabled)
+	const char* gdb;
+	// Lock-step co-simulation of the engine against the interpreter (single hart)
+	uint8_t cosim;
+	// Memory-mapped devices and their region bases (TLB_INVALID when absent)
+	uint8_t devices;
+	uint32_t device_base[DEVICE_COUNT];
+	// Summary and memory dump on the console (single run)
+	uint8_t verbose;
+} config_t;
+
+// Simulation of an image (a manifest line in batch mode)
+typedef struct {
+	const char* input;
+	const char* output;
+	// Final memory file (NULL for none)
+	const char* dump;
+	// Results: status (0 on success), memory fault, exit code of hart 0 (halt
+	// register), executed instructions and wall time
+	int status;
+	uint8_t fault;
+	uint8_t exited;
+	uint32_t exit_code;
+	uint64_t instret;
+	double seconds;
+	// Simulated cycles (timing model)
+	uint64_t cycles;
+} job_t;
+
+// GDB remote serial protocol stub: a single debugger connection over a local
+// TCP port or Unix socket, exposing x[32], pc and guest memory. The guest
+// runs on the selected engine between stops, checking for an interrupt
+// (Ctrl-C) every GDB_SLICE instructions.
+#define GDB_PACKET_MAX 4096
+#define GDB_SLICE (1 << 22)
+
+// Debugger connection
+typedef struct {
+	int fd;
+	// Received bytes not parsed yet
+	uint8_t input[GDB_PACKET_MAX];
+	size_t head;
+	size_t tail;
+	// Last stop reply (answer to "?")
+	char stop[48];
+} gdb_t;
+
+/**
+ * Opens the debugger socket and waits for the connection
+ * @param where	TCP port on 127.0.0.1 (digits only) or Unix socket path
+ * @return		Returns the connected socket, or -1 on error
+ */
+static int gdb_accept(const char* where) {
+	const int tcp = strspn(where, "0123456789") == strlen(where);
+	const int server = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+	if(server < 0) return -1;
+	int status;
+	if(tcp) {
+		const int reuse = 1;
+		setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = htons((uint16_t)(atoi(where))), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+		status = bind(server, (struct sockaddr*)(&address), sizeof(address));
+	} else {
+		struct sockaddr_un address = { .sun_family = AF_UNIX };
+		snprintf(address.sun_path, sizeof(address.sun_path), "%s", where);
+		unlink(where);
+		status = bind(server, (struct sockaddr*)(&address), sizeof(address));
+	}
+	if(status != 0 || listen(server, 1) != 0) {
+		close(server);
+		return -1;
+	}
+	printf("gdb listening=%s%s\n", tcp ? "127.0.0.1:" : "", where);
+	fflush(stdout);
+	const int fd = accept(server, NULL, NULL);
+	close(server);
+	if(!tcp) unlink(where);
+	if(fd >= 0 && tcp) {
+		const int nodelay = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	}
+	return fd;
+}
+
+/**
+ * Reads a byte from the debugger
+ * @param gdb	Connection
+ * @return		Returns the byte, or -1 when the connection is closed
+ */
+static int gdb_getc(gdb_t* gdb) {
+	if(gdb->head == gdb->tail) {
+		const ssize_t received = recv(gdb->fd, gdb->input, sizeof(gdb->input), 0);
+		if(received <= 0) return -1;
+		gdb->head = 0;
+		gdb->tail = received;
+	}
+	return gdb->input[gdb->head++];
+}
+
+/**
+ * Checks for pending bytes without waiting
+ * @param gdb	Connection
+ * @return		Returns 1 when a byte (or the connection end) is pending
+ */
+static int gdb_pending(gdb_t* gdb) {
+	struct pollfd events = { .fd = gdb->fd, .events = POLLIN };
+	return gdb->head != gdb->tail || poll(&events, 1, 0) > 0;
+}
+
+/**
+ * Sends a packet ("$data#checksum"; acknowledgments are skipped on receive)
+ * @param gdb	Connection
+ * @param data	Packet data
+ */
+static void gdb_send(gdb_t* gdb, const char* data) {
+	static char packet[2 * GDB_PACKET_MAX + 4];
+	uint8_t checksum = 0;
+	size_t length = 0;
+	packet[length++] = '$';
+	for(const char* c = data; *c != '\0'; c++) {
+		checksum += (uint8_t)(*c);
+		packet[length++] = *c;
+	}
+	length += sprintf(&packet[length], "#%02x", checksum);
+	for(size_t sent = 0; sent < length; ) {
+		const ssize_t written = send(gdb->fd, &packet[sent], length - sent, MSG_NOSIGNAL);
+		if(written <= 0) return;
+		sent += written;
+	}
+}
+
+/**
+ * Receives a packet, acknowledging it (interrupts and acknowledgments
+ * between packets are skipped)
+ * @param gdb		Connection
+ * @param packet	Packet data (null-terminated)
+ * @return			Returns 0 on success, -1 when the connection is closed
+ */
+static int gdb_receive(gdb_t* gdb, char packet[GDB_PACKET_MAX]) {
+	for(;;) {
+		int c;
+		while((c = gdb_getc(gdb)) != '$') {
+			if(c < 0) return -1;
+		}
+		uint8_t checksum = 0;
+		size_t length = 0;
+		while((c = gdb_getc(gdb)) != '#') {
+			if(c < 0) return -1;
+			checksum += (uint8_t)(c);
+			if(length < GDB_PACKET_MAX - 1) packet[length++] = (char)(c);
+		}
+		packet[length] = '\0';
+		const int high = gdb_getc(gdb), low = gdb_getc(gdb);
+		if(high < 0 || low < 0) return -1;
+		const int match = (hex_digit[high] && hex_digit[low] && ((hex_digit[high] & 0xF) << 4 | (hex_digit[low] & 0xF)) == checksum);
+		send(gdb->fd, match ? "+" : "-", 1, MSG_NOSIGNAL);
+		if(match) return 0;
+	}
+}
+
+/**
+ * Parses a hexadecimal number
+ * @param text	Text (advanced past the digits)
+ * @return		Returns the value
+ */
+static uint64_t gdb_hex(const char** text) {
+	uint64_t value = 0;
+	while(hex_digit[(uint8_t)(**text)]) value = (value << 4) | (hex_digit[(uint8_t)(*(*text)++)] & 0xF);
+	return value;
+}
+
+/**
+ * Writes a register as 8 hexadecimal digits in guest (little endian) byte order
+ * @param p		Output
+ * @param value	Register value
+ * @return		Returns the end of the output
+ */
+static char* gdb_put_register(char* p, uint32_t value) {
+	for(uint32_t i = 0; i < 4; i++) p += sprintf(p, "%02x", (value >> (8 * i)) & 0xFF);
+	return p;
+}
+
+/**
+ * Parses a register in guest (little endian) byte order
+ * @param text	Text (advanced past 8 digits)
+ * @param value	Register value
+ * @return		Returns 0 on success
+ */
+static int gdb_get_register(const char** text, uint32_t* value) {
+	uint32_t result = 0;
+	for(uint32_t i = 0; i < 8; i++) {
+		const uint8_t digit = hex_digit[(uint8_t)((*text)[i])];
+		if(digit == 0) return 1;
+		result |= (uint32_t)(digit & 0xF) << (8 * (i / 2) + 4 * (1 - i % 2));
+	}
+	*text += 8;
+	*value = result;
+	return 0;
+}
+
+/**
+ * Arms or disarms the software breakpoints in the decoded slots (blocks of
+ * their pages are translated again)
+ * @param cpu	Simulator state
+ * @param armed	Arming condition
+ */
+static void gdb_arm(cpu_t* cpu, int armed) {
+	const debug_t* debug = cpu->debug;
+	for(uint32_t i = 0; i < debug->count; i++) {
+		const uint32_t pc = debug->points[i].address;
+		if(debug->points[i].type > 1 || (pc & 1)) continue;
+		page_t* page = code_page(cpu, pc);
+		if(page == NULL) continue;
+		if(armed) {
+			decoded_t* d = code_decoded(cpu->memory, page, pc & PAGE_MASK);
+			d->op = OP_UNKNOWN;
+			if(d->size == 2) {
+				d->handler = op_compressed[OP_UNKNOWN];
+			} else {
+				d->dispatch = OP_UNKNOWN;
+				d->handler = exec_unknown;
+			}
+		} else {
+			page->code[code_slot(pc & PAGE_MASK)].handler = NULL;
+		}
+		page->version++;
+	}
+}
+
+/**
+ * Writes the stop reply of a halted hart (memory fault, unknown instruction,
+ * ebreak or exit code of the halt register), or of a process already gone
+ * when resumed again
+ * @param cpu		Simulator state
+ * @param reply		Stop reply
+ * @param resumed	Resumed after the halt
+ */
+static void gdb_halted(cpu_t* cpu, char* reply, int resumed) {
+	// Halts neither from faults, the halt register nor an ebreak (or c.ebreak)
+	// ending at pc come from unknown instructions
+	const int ebreak = mem_peek(cpu, cpu->pc - 4) == 0x00100073 || (mem_peek(cpu, cpu->pc - 2) & 0xFFFF) == 0x9002;
+	const char* signal = cpu->fault ? "0b" : (!ebreak && !cpu->exited) ? "04" : NULL;
+	if(signal == NULL) sprintf(reply, "W%02x", cpu->exited ? cpu->exit_code & 0xFF : 0);
+	else sprintf(reply, "%c%s", resumed ? 'X' : 'S', signal);
+}
+
+/**
+ * Continues or single-steps the hart until a stop point, a halt or an
+ * interrupt, on the selected engine at full speed (stepping over a
+ * breakpoint at pc first)
+ * @param gdb		Connection
+ * @param config	Simulation settings
+ * @param cpu		Simulator state
+ * @param single	Single step
+ * @return			Returns 0 on success, -1 when the connection is closed
+ */
+static int gdb_resume(gdb_t* gdb, const config_t* config, cpu_t* cpu, int single) {
+	debug_t* debug = cpu->debug;
+	if(!cpu->run) {
+		gdb_halted(cpu, gdb->stop, 1);
+		return 0;
+	}
+	debug->stop = DEBUG_NONE;
+	int interrupted = 0, closed = 0;
+	if(single || debug_breakpoint(debug, cpu->pc)) step(cpu);
+	if(!single && cpu->run) {
+		gdb_arm(cpu, 1);
+		while(cpu->run) {
+			trap_limit(cpu, cpu->instret + GDB_SLICE);
+			config->engine->run(cpu);
+			if(cpu->run && gdb_pending(gdb)) {
+				const int c = gdb_getc(gdb);
+				interrupted = (c == 0x03);
+				closed = (c < 0);
+				if(interrupted || closed) break;
+			}
+		}
+		trap_limit(cpu, UINT64_MAX);
+		gdb_arm(cpu, 0);
+	}
+	if(closed) return -1;
+	// Stop reply (breakpoint, watchpoint, step or interrupt, the hart runnable again)
+	if(debug->stop == DEBUG_WATCH) {
+		static const char* const kind[5] = { "", "", "watch", "rwatch", "awatch" };
+		sprintf(gdb->stop, "T05%s:%08x;", kind[debug->watch_type], debug->watch_address);
+		cpu->run = 1;
+	} else if(debug->stop == DEBUG_BREAKPOINT || (cpu->run && !interrupted)) {
+		strcpy(gdb->stop, "S05");
+		cpu->run = 1;
+	} else if(interrupted) {
+		strcpy(gdb->stop, "S02");
+	} else {
+		gdb_halted(cpu, gdb->stop, 0);
+	}
+	return 0;
+}
 
-					// Atualiza o registrador de destino, exceto x0
-					if (rd != 0) {
-						x[rd] = data;
-					}
+/**
+ * Executes backwards (reverse execution) one instruction or up to a
+ * breakpoint, the last write to a watched byte or the oldest checkpoint
+ * @param gdb		Connection
+ * @param cpu		Simulator state
+ * @param single	Single step
+ */
+static void gdb_reverse(gdb_t* gdb, cpu_t* cpu, int single) {
+	debug_t* debug = cpu->debug;
+	strcpy(gdb->stop, "S05");
+	for(uint64_t steps = 1; ; steps++) {
+		const undo_entry_t* entry = reverse_previous(cpu);
+		if(entry == NULL) {
+			strcpy(gdb->stop, "T05replaylog:begin;");
+			return;
+		}
+		const uint32_t address = entry->address, size = entry->size;
+		reverse_back(cpu);
+		if(single) return;
+		if(size != 0) {
+			debug->stop = DEBUG_NONE;
+			debug_access(cpu, address, size, DEBUG_WRITE);
+			cpu->run = 1;
+			if(debug->stop == DEBUG_WATCH) {
+				sprintf(gdb->stop, "T05%s:%08x;", (debug->watch_type == 2) ? "watch" : "awatch", debug->watch_address);
+				return;
+			}
+		}
+		if(debug_breakpoint(debug, cpu->pc)) return;
+		if(steps % GDB_SLICE == 0 && gdb_pending(gdb) && gdb_getc(gdb) == 0x03) {
+			strcpy(gdb->stop, "S02");
+			return;
+		}
+	}
+}
+
+/**
+ * Writes a part of the target description (RV32 registers x0 to x31 and pc)
+ * @param reply		Reply ("m" and more data, or "l" and the last data)
+ * @param offset	First byte
+ * @param length	Maximum bytes
+ */
+static void gdb_features(char* reply, uint32_t offset, uint32_t length) {
+	static char xml[4096];
+	if(xml[0] == '\0') {
+		char* p = xml + sprintf(xml, "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\"><target version=\"1.0\">"
+			"<architecture>riscv:rv32</architecture><feature name=\"org.gnu.gdb.riscv.cpu\">");
+		for(uint32_t i = 0; i < 32; i++) {
+			p += sprintf(p, "<reg name=\"%s\" bitsize=\"32\" type=\"%s\" regnum=\"%u\"/>", x_label[i], (i == 1) ? "code_ptr" : (i == 2) ? "data_ptr" : "int", i);
+		}
+		sprintf(p, "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\" regnum=\"32\"/></feature></target>");
+	}
+	const size_t size = strlen(xml);
+	if(offset > size) offset = size;
+	if(length > size - offset) length = size - offset;
+	if(length > GDB_PACKET_MAX - 16) length = GDB_PACKET_MAX - 16;
+	reply[0] = (offset + length < size) ? 'm' : 'l';
+	memcpy(&reply[1], &xml[offset], length);
+	reply[1 + length] = '\0';
+}
+
+/**
+ * Serves a debugger until it kills the guest, detaches (the guest then runs
+ * to its end) or closes the connection
+ * @param config	Simulation settings
+ * @param cpu		Simulator state (single hart)
+ * @return			Returns 0 on success
+ */
+static int gdb_serve(const config_t* config, cpu_t* cpu) {
+	gdb_t* gdb = (gdb_t*)(calloc(1, sizeof(gdb_t)));
+	gdb->fd = gdb_accept(config->gdb);
+	if(gdb->fd < 0) {
+		fprintf(stderr, "Erro: nao foi possivel aguardar o depurador em %s\n", config->gdb);
+		free(gdb);
+		return 1;
+	}
+	cpu->debug = (debug_t*)(calloc(1, sizeof(debug_t)));
+	strcpy(gdb->stop, "S05");
+	static char packet[GDB_PACKET_MAX], reply[2 * GDB_PACKET_MAX];
+	int detach = 0;
+	while(gdb_receive(gdb, packet) == 0) {
+		const char* p = &packet[1];
+		reply[0] = '\0';
+		switch(packet[0]) {
+			// Stop reason
+			case '?':
+				strcpy(reply, gdb->stop);
+				break;
+			// Registers (x0 to x31, then pc)
+			case 'g':
+				{
+					char* q = reply;
+					for(uint32_t i = 0; i < 32; i++) q = gdb_put_register(q, cpu->x[i]);
+					gdb_put_register(q, cpu->pc);
 				}
-				//xor
-				if (funct3 == 0b100 && funct7 == 0b00000000)
+				break;
+			case 'G':
 				{
-					uint32_t data;
-
-					// Se rs1 for zero, o resultado será apenas o valor de rs2
-					if (rs1 == 0) {
-						data = x[rs2];  // Não soma nada, apenas copia rs2
-					}
-					if (rs2 == 0)
-					{
-						data = x[rs1];
+					uint32_t values[33];
+					int status = 0;
+					for(uint32_t i = 0; i < 33 && status == 0; i++) status = gdb_get_register(&p, &values[i]);
+					if(status == 0) {
+						memcpy(cpu->x, values, sizeof(cpu->x));
+						cpu->pc = values[32];
 					}
-					
-					 else {
-						data = x[rs1] ^ x[rs2];  // Caso contrário, realiza a soma normal
-					}
-					
-					fprintf(output,"0x%08x:xor    %s,%s,%s       %s=0x%08x^0x%08x=0x%08x\n", 
-						pc, x_label[rd], x_label[rs1], x_label[rs2], x_label[rd], x[rs1], x[rs2], data);
-						
-					if (rd != 0) {
-						x[rd] = data;
-					}	
+					strcpy(reply, (status == 0) ? "OK" : "E01");
 				}
-				//or
-				if (funct3 == 0b110 && funct7 == 0b00000000)
+				break;
+			case 'p':
 				{
-
-					uint32_t data;
-					if (rs1 == 0) {
-						data = x[rs2];  // Não soma nada, apenas copia rs2
-					}
-					if (rs2 == 0)
-					{
-						data = x[rs1];
-					}
-					
-					if (rs1 != 0 && rs2 != 0)
-					 {
-						data = x[rs1] |  x[rs2];  // Caso contrário, realiza a soma normal
-					}
-					
-					fprintf(output,"0x%08x:or    %s,%s,%s       %s=0x%08x|0x%08x=0x%08x\n", 
-						pc, x_label[rd], x_label[rs1], x_label[rs2], x_label[rd], x[rs1], x[rs2], data);
-					if (rd != 0) {
-						x[rd] = data;
-					}	
+					const uint64_t index = gdb_hex(&p);
+					if(index <= 32) gdb_put_register(reply, (index == 32) ? cpu->pc : cpu->x[index]);
+					else strcpy(reply, "E01");
 				}
-				//and 
-				if (funct3 == 0b111 && funct7 == 0b00000000)
+				break;
+			case 'P':
 				{
-					uint32_t data;
-					 if (rs1 == 0 || rs2 == 0) {
-						data = 0x00000000;
+					const uint64_t index = gdb_hex(&p);
+					uint32_t value;
+					if(*p++ == '=' && index <= 32 && gdb_get_register(&p, &value) == 0) {
+						if(index == 32) cpu->pc = value;
+						else cpu->x[index] = value;
+						strcpy(reply, "OK");
 					} else {
-						data = x[rs1] & x[rs2];  // Operação normal de AND
+						strcpy(reply, "E01");
 					}
-	
-					
-					fprintf(output,"0x%08x:and    %s,%s,%s       %s=0x%08x&0x%08x=0x%08x\n", 
-						pc, x_label[rd], x_label[rs1], x_label[rs2], x_label[rd], x[rs1], x[rs2], data);
-					
-					if (rd != 0) {
-						x[rd] = data;
-					}	
-					
 				}
-				//sll
-				if (funct3 == 0b001 && funct7 == 0b00000000)
+				break;
+			// Memory (touched pages, zero elsewhere inside memory)
+			case 'm':
+			case 'M':
 				{
-					uint32_t shift_amount = x[rs2] & 0x1F;  // Apenas os 5 bits menos significativos
-					uint32_t result_sll = x[rs1] << shift_amount;
-
-					x[rd] = result_sll;
-
-					fprintf(output,"0x%08x:sll    %s,%s,%s       %s=0x%08x<<%d=0x%08x\n", 
-						pc, x_label[rd], x_label[rs1], x_label[rs2], x_label[rd], x[rs1], shift_amount, result_sll);
+					const uint32_t address = (uint32_t)(gdb_hex(&p));
+					uint32_t length = (*p++ == ',') ? (uint32_t)(gdb_hex(&p)) : 0;
+					if(length > GDB_PACKET_MAX / 2 - 16) length = GDB_PACKET_MAX / 2 - 16;
+					// Stopping at the end of memory
+					const uint32_t available = cpu->memory->base + cpu->memory->size - address;
+					if(address - cpu->memory->base >= cpu->memory->size) length = 0;
+					else if(length > available) length = available;
+					if(length == 0) {
+						strcpy(reply, "E14");
+					} else if(packet[0] == 'm') {
+						for(uint32_t i = 0; i < length; i++) sprintf(&reply[2 * i], "%02x", mem_peek(cpu, address + i) & 0xFF);
+					} else if(*p++ == ':') {
+						for(uint32_t i = 0; i < length && hex_digit[(uint8_t)(p[0])] && hex_digit[(uint8_t)(p[1])]; i++, p += 2) {
+							mem_poke(cpu, address + i, 1, (hex_digit[(uint8_t)(p[0])] & 0xF) << 4 | (hex_digit[(uint8_t)(p[1])] & 0xF));
+						}
+						strcpy(reply, "OK");
+					} else {
+						strcpy(reply, "E01");
+					}
 				}
-				//srl
-				if (funct3 == 0b101 && funct7 == 0b00000000)
+				break;
+			// Continue and single step (optionally from an address)
+			case 'c':
+			case 's':
+				if(*p != '\0') cpu->pc = (uint32_t)(gdb_hex(&p));
+				if(gdb_resume(gdb, config, cpu, packet[0] == 's') != 0) goto closed;
+				strcpy(reply, gdb->stop);
+				break;
+			// Reverse continue and step (reverse execution)
+			case 'b':
+				if(cpu->reverse == NULL || (*p != 'c' && *p != 's')) break;
+				gdb_reverse(gdb, cpu, *p == 's');
+				strcpy(reply, gdb->stop);
+				break;
+			// Stop points (address and length; breakpoints are armed on continue)
+			case 'Z':
+			case 'z':
 				{
-					uint32_t shamt = x[rs2] & 0x1F; // Pega apenas os 5 bits menos significativos para o deslocamento
-					uint32_t result_srl = x[rs1] >> shamt; 
-					
-					x[rd] = result_srl; 
-
-					fprintf(output,"0x%08x:srl    %s,%s,%s       %s=0x%08x>>%d=0x%08x\n", 
-							pc, x_label[rd], x_label[rs1], x_label[rs2], 
-							x_label[rd], x[rs1], shamt, result_srl);
+					debug_t* debug = cpu->debug;
+					const uint8_t type = (uint8_t)(gdb_hex(&p));
+					const uint32_t address = (*p++ == ',') ? (uint32_t)(gdb_hex(&p)) : 0;
+					const uint32_t length = (*p++ == ',') ? (uint32_t)(gdb_hex(&p)) : 0;
+					if(type > 4) break;
+					uint32_t i = 0;
+					while(i < debug->count && (debug->points[i].type != type || debug->points[i].address != address || debug->points[i].length != length)) i++;
+					if(packet[0] == 'Z' && i == debug->count) {
+						if(debug->count == DEBUG_POINTS_MAX || (type >= 2 && length == 0)) {
+							strcpy(reply, "E01");
+							break;
+						}
+						debug->points[debug->count++] = (debug_point_t){ address, length, type };
+					} else if(packet[0] == 'z' && i < debug->count) {
+						debug->points[i] = debug->points[--debug->count];
+					}
+					// Flushing the data TLB (watched pages stay out of it)
+					if(type >= 2) {
+						for(uint32_t k = 0; k < TLB_SIZE; k++) cpu->dtlb[k].tag = TLB_INVALID;
+					}
+					strcpy(reply, "OK");
 				}
-				//sra
-				if (funct3 == 0b101 && funct7 == 0b0100000 )
-				{
-					int32_t sig_value = (int32_t)x[rs1];
-					int32_t shamt = x[rs2] & 0x1F;  // Apenas os 5 bits menos significativos
-					int32_t result_sra = sig_value >> shamt;
-
-					x[rd] = result_sra;
-
-					fprintf(output,"0x%08x:sra    %s,%s,%s       %s=0x%08x>>>%d=0x%08x\n", 
-							pc, x_label[rd], x_label[rs1], x_label[rs2], 
-							x_label[rd], x[rs1], shamt, result_sra);
+				break;
+			// Detach (the guest runs to its end) and kill
+			case 'D':
+				gdb_send(gdb, "OK");
+				detach = 1;
+				goto closed;
+			case 'k':
+				goto closed;
+			// Thread selection and liveness (a single thread)
+			case 'H':
+			case 'T':
+				strcpy(reply, "OK");
+				break;
+			// Queries
+			case 'q':
+				if(strncmp(packet, "qSupported", 10) == 0) {
+					sprintf(reply, "PacketSize=%x;qXfer:features:read+;swbreak+;hwbreak+%s", GDB_PACKET_MAX, (cpu->reverse != NULL) ? ";ReverseStep+;ReverseContinue+" : "");
+				} else if(strncmp(packet, "qXfer:features:read:target.xml:", 31) == 0) {
+					p = &packet[31];
+					const uint32_t offset = (uint32_t)(gdb_hex(&p));
+					const uint32_t length = (*p++ == ',') ? (uint32_t)(gdb_hex(&p)) : 0;
+					gdb_features(reply, offset, length);
+				} else if(strcmp(packet, "qAttached") == 0) {
+					strcpy(reply, "1");
+				} else if(strcmp(packet, "qC") == 0) {
+					strcpy(reply, "QC1");
+				} else if(strcmp(packet, "qfThreadInfo") == 0) {
+					strcpy(reply, "m1");
+				} else if(strcmp(packet, "qsThreadInfo") == 0) {
+					strcpy(reply, "l");
 				}
-				//slt
-				if (funct3 == 0b010 && funct7 == 0b00000000)
-				{
-					int32_t rs1_value = (rs1 == 0) ? 0 : (int32_t)x[rs1];  // Força rs1 = 0 se for zero
-					int32_t rs2_value = (int32_t)x[rs2];
-					int32_t result = (rs1_value < rs2_value) ? 1 : 0;
+				break;
+			// Unsupported (empty reply)
+			default:
+				break;
+		}
+		gdb_send(gdb, reply);
+	}
+closed:
+	close(gdb->fd);
+	free(gdb);
+	free(cpu->debug);
+	cpu->debug = NULL;
+	// Running to the end after a detach, halting otherwise
+	if(detach && cpu->run) config->engine->run(cpu);
+	cpu->run = 0;
+	return 0;
+}
 
-					// Apenas escreve se rd != x0
-					if (rd != 0) {
-						x[rd] = result;
-					}
+/**
+ * Moves a halted hart back in time as requested (last write of an address,
+ * then instructions stepped back, then an instruction count), outputting
+ * where it stopped to the console
+ * @param config	Simulation settings
+ * @param cpu		Simulator state (single hart)
+ */
+static void reverse_query(const config_t* config, cpu_t* cpu) {
+	if(config->reverse_last_write != UINT64_MAX) {
+		const uint32_t address = (uint32_t)(config->reverse_last_write);
+		if(reverse_last_write(cpu, address)) printf("reverse last-write=0x%08x instruction=%llu pc=0x%08x\n", address, (unsigned long long)cpu->instret, cpu->pc);
+		else printf("reverse last-write=0x%08x none\n", address);
+	}
+	if(config->reverse_back != 0) {
+		const uint64_t target = (cpu->instret > config->reverse_back) ? cpu->instret - config->reverse_back : 0;
+		if(reverse_goto(cpu, target) != 0) fprintf(stderr, "Erro: instrucao %llu fora da janela de execucao reversa\n", (unsigned long long)target);
+		printf("reverse step-back=%llu instruction=%llu pc=0x%08x\n", (unsigned long long)config->reverse_back, (unsigned long long)cpu->instret, cpu->pc);
+	}
+	if(config->reverse_to != UINT64_MAX) {
+		if(reverse_goto(cpu, config->reverse_to) != 0) fprintf(stderr, "Erro: instrucao %llu fora da janela de execucao reversa\n", (unsigned long long)config->reverse_to);
+		printf("reverse goto=%llu instruction=%llu pc=0x%08x\n", (unsigned long long)config->reverse_to, (unsigned long long)cpu->instret, cpu->pc);
+	}
+}
 
-					// Usa rs1_value (corrigido) para exibição correta
-					fprintf(output, "0x%08x:slt     %s,%s,%s         %s=(0x%08x<0x%08x)=%d\n", 
-							pc, x_label[rd], x_label[rs1], x_label[rs2], 
-							x_label[rd], rs1_value, rs2_value, result);
-					
+/**
+ * Simulates an image with isolated memory, harts and trace buffers
+ * @param config	Simulation settings
+ * @param job		Image (results are stored back)
+ * @param input		Input hexadecimal file, ELF executable or snapshot
+ * @param output	Trace file (hart 0, or every hart in a merged trace)
+ * @return			Returns 0 on success
+ */
+static int simulate(const config_t* config, job_t* job, FILE* input, FILE* output) {
+	const uint32_t hart_count = config->hart_count;
+	const uint8_t merge_trace = config->merge_trace;
+	int status = 0;
+	// Creating memory for both data and instructions (pages allocated on first touch)
+	memory_t memory;
+	mem_create(&memory, MEM_OFFSET, config->mem_size);
+	if(config->devices) memory.devices = device_create(config->device_base, hart_count);
+	// Creating harts with 32 registers initialized with zero, sharing the memory
+	cpu_t* harts[HARTS_MAX];
+	for(uint32_t k = 0; k < hart_count; k++) {
+		cpu_t* cpu = hart_create(&memory, k);
+		harts[k] = cpu;
+		// Selecting traced instructions (a range or window restricts tracing)
+		cpu->trace_mode = config->trace_mode;
+		cpu->trace_pc_first = config->trace_pc_first;
+		cpu->trace_pc_span = config->trace_pc_last - config->trace_pc_first;
+		cpu->trace_first = config->trace_first;
+		cpu->trace_count = config->trace_count;
+		if(config->trace_mode == TRACE_ALL && (config->trace_pc_first != 0 || config->trace_pc_last != 0xFFFFFFFF || config->trace_first != 0 || config->trace_count != UINT64_MAX)) {
+			cpu->trace_mode = TRACE_FILTER;
+		}
+		// Creating trace buffer (hart k > 0 writes "output.hart<k>", unless merged)
+		cpu->trace_binary = config->trace_binary;
+		cpu->trace_merged = merge_trace && hart_count > 1;
+		if(k > 0 && merge_trace) {
+			cpu->trace = harts[0]->trace;
+		} else {
+			cpu->trace = (trace_buffer_t*)(calloc(1, sizeof(trace_buffer_t)));
+			cpu->trace->data = (char*)(malloc(TRACE_BUFFER_SIZE));
+			cpu->trace->file = output;
+			if(k > 0) {
+				char name[FILENAME_MAX];
+				snprintf(name, sizeof(name), "%s.hart%u", job->output, k);
+				cpu->trace->file = (config->trace_mode != TRACE_OFF) ? fopen(name, "w") : NULL;
+				if(config->trace_mode != TRACE_OFF && cpu->trace->file == NULL) {
+					fprintf(stderr, "Erro: nao foi possivel abrir %s\n", name);
+					status = 1;
 				}
+			}
+			// Binary records start with the file header
+			if(config->trace_binary && cpu->trace->file != NULL) {
+				const uint32_t header[2] = { TRACE_MAGIC, sizeof(trace_record_t) };
+				fwrite(header, sizeof(header), 1, cpu->trace->file);
+			}
+		}
+		// Creating timing model and branch predictors (observed with the trace on the engines' slow path)
+		if(config->timing) cpu->timing = timing_create(&config->timing_config);
+		if(config->predictor_count != 0) cpu->branches = branch_create(config->predictors, config->predictor_count);
+		cpu->profile = config->profile;
+		cpu->snapshot = (config->snapshot.file != NULL) ? &config->snapshot : NULL;
+		// Creating sampler (keeping the side channels it detaches) and basic block vectors
+		if(config->sample_period != 0) {
+			cpu->sample = (sample_t*)(calloc(1, sizeof(sample_t)));
+			cpu->sample->period = config->sample_period;
+			cpu->sample->window = config->sample_window;
+			cpu->sample->warmup = config->sample_warmup;
+			cpu->sample->trace_mode = cpu->trace_mode;
+			cpu->sample->timing = cpu->timing;
+			cpu->sample->branches = cpu->branches;
+			cpu->sample->profile = cpu->profile;
+		}
+		if(config->bbv_file != NULL) {
+			FILE* file = fopen(config->bbv_file, "w");
+			if(file == NULL) {
+				fprintf(stderr, "Erro: nao foi possivel abrir %s\n", config->bbv_file);
+				status = 1;
+			} else {
+				cpu->bbv = bbv_create(file, config->bbv_interval);
+			}
+		}
+		if(config->reverse_checkpoints != 0) cpu->reverse = reverse_create(config->reverse_checkpoints, config->reverse_interval);
+		observe_update(cpu);
+	}
+	if(memory.devices != NULL) memory.devices->cpus = harts;
+	// Reading memory contents from input hexadecimal file, ELF executable or
+	// snapshot (timed); harts start at the ELF entry point
+	struct timespec load_start, load_end;
+	clock_gettime(CLOCK_MONOTONIC, &load_start);
+	symbols_t symbols = { NULL, 0, NULL };
+	uint32_t entry = MEM_OFFSET;
+	const int elf = status == 0 && !config->restore && load_is_elf(input);
+	if(status == 0 && (config->restore ? snapshot_load(&memory, harts[0], input) : elf ? load_elf(&memory, &symbols, input, &entry) : load_hex(&memory, input)) != 0) status = 1;
+	clock_gettime(CLOCK_MONOTONIC, &load_end);
+	for(uint32_t k = 0; k < hart_count && elf; k++) {
+		harts[k]->pc = entry;
+		harts[k]->symbols = (symbols.count != 0) ? &symbols : NULL;
+	}
+	if(status == 0 && config->verbose) {
+		if(elf) printf("elf entry=0x%08x symbols=%u\n", entry, symbols.count);
+		printf("load=%.6fs\n", (load_end.tv_sec - load_start.tv_sec) + (load_end.tv_nsec - load_start.tv_nsec) / 1e9);
+		// Outputting separator
+		printf("--------------------------------------------------------------------------------\n");
+	}
+	// Running selected engine (timed): a single hart on this thread, merged
+	// harts round-robin on this thread, or one host thread per hart
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if(status != 0) {
+		// Nothing to run
+	} else if(hart_count == 1 && config->gdb != NULL) {
+		status = gdb_serve(config, harts[0]);
+	} else if(hart_count == 1 && config->cosim) {
+		status = run_cosim(config->engine, harts[0]);
+	} else if(hart_count == 1 && harts[0]->sample != NULL) {
+		run_sampled(config->engine->run, harts[0]);
+	} else if(hart_count == 1) {
+		config->engine->run(harts[0]);
+	} else if(merge_trace) {
+		run_merged(harts, hart_count);
+	} else {
+		hart_t threads[HARTS_MAX];
+		uint32_t started = 0;
+		for(; started < hart_count; started++) {
+			threads[started].cpu = harts[started];
+			threads[started].engine = config->engine;
+			if(pthread_create(&threads[started].thread, NULL, hart_thread, &threads[started]) != 0) {
+				fprintf(stderr, "Erro: nao foi possivel criar a thread do hart %u\n", started);
+				// Halting the harts already started
+				for(uint32_t k = 0; k < started; k++) harts[k]->run = 0;
+				status = 1;
+				break;
+			}
+		}
+		for(uint32_t k = 0; k < started; k++) pthread_join(threads[k].thread, NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	// Moving back in time (single hart)
+	if(status == 0 && harts[0]->reverse != NULL) reverse_query(config, harts[0]);
+	// Storing results
+	job->status = status;
+	job->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	job->instret = 0;
+	job->fault = 0;
+	job->cycles = 0;
+	job->exited = harts[0]->exited;
+	job->exit_code = harts[0]->exit_code;
+	for(uint32_t k = 0; k < hart_count; k++) {
+		job->instret += harts[k]->instret;
+		job->fault |= harts[k]->fault;
+		// Harts run in parallel (the slowest one sets the cycles)
+		if(harts[k]->timing != NULL && harts[k]->timing->cycles > job->cycles) job->cycles = harts[k]->timing->cycles;
+	}
+	// Writing remaining console output, trace lines and records
+	if(memory.devices != NULL) device_flush(memory.devices);
+	for(uint32_t k = 0; k < hart_count; k++) {
+		if((k > 0 && merge_trace) || harts[k]->trace->file == NULL) continue;
+		trace_flush(harts[k]->trace);
+		if(k > 0) fclose(harts[k]->trace->file);
+	}
+	if(status == 0 && config->verbose) {
+		// Outputting separator
+		printf("--------------------------------------------------------------------------------\n");
+		// Outputting final registers and throughput
+		print_summary(harts, hart_count, job->seconds);
+	}
+	// Writing final memory
+	if(status == 0 && job->dump != NULL) {
+		FILE* dump = fopen(job->dump, "w");
+		if(dump == NULL) {
+			fprintf(stderr, "Erro: nao foi possivel abrir %s\n", job->dump);
+			job->status = status = 1;
+		} else {
+			dump_memory(&memory, dump);
+			fclose(dump);
+		}
+	}
+	// Releasing harts and memory
+	for(uint32_t k = 0; k < hart_count; k++) hart_destroy(harts[k], k == 0 || !merge_trace);
+	if(memory.devices != NULL) device_destroy(memory.devices);
+	mem_destroy(&memory);
+	free(symbols.entries);
+	free(symbols.names);
+	return status;
+}
 
-					
-				
-				//sltu
-				if (funct3 == 0b011 && funct7 == 0b00000000)
-				{
-					uint32_t rs1_value = (rs1 == 0) ? 0 : (uint32_t)x[rs1];  // Força rs1 = 0 se for zero
-					uint32_t rs2_value = (uint32_t)x[rs2];
-					uint32_t result = (rs1_value < rs2_value) ? 1 : 0;
-
-					// Apenas escreve se rd != x0
-					if (rd != 0) {
-						x[rd] = result;
-					}
-
-					// Usa rs1_value (corrigido) para exibição correta
-					fprintf(output, "0x%08x:sltu     %s,%s,%s         %s=(0x%08x<0x%08x)=%d\n", 
-							pc, x_label[rd], x_label[rs1], x_label[rs2], 
-							x_label[rd], rs1_value, rs2_value, result);
-					
-				}
-				
+// Batch worker: a deque of job indexes (the owner pops the bottom, idle
+// workers steal the top)
+typedef struct worker worker_t;
+
+// Batch pool
+typedef struct {
+	const config_t* config;
+	job_t* jobs;
+	worker_t* workers;
+	uint32_t count;
+} pool_t;
+
+struct worker {
+	pool_t* pool;
+	uint32_t index;
+	uint32_t* queue;
+	uint32_t top;
+	uint32_t bottom;
+	pthread_mutex_t lock;
+	pthread_t thread;
+};
 
-	
-			break;
+/**
+ * Takes a job index from a worker deque
+ * @param worker	Worker
+ * @param steal		Takes the top (stealing) instead of the bottom (owner)
+ * @param job		Job index
+ * @return			Returns 1 if a job was taken
+ */
+static int worker_take(worker_t* worker, int steal, uint32_t* job) {
+	int taken = 0;
+	pthread_mutex_lock(&worker->lock);
+	if(worker->top < worker->bottom) {
+		*job = steal ? worker->queue[worker->top++] : worker->queue[--worker->bottom];
+		taken = 1;
 	}
+	pthread_mutex_unlock(&worker->lock);
+	return taken;
+}
 
-			// S Type (0100011)
-			case 0b0100011:
-			// sw (funct3 == 010)
-				if (funct3 == 0b010) {
-					// Cálculo do imediato para SW (S-type)
-					uint32_t imm_sw = ((instruction >> 25) << 5) | ((instruction >> 7) & 0x1F);
+/**
+ * Runs a batch job: opens its files and simulates it
+ * @param config	Simulation settings
+ * @param job		Image
+ */
+static void job_run(const config_t* config, job_t* job) {
+	FILE* input = fopen(job->input, "r");
+	FILE* output = fopen(job->output, "w");
+	if(input == NULL || output == NULL) {
+		fprintf(stderr, "Erro: nao foi possivel abrir %s ou %s\n", job->input, job->output);
+		job->status = 1;
+	} else {
+		simulate(config, job, input, output);
+	}
+	if(input != NULL) fclose(input);
+	if(output != NULL) fclose(output);
+}
 
-					// Extensão de sinal para 12 bits
-					int32_t simm_sw = ((int32_t)(imm_sw << 20)) >> 20;
+/**
+ * Runs jobs from the worker deque, then steals from the others until every
+ * deque is empty (batch host thread entry)
+ * @param argument	Worker
+ * @return			Returns NULL
+ */
+static void* worker_thread(void* argument) {
+	worker_t* worker = (worker_t*)(argument);
+	pool_t* pool = worker->pool;
+	uint32_t job;
+	for(;;) {
+		int taken = worker_take(worker, 0, &job);
+		for(uint32_t i = 1; !taken && i < pool->count; i++) {
+			taken = worker_take(&pool->workers[(worker->index + i) % pool->count], 1, &job);
+		}
+		if(!taken) return NULL;
+		job_run(pool->config, &pool->jobs[job]);
+	}
+}
 
-					// Cálculo do endereço de memória (rs1 + offset)
-					uint32_t address = x[rs1] + simm_sw;
+/**
+ * Compares job input sizes (descending)
+ * @param a	First job (size and index)
+ * @param b	Second job (size and index)
+ * @return	Returns the ordering
+ */
+static int job_size_compare(const void* a, const void* b) {
+	const uint64_t size_a = ((const uint64_t*)(a))[0], size_b = ((const uint64_t*)(b))[0];
+	return (size_a < size_b) - (size_a > size_b);
+}
 
-					// Armazena a palavra (32 bits) de rs2 na memória (endereçamento por byte)
-					*(uint32_t*)(mem + (address - offset)) = x[rs2];
+/**
+ * Runs a manifest of "input output [dump]" lines on a work-stealing pool and
+ * outputs per-image and aggregate results
+ * @param config		Simulation settings
+ * @param manifest		Manifest file
+ * @param worker_count	Host threads
+ * @return				Returns 0 if every image ran
+ */
+static int run_batch(const config_t* config, FILE* manifest, uint32_t worker_count) {
+	// Reading jobs (blank lines and '#' comments are skipped)
+	job_t* jobs = NULL;
+	uint32_t count = 0, capacity = 0;
+	char line[3 * FILENAME_MAX];
+	for(uint32_t number = 1; fgets(line, sizeof(line), manifest) != NULL; number++) {
+		char* save;
+		char* input = strtok_r(line, " \t\r\n", &save);
+		if(input == NULL || input[0] == '#') continue;
+		char* output = strtok_r(NULL, " \t\r\n", &save);
+		char* dump = strtok_r(NULL, " \t\r\n", &save);
+		if(output == NULL || strtok_r(NULL, " \t\r\n", &save) != NULL) {
+			fprintf(stderr, "Erro: linha %u do manifesto invalida (entrada saida [dump])\n", number);
+			return 1;
+		}
+		if(count == capacity) {
+			capacity = capacity ? 2 * capacity : 64;
+			jobs = (job_t*)(realloc(jobs, capacity * sizeof(job_t)));
+		}
+		jobs[count++] = (job_t){ .input = strdup(input), .output = strdup(output), .dump = dump ? strdup(dump) : NULL };
+	}
+	if(worker_count > count) worker_count = count ? count : 1;
+	// Dealing jobs to the workers, largest inputs first (long runs start early)
+	uint64_t (*order)[2] = calloc(count ? count : 1, sizeof(*order));
+	for(uint32_t j = 0; j < count; j++) {
+		struct stat info;
+		order[j][0] = (stat(jobs[j].input, &info) == 0) ? (uint64_t)info.st_size : 0;
+		order[j][1] = j;
+	}
+	qsort(order, count, sizeof(*order), job_size_compare);
+	pool_t pool = { config, jobs, (worker_t*)(calloc(worker_count, sizeof(worker_t))), worker_count };
+	for(uint32_t w = 0; w < worker_count; w++) {
+		worker_t* worker = &pool.workers[w];
+		worker->pool = &pool;
+		worker->index = w;
+		worker->queue = (uint32_t*)(calloc(count / worker_count + 1, sizeof(uint32_t)));
+		pthread_mutex_init(&worker->lock, NULL);
+	}
+	// The owner pops the bottom, so each deque holds its jobs smallest first
+	for(uint32_t j = count; j-- > 0; ) {
+		worker_t* worker = &pool.workers[j % worker_count];
+		worker->queue[worker->bottom++] = (uint32_t)order[j][1];
+	}
+	// Running workers (timed)
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(uint32_t w = 0; w < worker_count; w++) {
+		if(pthread_create(&pool.workers[w].thread, NULL, worker_thread, &pool.workers[w]) != 0) {
+			fprintf(stderr, "Erro: nao foi possivel criar a thread do worker %u\n", w);
+			return 1;
+		}
+	}
+	for(uint32_t w = 0; w < worker_count; w++) pthread_join(pool.workers[w].thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	const double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	// Outputting per-image results (manifest order)
+	uint64_t instret = 0;
+	uint32_t failed = 0;
+	for(uint32_t j = 0; j < count; j++) {
+		const job_t* job = &jobs[j];
+		printf("%s instructions=%llu time=%.6fs mips=%.2f", job->input, (unsigned long long)job->instret, job->seconds, job->seconds > 0 ? job->instret / job->seconds / 1e6 : 0.0);
+		if(config->timing) printf(" cycles=%llu", (unsigned long long)job->cycles);
+		if(job->status) printf(" error");
+		else if(job->fault) printf(" fault");
+		else if(job->exited && job->exit_code != 0) printf(" exit=%u", job->exit_code);
+		printf("\n");
+		instret += job->instret;
+		failed += (job->status != 0 || job->fault || (job->exited && job->exit_code != 0));
+	}
+	// Outputting separator
+	printf("--------------------------------------------------------------------------------\n");
+	// Outputting aggregate throughput (wall time of the whole batch)
+	printf("images=%u failed=%u workers=%u instructions=%llu time=%.6fs mips=%.2f\n", count, failed, worker_count, (unsigned long long)instret, seconds, seconds > 0 ? instret / seconds / 1e6 : 0.0);
+	// Releasing jobs and workers
+	for(uint32_t j = 0; j < count; j++) {
+		free((char*)(jobs[j].input));
+		free((char*)(jobs[j].output));
+		free((char*)(jobs[j].dump));
+	}
+	for(uint32_t w = 0; w < worker_count; w++) {
+		free(pool.workers[w].queue);
+		pthread_mutex_destroy(&pool.workers[w].lock);
+	}
+	free(pool.workers);
+	free(order);
+	free(jobs);
+	return failed != 0;
+}
 
-					// Exibe a instrução no console
-					fprintf(output,"0x%08x:sw     %s,0x%03x(%s)    mem[0x%08x]=0x%08x\n",
-						pc, x_label[rs2], simm_sw, x_label[rs1], address, x[rs2]);
+/**
+ * Main function
+ * @param argc	Number of command line arguments
+ * @param argv	Command line arguments
+ * @return		Returns the program execution status
+ */
+int main(int argc, char* argv[]) {
+	// Outputting separator
+	printf("--------------------------------------------------------------------------------\n");
+	// Iterating over arguments
+	for(uint32_t i = 0; i < argc; i++) {
+		// Outputting argument
+		printf("argv[%i] = %s\n", i, argv[i]);
+	}
+	// Parsing options (tracing every instruction by default)
+	const engine_t* engine = &engines[0];
+	const char* dump_file = NULL;
+	uint8_t trace_binary = 0, render = 0;
+	uint32_t mem_size = MEM_SIZE_DEFAULT;
+	uint32_t hart_count = 1;
+	uint8_t merge_trace = 0;
+	const char* batch_file = NULL;
+	uint8_t timing = 0;
+	timing_config_t timing_config = timing_default;
+	uint32_t predictor_count = 0;
+	predictor_config_t predictors[PREDICTORS_MAX] = { 0 };
+	uint32_t profile = 0;
+	snapshot_point_t snapshot = { NULL, UINT64_MAX, TLB_INVALID };
+	uint8_t restore = 0;
+	unsigned long long sample_period = 0, sample_window = 0, sample_warmup = 0;
+	const char* bbv_file = NULL;
+	unsigned long long bbv_interval = 10000000;
+	unsigned int reverse_checkpoints = 0;
+	unsigned long long reverse_interval = 100000;
+	unsigned long long reverse_last_write = UINT64_MAX, reverse_back = 0, reverse_to = UINT64_MAX;
+	const char* gdb = NULL;
+	uint8_t cosim = 0;
+	const generate_mix_t* generate_mix = NULL;
+	unsigned long long generate_length = 1000000, generate_seed = 1;
+	uint8_t devices = 0;
+	uint32_t device_base[DEVICE_COUNT];
+	const long online = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t jobs = (online > 0) ? (uint32_t)online : 1;
+	uint8_t trace_mode = TRACE_ALL;
+	uint32_t trace_pc_first = 0, trace_pc_last = 0xFFFFFFFF;
+	unsigned long long trace_first = 0, trace_count = UINT64_MAX;
+	static const struct option options[] = {
+		{ "engine", required_argument, NULL, 'e' },
+		{ "trace", required_argument, NULL, 't' },
+		{ "trace-pc", required_argument, NULL, 'p' },
+		{ "trace-window", required_argument, NULL, 'w' },
+		{ "dump-mem", required_argument, NULL, 'd' },
+		{ "trace-format", required_argument, NULL, 'f' },
+		{ "render", no_argument, NULL, 'r' },
+		{ "mem-size", required_argument, NULL, 'm' },
+		{ "harts", required_argument, NULL, 'n' },
+		{ "merge-trace", no_argument, NULL, 'M' },
+		{ "batch", required_argument, NULL, 'b' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ "timing", optional_argument, NULL, 'T' },
+		{ "bpred", required_argument, NULL, 'B' },
+		{ "profile", optional_argument, NULL, 'P' },
+		{ "snapshot", required_argument, NULL, 's' },
+		{ "snapshot-at", required_argument, NULL, 'a' },
+		{ "snapshot-pc", required_argument, NULL, 'c' },
+		{ "restore", no_argument, NULL, 'R' },
+		{ "sample", required_argument, NULL, 'S' },
+		{ "bbv", required_argument, NULL, 'V' },
+		{ "reverse", optional_argument, NULL, 'u' },
+		{ "last-write", required_argument, NULL, 'W' },
+		{ "step-back", required_argument, NULL, 'k' },
+		{ "goto", required_argument, NULL, 'g' },
+		{ "gdb", required_argument, NULL, 'G' },
+		{ "cosim", no_argument, NULL, 'C' },
+		{ "generate", required_argument, NULL, 'X' },
+		{ "devices", optional_argument, NULL, 'D' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int option;
+	while((option = getopt_long(argc, argv, "e:t:p:w:d:f:rm:n:Mb:j:T::B:P::s:a:c:RS:V:u::W:k:g:G:CX:D::", options, NULL)) != -1) {
+		switch(option) {
+			// Execution engine
+			case 'e':
+				engine = NULL;
+				for(uint32_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+					if(strcmp(optarg, engines[i].name) == 0) engine = &engines[i];
 				}
-				//sb
-				if (funct3 == 0b000)
-				{
-					// Cálculo do imediato para SW (S-type)
-					uint32_t imm_sb = ((instruction >> 25) << 5) | ((instruction >> 7) & 0x1F);
-
-					// Extensão de sinal para 12 bits
-					int32_t simm_sb = ((int32_t)(imm_sb << 20)) >> 20;
-
-					// Cálculo do endereço de memória (rs1 + offset)
-					uint32_t address = x[rs1] + simm_sb;
-
-					// Armazena a palavra (32 bits) de rs2 na memória (endereçamento por byte)
-					*(uint8_t*)(mem + (address - offset)) =(uint8_t)x[rs2];
-
-					// Exibe a instrução no console
-					fprintf(output,"0x%08x:sb    %s,0x%03x(%s)    mem[0x%08x]=0x%02x\n",
-						pc, x_label[rs2], simm_sb, x_label[rs1], address, (uint8_t)x[rs2]);
+				if(engine == NULL) {
+					fprintf(stderr, "Erro: engine desconhecida: %s\n", optarg);
+					return 1;
 				}
-				//sh
-				if (funct3 == 0b001)
-				{
-					// Cálculo do imediato para SW (S-type)
-					uint32_t imm_sh = ((instruction >> 25) << 5) | ((instruction >> 7) & 0x1F);
-
-					// Extensão de sinal para 12 bits
-					int32_t simm_sh = ((int32_t)(imm_sh << 20)) >> 20;
-
-					// Cálculo do endereço de memória (rs1 + offset)
-					uint32_t address = x[rs1] + simm_sh;
-
-					// Armazena a palavra (32 bits) de rs2 na memória (endereçamento por byte)
-					*(uint16_t*)(mem + (address - offset)) = (uint16_t)x[rs2];
-
-					// Exibe a instrução no console
-					fprintf(output,"0x%08x:sw     %s,0x%03x(%s)    mem[0x%08x]=0x%08x\n",
-						pc, x_label[rs2], simm_sh, x_label[rs1], address, (uint16_t)x[rs2]);
+				break;
+			// Trace on or off
+			case 't':
+				if(strcmp(optarg, "on") == 0) trace_mode = TRACE_ALL;
+				else if(strcmp(optarg, "off") == 0) trace_mode = TRACE_OFF;
+				else {
+					fprintf(stderr, "Erro: trace deve ser on ou off: %s\n", optarg);
+					return 1;
 				}
-				
-				
 				break;
-			// I type (1110011)
-			case 0b1110011:
-				// ebreak (funct3 == 000 and imm == 1)
-				if(funct3 == 0b000 && imm == 1) {
-					// Outputting instruction to console
-					fprintf(output,"0x%08x:ebreak\n", pc);
-					// Retrieving previous and next instructions
-					const uint32_t previous = ((uint32_t*)(mem))[(pc - 4 - offset) >> 2];
-					const uint32_t next = ((uint32_t*)(mem))[(pc + 4 - offset) >> 2];
-					// Halting condition
-            		if(previous == 0x01f01013 && next == 0x40705013) run = 0;
+			// Traced PC range
+			case 'p':
+				if(sscanf(optarg, "%x:%x", &trace_pc_first, &trace_pc_last) != 2 || trace_pc_last < trace_pc_first) {
+					fprintf(stderr, "Erro: intervalo de pc invalido: %s\n", optarg);
+					return 1;
 				}
-				// Breaking case
 				break;
-			// blt Type (110011)
-			case 0b1100011:
-				//blt
-				if(funct3 == 0b100){
-					// Extração do imediato para instruções de branch
-					int32_t imm_b = 0;
-
-					imm_b |= ((instruction >> 31) & 0x1) << 12;  // Bit 12 (sinal)
-					imm_b |= ((instruction >> 7) & 0x1) << 11;   // Bit 11
-					imm_b |= ((instruction >> 25) & 0x3F) << 5;  // Bits 10-5
-					imm_b |= ((instruction >> 8) & 0xF) << 1;    // Bits 4-1
-
-					// Extensão de sinal explícita
-					if (imm_b & 0x1000) {  // Se o bit 12 (sinal) for 1
-					    imm_b |= 0xFFFFE000;  // Estende para 32 bits negativos
-					}
- 
-
-					
-
-						uint32_t pc_original = pc;
-						
-						int condition = ((int32_t)x[rs1] < (int32_t)x[rs2]) ? 1 : 0;
-
-						pc = condition ? (pc + imm_b) : (pc + 4);
-
-						
-
-						// Impressão ajustada para exibir o imediato corretamente
-						fprintf(output,"0x%08x:blt    %s,%s,0x%03x   (0x%08x<0x%08x)=%d->pc=0x%08x\n",
-							pc_original, x_label[rs1], x_label[rs2],
-							(uint32_t)((imm_b >> 1) & 0xFFF),  
-							x[rs1], x[rs2], condition, pc);
-
-						
-					
+			// Traced instruction window
+			case 'w':
+				if(sscanf(optarg, "%llu:%llu", &trace_first, &trace_count) != 2) {
+					fprintf(stderr, "Erro: janela de instrucoes invalida: %s\n", optarg);
+					return 1;
+				}
+				break;
+			// Final memory dump
+			case 'd':
+				dump_file = optarg;
+				break;
+			// Trace format
+			case 'f':
+				if(strcmp(optarg, "text") == 0) trace_binary = 0;
+				else if(strcmp(optarg, "binary") == 0) trace_binary = 1;
+				else {
+					fprintf(stderr, "Erro: formato de trace deve ser text ou binary: %s\n", optarg);
+					return 1;
 				}
-				//bne
-				if (funct3 == 0b001)
+				break;
+			// Binary trace rendering
+			case 'r':
+				render = 1;
+				break;
+			// Memory size (whole pages, at most 2 GiB above the memory offset)
+			case 'm':
 				{
-					int32_t imm_b = 0;
-
-					// Extração do imediato (formato de branch)
-					imm_b |= ((instruction >> 31) & 0x1) << 12;  // Bit 12 (sinal)
-					imm_b |= ((instruction >> 7) & 0x1) << 11;   // Bit 11
-					imm_b |= ((instruction >> 25) & 0x3F) << 5;  // Bits 10-5
-					imm_b |= ((instruction >> 8) & 0xF) << 1;    // Bits 4-1
-
-					// Extensão de sinal
-					imm_b = (imm_b << 19) >> 19;
-
-					uint32_t pc_original = pc;  // Salva o PC atual para impressão
-					int condition = (x[rs1] != x[rs2]);  // Verifica se rs1 é diferente de rs2
-
-					// Atualiza o PC dependendo da condição
-					if (condition) {
-						pc = pc + imm_b;
-					} else {
-						pc = pc + 4;
+					char* suffix;
+					unsigned long long size = strtoull(optarg, &suffix, 0);
+					if(*suffix == 'K' || *suffix == 'k') size <<= 10, suffix++;
+					else if(*suffix == 'M' || *suffix == 'm') size <<= 20, suffix++;
+					else if(*suffix == 'G' || *suffix == 'g') size <<= 30, suffix++;
+					if(*suffix != '\0' || size == 0 || size % PAGE_SIZE != 0 || size > 0x100000000ULL - MEM_OFFSET) {
+						fprintf(stderr, "Erro: tamanho de memoria invalido (multiplo de 4K, ate 2G): %s\n", optarg);
+						return 1;
 					}
-
-					// Impressão detalhada
-					fprintf(output,"0x%08x:bne    %s,%s,0x%03x   (0x%08x!=0x%08x)=%d->pc=0x%08x\n", 
-						pc_original, x_label[rs1], x_label[rs2], 
-						(uint32_t)((imm_b >> 1) & 0xFFF), x[rs1], x[rs2], condition, pc);
+					mem_size = (uint32_t)size;
 				}
-				//beq
-				if (funct3 == 0b000)
+				break;
+			// Number of harts
+			case 'n':
 				{
-					int32_t imm_b = 0;
-
-					imm_b |= ((instruction >> 31) & 0x1) << 12;  // Bit 12 (sinal)
-					imm_b |= ((instruction >> 7) & 0x1) << 11;   // Bit 11
-					imm_b |= ((instruction >> 25) & 0x3F) << 5;  // Bits 10-5
-					imm_b |= ((instruction >> 8) & 0xF) << 1;    // Bits 4-1
-
-					// Extensão de sinal explícita
-					if (imm_b & 0x1000) {  // Se o bit 12 (sinal) for 1, é negativo
-						imm_b |= 0xFFFFE000;  // Estende para 32 bits com 1s
+					char* end;
+					const unsigned long count = strtoul(optarg, &end, 10);
+					if(*end != '\0' || count == 0 || count > HARTS_MAX) {
+						fprintf(stderr, "Erro: numero de harts invalido (1 a %u): %s\n", HARTS_MAX, optarg);
+						return 1;
 					}
-					uint32_t pc_original = pc;
-					int condition;
-					if ((int32_t)x[rs1] == (int32_t)x[rs2]) {
-						condition = 1;
-					} else {
-						condition = 0;
+					hart_count = (uint32_t)count;
+				}
+				break;
+			// Merged trace of all harts
+			case 'M':
+				merge_trace = 1;
+				break;
+			// Timing model (optional settings over the defaults)
+			case 'T':
+				timing = 1;
+				if(optarg != NULL && timing_parse(&timing_config, optarg) != 0) {
+					fprintf(stderr, "Erro: configuracao de timing invalida: %s\n", optarg);
+					return 1;
+				}
+				break;
+			// Branch predictors
+			case 'B':
+				if(branch_parse(predictors, &predictor_count, optarg) != 0) {
+					fprintf(stderr, "Erro: preditores de desvio invalidos: %s\n", optarg);
+					return 1;
+				}
+				break;
+			// Profiler (optional number of hottest entries listed)
+			case 'P':
+				profile = 16;
+				if(optarg != NULL) {
+					char* end;
+					const unsigned long top = strtoul(optarg, &end, 10);
+					if(*end != '\0' || top == 0 || top > 1000000) {
+						fprintf(stderr, "Erro: numero de entradas do perfil invalido: %s\n", optarg);
+						return 1;
 					}
-
-					if (condition) {
-						pc = pc + imm_b;
-					} else {
-						pc = pc + 4;
+					profile = (uint32_t)top;
+				}
+				break;
+			// Snapshot file and point
+			case 's':
+				snapshot.file = optarg;
+				break;
+			case 'a':
+				{
+					char* end;
+					snapshot.at = strtoull(optarg, &end, 10);
+					if(*end != '\0' || snapshot.at == UINT64_MAX) {
+						fprintf(stderr, "Erro: instrucao do snapshot invalida: %s\n", optarg);
+						return 1;
 					}
-						
-					
-					// Impressão ajustada para exibir o imediato corretamente
-					fprintf(output,"0x%08x:beq    %s,%s,0x%03x   (0x%08x==0x%08x)=%d->pc=0x%08x\n",
-							pc_original, x_label[rs1], x_label[rs2],
-							(uint32_t)(imm_b & 0xFFF),  
-							x[rs1], x[rs2], condition, pc);
-			
 				}
-				//bge
-				if (funct3 == 0b101)
+				break;
+			case 'c':
 				{
-					int32_t imm_b = 0;
-
-					imm_b |= ((instruction >> 31) & 0x1) << 12;  // Bit 12 (sinal)
-					imm_b |= ((instruction >> 7) & 0x1) << 11;   // Bit 11
-					imm_b |= ((instruction >> 25) & 0x3F) << 5;  // Bits 10-5
-					imm_b |= ((instruction >> 8) & 0xF) << 1;    // Bits 4-1
-
-					// Extensão de sinal explícita
-					imm_b = (imm_b << 19) >> 19;
-
-					uint32_t pc_original = pc;
-					int condition = ((int32_t)x[rs1] >= (int32_t)x[rs2]) ? 1 : 0;
-					pc = condition ? (pc + imm_b) : (pc + 4);
-						
-					
-					// Impressão ajustada para exibir o imediato corretamente
-					fprintf(output,"0x%08x:bge    %s,%s,0x%03x   (0x%08x>=0x%08x)=%d->pc=0x%08x\n",
-							pc_original, x_label[rs1], x_label[rs2],
-							(uint32_t)((imm_b >> 1)& 0xFFF),  
-							x[rs1], x[rs2], condition, pc);
+					char* end;
+					const unsigned long pc = strtoul(optarg, &end, 16);
+					if(*end != '\0' || pc > 0xFFFFFFFF || pc % 2 != 0) {
+						fprintf(stderr, "Erro: pc do snapshot invalido: %s\n", optarg);
+						return 1;
+					}
+					snapshot.pc = (uint32_t)pc;
 				}
-				//bltu
-				if (funct3 == 0b110)
+				break;
+			// Snapshot input
+			case 'R':
+				restore = 1;
+				break;
+			// Sampled simulation (enabling the timing model)
+			case 'S':
 				{
-					// Extração do imediato para instruções de branch
-					int32_t imm_b = 0;
-
-					imm_b |= ((instruction >> 31) & 0x1) << 12;  // Bit 12 (sinal)
-					imm_b |= ((instruction >> 7) & 0x1) << 11;   // Bit 11
-					imm_b |= ((instruction >> 25) & 0x3F) << 5;  // Bits 10-5
-					imm_b |= ((instruction >> 8) & 0xF) << 1;    // Bits 4-1
-
-					// Extensão de sinal explícita
-					imm_b = (imm_b << 19) >> 19;
-; 
-					uint32_t pc_original = pc;
-					int condition = ((uint32_t)x[rs1] < (uint32_t)x[rs2]) ? 1 : 0;
-					pc = condition ? (pc + imm_b) : (pc + 4);
-
-						
-
-					// Impressão ajustada para exibir o imediato corretamente
-					fprintf(output,"0x%08x:bltu    %s,%s,0x%03x   (0x%08x<0x%08x)=%d->pc=0x%08x\n",
-						pc_original, x_label[rs1], x_label[rs2],
-						(uint32_t)((imm_b >>1) & 0xFFF),  
-						x[rs1], x[rs2], condition, pc);
-
-						
-					
+					const int fields = sscanf(optarg, "%llu:%llu:%llu", &sample_period, &sample_window, &sample_warmup);
+					if(fields < 2 || sample_window == 0 || sample_window + sample_warmup > sample_period) {
+						fprintf(stderr, "Erro: amostragem invalida (PERIODO:JANELA[:AQUECIMENTO]): %s\n", optarg);
+						return 1;
+					}
+					timing = 1;
 				}
-				//bgeu
-				if (funct3 == 0b111)
+				break;
+			// Basic block vectors (optional interval after the last colon)
+			case 'V':
 				{
-					int32_t imm_b = 0;
-
-					imm_b |= ((instruction >> 31) & 0x1) << 12;  // Bit 12 (sinal)
-					imm_b |= ((instruction >> 7) & 0x1) << 11;   // Bit 11
-					imm_b |= ((instruction >> 25) & 0x3F) << 5;  // Bits 10-5
-					imm_b |= ((instruction >> 8) & 0xF) << 1;    // Bits 4-1
-
-					// Extensão de sinal explícita
-					imm_b = (imm_b << 19) >> 19;
- 
-					uint32_t pc_original = pc;
-					int condition = ((uint32_t)x[rs1] >= (uint32_t)x[rs2]) ? 1 : 0;
-					pc = condition ? (pc + imm_b) : (pc + 4);
-						
-					
-					// Impressão ajustada para exibir o imediato corretamente
-					fprintf(output,"0x%08x:bgeu    %s,%s,0x%03x   (0x%08x>=0x%08x)=%d->pc=0x%08x\n",
-							pc_original, x_label[rs1], x_label[rs2],
-							(uint32_t)((imm_b >>1) & 0xFFF),  
-							x[rs1], x[rs2], condition, pc);
+					bbv_file = optarg;
+					char* colon = strrchr(optarg, ':');
+					if(colon != NULL) {
+						char* end;
+						bbv_interval = strtoull(colon + 1, &end, 10);
+						if(*end != '\0' || bbv_interval == 0) {
+							fprintf(stderr, "Erro: intervalo de BBV invalido: %s\n", optarg);
+							return 1;
+						}
+						*colon = '\0';
+					}
 				}
-				
-				
-				
-				
-
-				pc -= 4;
-				
 				break;
-			case 0b1100111:   // JALR (Jump And Link Register)
-
-				// Calculando o imediato de 12 bits (extração de bits do campo da instrução)
-				int32_t imm_jarl = (int32_t)(instruction >> 20);  // Extraindo o imediato de 12 bits
-				imm_jarl = (imm_jarl << 20) >> 20;  // Extensão de sinal para garantir um valor de 32 bits com sinal
-
-				// Calculando o endereço de salto, utilizando rs1 e o imediato
-				uint32_t target_address = (x[rs1] + imm_jarl) & ~1;  // Mascarando para garantir alinhamento
-				int32_t pc_impressao = pc +4;
-
-				// Imprimindo a instrução JALR de forma mais detalhada (ajustando para a saída esperada)
-				fprintf(output,"0x%08x:jalr   %s,%s,0x%03x   pc=0x%08x+0x%08x,%s=0x%08x\n", 
-					pc, x_label[rd], x_label[rs1], imm_jarl, target_address, imm_jarl, x_label[rd], pc_impressao);
-
-				// Atualizando o registrador rd com o endereço de retorno (pc + 4)
-				if (rd != 0) {
-					x[rd] = pc + 4;
+			// Reverse execution (optional checkpoints kept and interval)
+			case 'u':
+				reverse_checkpoints = 64;
+				if(optarg != NULL && (sscanf(optarg, "%u:%llu", &reverse_checkpoints, &reverse_interval) != 2 || reverse_checkpoints == 0 ||
+					reverse_checkpoints > 1000000 || reverse_interval == 0 || reverse_interval > 100000000)) {
+					fprintf(stderr, "Erro: execucao reversa invalida (CHECKPOINTS:INTERVALO): %s\n", optarg);
+					return 1;
 				}
-
-				// Atualizando o PC com o endereço de destino
-				pc = target_address - 4;
-
 				break;
-
-			// I type(0000011)
-			case 0b0000011:{ 
-				uint8_t funct3 = (instruction >> 12) & 0x7; // Extrair o campo funct3
-				//lw
-				if (funct3 == 0b010) {
-					int32_t imm = (int32_t)(instruction >> 20); 
-					imm = (imm << 20) >> 20; 
-
-					// Calculando o endereço de memória
-					uint32_t address = x[rs1] + imm;
-					
-					if(address >= offset && address < 0x80008000){
-						x[rd] = *(uint32_t*)&mem[address - offset];
-					}
-
-					fprintf(output,"0x%08x:lw     %s,0x%03x(%s)       %s=mem[0x%08x]=0x%08x\n", 
-            		pc, x_label[rd], imm, x_label[rs1], (x_label[rd]),address, x[rd]);
-				}	
-
-				//lb
-				if (funct3 == 0b000)
-				{	
-					int32_t imm = (int32_t)(instruction >> 20); 
-					imm = (imm << 20) >> 20;  // Extensão de sinal para o imediato
-
-					// Calculando o endereço de memória
-					uint32_t address = x[rs1] + imm;
-
-					if (address >= offset && address < 0x80008000) {
-						// Carrega um byte da memória e estende o sinal para 32 bits
-						uint8_t byte = *(uint8_t*)&mem[address - offset];  // Leitura de 1 byte da memória
-						x[rd] = (int32_t)(int8_t)byte;  // Extensão de sinal do byte para 32 bits
+			// Moves back after the run (enabling reverse execution)
+			case 'W':
+				{
+					char* end;
+					reverse_last_write = strtoull(optarg, &end, 16);
+					if(*end != '\0' || reverse_last_write > 0xFFFFFFFF) {
+						fprintf(stderr, "Erro: endereco invalido: %s\n", optarg);
+						return 1;
 					}
-
-					fprintf(output,"0x%08x:lb     %s,0x%03x(%s)       %s=mem[0x%08x]=0x%08x\n", 
-						pc, x_label[rd], imm, x_label[rs1], x_label[rd], address, x[rd]);
+					if(reverse_checkpoints == 0) reverse_checkpoints = 64;
 				}
-				//lh
-				if (funct3 == 0b001)
+				break;
+			case 'k':
+			case 'g':
 				{
-					int32_t imm = (int32_t)(instruction >> 20); 
-					imm = (imm << 20) >> 20;  // Extensão de sinal para o imediato
-
-					// Calculando o endereço de memória
-					uint32_t address = x[rs1] + imm;
-
-					if (address >= offset && address < 0x80008000) {
-						// Carrega um byte da memória e estende o sinal para 32 bits
-						uint8_t byte = *(uint16_t*)&mem[address - offset];  // Leitura de 1 byte da memória
-						x[rd] = (int32_t)(int16_t)byte;  // Extensão de sinal do byte para 32 bits
+					char* end;
+					const unsigned long long count = strtoull(optarg, &end, 10);
+					if(*end != '\0' || count == UINT64_MAX) {
+						fprintf(stderr, "Erro: numero de instrucoes invalido: %s\n", optarg);
+						return 1;
 					}
-
-					fprintf(output,"0x%08x:lh     %s,0x%03x(%s)       %s=mem[0x%08x]=0x%08x\n", 
-						pc, x_label[rd], imm, x_label[rs1], x_label[rd], address, x[rd]);
+					if(option == 'k') reverse_back = count;
+					else reverse_to = count;
+					if(reverse_checkpoints == 0) reverse_checkpoints = 64;
 				}
-				//lbu
-				if (funct3 == 0b100)
-				{	
-					int32_t imm = (int32_t)(instruction >> 20); 
-					imm = (imm << 20) >> 20;  // Extensão de sinal para o imediato
-
-					// Calculando o endereço de memória
-					uint32_t address = x[rs1] + imm;
-
-					if (address >= offset && address < 0x80008000) {
-						// Carrega um byte da memória e estende o sinal para 32 bits
-						uint8_t byte = *(uint8_t*)&mem[address - offset];  // Leitura de 1 byte da memória
-						x[rd] = (uint32_t)byte;  // Extensão de sinal do byte para 32 bits
+				break;
+			// GDB stub socket
+			case 'G':
+				gdb = optarg;
+				break;
+			// Lock-step co-simulation
+			case 'C':
+				cosim = 1;
+				break;
+			// Generated program (mix, optional length and seed)
+			case 'X':
+				{
+					char name[16];
+					const int fields = sscanf(optarg, "%15[^:]:%llu:%llu", name, &generate_length, &generate_seed);
+					generate_mix = NULL;
+					for(uint32_t i = 0; fields >= 1 && i < sizeof(generate_mixes) / sizeof(generate_mixes[0]); i++) {
+						if(strcmp(name, generate_mixes[i].name) == 0) generate_mix = &generate_mixes[i];
 					}
-
-					fprintf(output,"0x%08x:lbu     %s,0x%03x(%s)       %s=mem[0x%08x]=0x%08x\n", 
-						pc, x_label[rd], imm, x_label[rs1], x_label[rd], address, x[rd]);
+					if(generate_mix == NULL || generate_length == 0) {
+						fprintf(stderr, "Erro: geracao invalida (alu|mul|mem|branch|mixed[:INSTRUCOES[:SEMENTE]]): %s\n", optarg);
+						return 1;
+					}
+				}
+				break;
+			// Memory-mapped devices (default regions, or only the listed ones)
+			case 'D':
+				devices = 1;
+				memcpy(device_base, device_default, sizeof(device_base));
+				if(optarg != NULL && device_parse(device_base, optarg) != 0) {
+					fprintf(stderr, "Erro: dispositivos invalidos: %s\n", optarg);
+					return 1;
 				}
-				//lhu
-				if (funct3 == 0b101)
+				break;
+			// Batch manifest
+			case 'b':
+				batch_file = optarg;
+				break;
+			// Batch host threads
+			case 'j':
 				{
-					int32_t imm = (int32_t)(instruction >> 20); 
-					imm = (imm << 20) >> 20;  // Extensão de sinal para o imediato
-
-					// Calculando o endereço de memória
-					uint32_t address = x[rs1] + imm;
-
-					if (address >= offset && address < 0x80008000) {
-						// Carrega um halfword (16 bits) da memória e estende para 32 bits com zeros
-						uint16_t halfword = *(uint16_t*)&mem[address - offset];  // Leitura de 2 bytes da memória
-						x[rd] = (uint32_t)halfword;  // Extensão sem sinal para 32 bits
+					char* end;
+					const unsigned long count = strtoul(optarg, &end, 10);
+					if(*end != '\0' || count == 0 || count > 4096) {
+						fprintf(stderr, "Erro: numero de jobs invalido (1 a 4096): %s\n", optarg);
+						return 1;
 					}
-
-					fprintf(output, "0x%08x:lhu     %s,0x%03x(%s)       %s=mem[0x%08x]=0x%08x\n", 
-							pc, x_label[rd], imm, x_label[rs1], x_label[rd], address, x[rd]);
-								
+					jobs = (uint32_t)count;
 				}
-				
-				
-				
-				
-					    		
-			break;
-		}
-			
-			
-			// Jal type (1101111)
-			case 0b1101111:
-				// Calculating operation address
-
-				// Extensão de sinal correta para 21 bits
-				 const int32_t simm = ((int32_t)(imm20 << 11)) >> 11;
-				// Extensão de sinal auxiliar 
-
-				uint32_t simm_aux = ((imm20 >> 20)) ? (0xFFF00000) : (imm20);
-				simm_aux |= (simm_aux & 0x800) ? 0xFFFFF000 : 0x00000000;
-				const uint32_t address = pc + (simm_aux<<1 ) ;
-				// Outputting instruction to console
-				fprintf(output,"0x%08x:jal    %s,0x%05x    pc=0x%08x,%s=0x%08x\n", pc, x_label[rd], simm  , address , x_label[rd], pc + 4);
-				// Updating register if not x[0] (zero)
-				if(rd != 0) x[rd] = pc + 4;
-				// Setting next pc minus 4
-				pc = address - 4;
-				// Breaking case
 				break;
-
-				
-			// Unknown
 			default:
-				// Outputting error message
-				fprintf(output,"error: unknown instruction opcode at pc = 0x%08x\n", pc);
-				// Halting simulation
-				run = 0;
+				return 1;
 		}
-		// Incrementing pc by 4
-		pc = pc + 4;
 	}
+	// Simulation settings
+	config_t config = {
+		.engine = engine,
+		.mem_size = mem_size,
+		.hart_count = hart_count,
+		.merge_trace = merge_trace,
+		.trace_mode = trace_mode,
+		.trace_binary = trace_binary,
+		.trace_pc_first = trace_pc_first,
+		.trace_pc_last = trace_pc_last,
+		.trace_first = trace_first,
+		.trace_count = trace_count,
+		.timing = timing,
+		.timing_config = timing_config,
+		.predictor_count = predictor_count,
+		.profile = profile,
+		.snapshot = snapshot,
+		.restore = restore,
+		.sample_period = sample_period,
+		.sample_window = sample_window,
+		.sample_warmup = sample_warmup,
+		.bbv_file = bbv_file,
+		.bbv_interval = bbv_interval,
+		.reverse_checkpoints = reverse_checkpoints,
+		.reverse_interval = reverse_interval,
+		.reverse_last_write = reverse_last_write,
+		.reverse_back = reverse_back,
+		.reverse_to = reverse_to,
+		.gdb = gdb,
+		.cosim = cosim,
+		.devices = devices,
+		.verbose = (batch_file == NULL)
+	};
+	memcpy(config.predictors, predictors, sizeof(predictors));
+	if(devices) memcpy(config.device_base, device_base, sizeof(device_base));
+	// Snapshots hold a single hart (written from the simulation of a single image)
+	if((snapshot.file != NULL) != (snapshot.at != UINT64_MAX || snapshot.pc != TLB_INVALID)) {
+		fprintf(stderr, "Erro: --snapshot exige --snapshot-at ou --snapshot-pc (e vice-versa)\n");
+		return 1;
+	}
+	if((snapshot.file != NULL || restore) && hart_count != 1) {
+		fprintf(stderr, "Erro: --snapshot e --restore exigem --harts=1\n");
+		return 1;
+	}
+	if(snapshot.file != NULL && batch_file != NULL) {
+		fprintf(stderr, "Erro: --snapshot nao pode ser usado com --batch\n");
+		return 1;
+	}
+	// Sampling and basic block vectors follow a single hart of a single image
+	if((sample_period != 0 || bbv_file != NULL) && (hart_count != 1 || batch_file != NULL)) {
+		fprintf(stderr, "Erro: --sample e --bbv exigem --harts=1, sem --batch\n");
+		return 1;
+	}
+	// Reverse execution follows a single hart of a single image, run in full
+	if(reverse_checkpoints != 0 && (hart_count != 1 || batch_file != NULL || sample_period != 0)) {
+		fprintf(stderr, "Erro: --reverse, --last-write, --step-back e --goto exigem --harts=1, sem --batch ou --sample\n");
+		return 1;
+	}
+	// The debugger follows a single hart of a single image
+	if(gdb != NULL && (hart_count != 1 || batch_file != NULL || sample_period != 0)) {
+		fprintf(stderr, "Erro: --gdb exige --harts=1, sem --batch ou --sample\n");
+		return 1;
+	}
+	// Co-simulation follows a single hart of a single image, run in full
+	if(cosim && (hart_count != 1 || batch_file != NULL || sample_period != 0 || gdb != NULL)) {
+		fprintf(stderr, "Erro: --cosim exige --harts=1, sem --batch, --sample ou --gdb\n");
+		return 1;
+	}
+	// Merged trace lines are only prefixed in the text format
+	if(merge_trace && trace_binary) {
+		fprintf(stderr, "Erro: --merge-trace exige --trace-format=text\n");
+		return 1;
+	}
+	// Running the manifest images instead of a single one
+	if(batch_file != NULL) {
+		FILE* manifest = fopen(batch_file, "r");
+		if(argc != optind || dump_file != NULL || render || manifest == NULL) {
+			fprintf(stderr, "Erro: --batch exige um manifesto legivel, sem entrada, saida, --dump-mem ou --render\n");
+			return 1;
+		}
+		// Outputting separator
+		printf("--------------------------------------------------------------------------------\n");
+		const int status = run_batch(&config, manifest, jobs);
+		fclose(manifest);
+		// Outputting separator
+		printf("--------------------------------------------------------------------------------\n");
+		return status;
+	}
+	// Writing a generated program instead of simulating
+	if(generate_mix != NULL) {
+		FILE* output = (argc - optind == 1) ? fopen(argv[optind], "w") : NULL;
+		if(output == NULL) {
+			fprintf(stderr, "Erro: --generate exige um unico arquivo de saida\n");
+			return 1;
+		}
+		const int status = generate_program(output, generate_mix, generate_length, generate_seed, mem_size);
+		fclose(output);
+		if(status != 0) return 1;
+		// Outputting separator
+		printf("--------------------------------------------------------------------------------\n");
+		return 0;
+	}
+	// Checking input and output arguments
+	if(argc - optind != 2) {
+		fprintf(stderr, "Uso: %s [--engine=interp|threaded|block|jit] [--trace=on|off] [--trace-pc=FIRST:LAST] [--trace-window=FIRST:COUNT] [--dump-mem=FILE] [--trace-format=text|binary] [--render] [--mem-size=SIZE] [--harts=N] [--merge-trace] [--timing[=SETTINGS]] [--bpred=LIST] [--profile[=N]] [--snapshot=FILE --snapshot-at=N|--snapshot-pc=ADDR] [--restore] [--sample=PERIOD:WINDOW[:WARMUP]] [--bbv=FILE[:INTERVAL]] [--reverse[=CHECKPOINTS:INTERVAL]] [--last-write=ADDR] [--step-back=N] [--goto=N] [--gdb=PORT|PATH] [--cosim] [--devices[=LIST]] input output\n       %s [options] --batch=MANIFEST [--jobs=N]\n       %s [--mem-size=SIZE] --generate=MIX[:LENGTH[:SEED]] output\n", argv[0], argv[0], argv[0]);
+		return 1;
+	}
+	// Opening input and output files using proper permissions
+	FILE* input = fopen(argv[optind], "r");
+	FILE* output = fopen(argv[optind + 1], "w");
+	if(input == NULL || output == NULL) {
+		fprintf(stderr, "Erro: nao foi possivel abrir os arquivos de entrada e saida\n");
+		return 1;
+	}
+	// Rendering binary trace instead of simulating
+	if(render) {
+		const int status = trace_render(input, output);
+		fclose(input);
+		fclose(output);
+		return status;
+	}
+	// Simulating the image
+	job_t job = { .input = argv[optind], .output = argv[optind + 1], .dump = dump_file };
+	if(simulate(&config, &job, input, output) != 0) return 1;
 	// Closing input and output files
 	// fclose(input);
 	// fclose(output);
 	// Outputting separator
 	printf("--------------------------------------------------------------------------------\n");
-	// Returning success status
+	// Returning failure on memory faults, the exit code of the halt register
+	// or success
+	if(job.fault) return 1;
+	if(job.exited) return (job.exit_code > 255) ? 255 : (int)(job.exit_code);
 	return 0;
 }